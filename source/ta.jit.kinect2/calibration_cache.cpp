@@ -0,0 +1,252 @@
+/**
+ @file
+ calibration_cache - per-device on-disk cache of tables derived from the
+ calibration data (P0 trig tables, registration maps), memory-mapped on open
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "calibration_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TA_CALIBRATION_CACHE_MAGIC 0x324b4154 // 'TAK2'
+#define TA_CALIBRATION_CACHE_VERSION 1
+#define TA_CALIBRATION_CACHE_ALIGN 64
+
+namespace ta
+{
+
+namespace
+{
+
+struct FileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct FileEntry
+{
+    uint32_t tag;
+    uint32_t reserved;
+    uint64_t key;
+    uint64_t offset;
+    uint64_t size;
+};
+
+std::string sanitize(const std::string &name)
+{
+    std::string out(name);
+    for (size_t i = 0; i < out.size(); i++) {
+        char c = out[i];
+        bool ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '-';
+        if (!ok)
+            out[i] = '_';
+    }
+    return out.empty() ? std::string("unknown") : out;
+}
+
+bool makeDirectories(const std::string &path)
+{
+    for (size_t i = 1; i <= path.size(); i++) {
+        if (i == path.size() || path[i] == '/') {
+            std::string part = path.substr(0, i);
+            if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        size -= (size_t)n;
+    }
+    return true;
+}
+
+uint64_t alignUp(uint64_t offset)
+{
+    return (offset + TA_CALIBRATION_CACHE_ALIGN - 1) & ~(uint64_t)(TA_CALIBRATION_CACHE_ALIGN - 1);
+}
+
+}
+
+CalibrationCache::CalibrationCache(const std::string &directory, const std::string &serial, const std::string &firmware) :
+    directory_(directory),
+    mapping_(0),
+    mapping_size_(0)
+{
+    path_ = directory_ + "/" + sanitize(serial) + "_" + sanitize(firmware) + ".k2cal";
+    map();
+}
+
+CalibrationCache::~CalibrationCache()
+{
+    if (mapping_)
+        munmap(mapping_, mapping_size_);
+    for (size_t i = 0; i < old_mappings_.size(); i++)
+        munmap(old_mappings_[i].first, old_mappings_[i].second);
+}
+
+std::string CalibrationCache::defaultDirectory()
+{
+    const char *home = getenv("HOME");
+#ifdef __APPLE__
+    return std::string(home ? home : "/tmp") + "/Library/Caches/ta.jit.kinect2";
+#else
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0])
+        return std::string(xdg) + "/ta.jit.kinect2";
+    return std::string(home ? home : "/tmp") + "/.cache/ta.jit.kinect2";
+#endif
+}
+
+uint64_t CalibrationCache::hash(const void *data, size_t size, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// maps the file (if there is a valid one) and indexes its sections
+void CalibrationCache::map()
+{
+    sections_.clear();
+
+    int fd = open(path_.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+        close(fd);
+        return;
+    }
+
+    void *mapping = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return;
+
+    size_t size = (size_t)st.st_size;
+    const unsigned char *base = (const unsigned char *)mapping;
+    const FileHeader *header = (const FileHeader *)base;
+
+    if (header->magic != TA_CALIBRATION_CACHE_MAGIC || header->version != TA_CALIBRATION_CACHE_VERSION
+        || sizeof(FileHeader) + (uint64_t)header->count * sizeof(FileEntry) > size) {
+        munmap(mapping, size); // foreign or older format, rebuilt on the next save()
+        return;
+    }
+
+    const FileEntry *entries = (const FileEntry *)(base + sizeof(FileHeader));
+    for (uint32_t i = 0; i < header->count; i++) {
+        const FileEntry &e = entries[i];
+        if (e.offset > size || e.size > size - e.offset || (e.offset % TA_CALIBRATION_CACHE_ALIGN) != 0)
+            continue; // truncated file
+        Section section = { e.key, base + e.offset, (size_t)e.size };
+        sections_[e.tag] = section;
+    }
+
+    mapping_ = mapping;
+    mapping_size_ = size;
+}
+
+const void *CalibrationCache::find(uint32_t tag, uint64_t key, size_t size) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<uint32_t, Section>::const_iterator it = sections_.find(tag);
+    if (it == sections_.end() || it->second.key != key || it->second.size != size)
+        return 0;
+    return it->second.data;
+}
+
+void CalibrationCache::store(uint32_t tag, uint64_t key, const void *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::pair<uint64_t, std::vector<unsigned char> > &section = pending_[tag];
+    section.first = key;
+    section.second.assign((const unsigned char *)data, (const unsigned char *)data + size);
+}
+
+bool CalibrationCache::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (pending_.empty())
+        return true;
+
+    // everything already on disk that was not replaced, plus the new sections
+    std::map<uint32_t, Section> out(sections_);
+    for (std::map<uint32_t, std::pair<uint64_t, std::vector<unsigned char> > >::const_iterator it = pending_.begin(); it != pending_.end(); ++it) {
+        Section section = { it->second.first, it->second.second.empty() ? 0 : &it->second.second[0], it->second.second.size() };
+        out[it->first] = section;
+    }
+
+    if (!makeDirectories(directory_))
+        return false;
+
+    // written next to the final file and renamed, so a reader never sees half a cache
+    std::string temp = path_ + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    FileHeader header = { TA_CALIBRATION_CACHE_MAGIC, TA_CALIBRATION_CACHE_VERSION, (uint32_t)out.size(), 0 };
+    std::vector<FileEntry> entries;
+    uint64_t offset = alignUp(sizeof(FileHeader) + out.size() * sizeof(FileEntry));
+    for (std::map<uint32_t, Section>::const_iterator it = out.begin(); it != out.end(); ++it) {
+        FileEntry e = { it->first, 0, it->second.key, offset, it->second.size };
+        entries.push_back(e);
+        offset = alignUp(offset + it->second.size);
+    }
+
+    bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, &entries[0], entries.size() * sizeof(FileEntry));
+    uint64_t written = sizeof(FileHeader) + entries.size() * sizeof(FileEntry);
+    static const unsigned char zeros[TA_CALIBRATION_CACHE_ALIGN] = { 0 };
+
+    size_t i = 0;
+    for (std::map<uint32_t, Section>::const_iterator it = out.begin(); ok && it != out.end(); ++it, ++i) {
+        ok = writeAll(fd, zeros, (size_t)(entries[i].offset - written)) && writeAll(fd, it->second.data, it->second.size);
+        written = entries[i].offset + it->second.size;
+    }
+
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp.c_str(), path_.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+
+    // pointers handed out by find() point into the old mapping, keep it
+    if (mapping_)
+        old_mappings_.push_back(std::make_pair(mapping_, mapping_size_));
+    mapping_ = 0;
+    mapping_size_ = 0;
+    pending_.clear();
+    map();
+    return true;
+}
+
+} // namespace ta
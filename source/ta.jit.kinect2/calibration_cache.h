@@ -0,0 +1,83 @@
+/**
+ @file
+ calibration_cache - per-device on-disk cache of tables derived from the
+ calibration data (P0 trig tables, registration maps), memory-mapped on open
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_CALIBRATION_CACHE_H
+#define TA_CALIBRATION_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace ta
+{
+
+// One file per device, named after its serial number and firmware version.
+// The file is a list of sections, each with a tag (what table it is), a key
+// (hash of whatever the table was computed from, so a recalibrated device
+// misses instead of getting stale tables) and 64 byte aligned data.
+//
+// find() returns pointers straight into the read-only mapping; they stay valid
+// for the lifetime of the cache, also after save() replaced the file.
+// Everything is called from the session thread, the mutex is just cheap insurance.
+class CalibrationCache
+{
+public:
+    // section tags
+    enum Tag
+    {
+        TrigTables = 0x47495254,        // 'TRIG'
+        RegistrationMaps = 0x50414d52   // 'RMAP'
+    };
+
+    CalibrationCache(const std::string &directory, const std::string &serial, const std::string &firmware);
+    ~CalibrationCache();
+
+    // ~/Library/Caches/ta.jit.kinect2 on the Mac, $XDG_CACHE_HOME (or ~/.cache)/ta.jit.kinect2 elsewhere
+    static std::string defaultDirectory();
+
+    static uint64_t hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL); // FNV-1a
+
+    const std::string &path() const { return path_; }
+
+    // the cached section, or 0 if there is none with this tag, key and size
+    const void *find(uint32_t tag, uint64_t key, size_t size) const;
+
+    // adds or replaces a section (copied), written out by save()
+    void store(uint32_t tag, uint64_t key, const void *data, size_t size);
+
+    // rewrites the file if anything was stored, returns false on I/O errors
+    bool save();
+
+private:
+    CalibrationCache(const CalibrationCache &);
+    CalibrationCache &operator=(const CalibrationCache &);
+
+    struct Section
+    {
+        uint64_t key;
+        const unsigned char *data;
+        size_t size;
+    };
+
+    void map();
+
+    std::string directory_;
+    std::string path_;
+    void *mapping_;
+    size_t mapping_size_;
+    std::vector<std::pair<void *, size_t> > old_mappings_; // kept until destruction, find() results point into them
+    std::map<uint32_t, Section> sections_;                 // what the file on disk holds
+    std::map<uint32_t, std::pair<uint64_t, std::vector<unsigned char> > > pending_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace ta
+
+#endif // TA_CALIBRATION_CACHE_H
@@ -0,0 +1,277 @@
+/**
+ @file
+ cloud_writer - streams point clouds to disk on a background thread, as
+ binary PLY files or one indexed sequence file
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "cloud_writer.h"
+
+#include <cerrno>
+#include <cstring>
+
+#define TA_CLOUD_MAGIC 0x434b4154       // 'TAKC'
+#define TA_CLOUD_FRAME_MAGIC 0x464b4154 // 'TAKF'
+#define TA_CLOUD_INDEX_MAGIC 0x494b4154 // 'TAKI'
+#define TA_CLOUD_VERSION 2 // 2: header flags, depth record
+
+namespace ta
+{
+
+CloudWriter::CloudWriter(const std::string &path, int format, unsigned int flags) :
+    path_(path),
+    format_(format == Sequence ? Sequence : PlyFiles),
+    flags_(format == Sequence ? flags & DepthRecord : 0),
+    file_(0),
+    offset_(0),
+    queued_(0),
+    stop_(false),
+    written_(0),
+    dropped_(0)
+{
+    for (int i = 0; i < Buffers; i++) {
+        staging_[i].count = 0;
+        staging_[i].bytes_per_point = 0;
+        staging_[i].width = 0;
+        staging_[i].height = 0;
+        staging_[i].sequence = 0;
+        staging_[i].timestamp = 0;
+        staging_[i].busy = false;
+    }
+
+    if (format_ == Sequence) {
+        file_ = std::fopen(path_.c_str(), "wb");
+        const uint32_t header[4] = { TA_CLOUD_MAGIC, TA_CLOUD_VERSION, flags_, 0 };
+        if (!file_ || std::fwrite(header, sizeof(header), 1, file_) != 1) {
+            error_ = "could not create " + path_ + ": " + strerror(errno);
+            if (file_)
+                std::fclose(file_);
+            file_ = 0;
+            return;
+        }
+        offset_ = sizeof(header);
+    }
+    thread_ = std::thread(&CloudWriter::ioLoop, this);
+}
+
+CloudWriter::~CloudWriter()
+{
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        thread_.join(); // the loop only leaves with an empty queue
+    }
+
+    if (file_) {
+        const uint64_t index_offset = offset_;
+        for (size_t i = 0; i < index_.size(); i++) {
+            const IndexEntry &e = index_[i];
+            const uint32_t fields[4] = { e.sequence, e.timestamp, e.count, 0 };
+            std::fwrite(&e.offset, sizeof(e.offset), 1, file_);
+            std::fwrite(fields, sizeof(fields), 1, file_);
+        }
+        const uint32_t footer[2] = { TA_CLOUD_INDEX_MAGIC, (uint32_t)index_.size() };
+        std::fwrite(footer, sizeof(footer), 1, file_);
+        std::fwrite(&index_offset, sizeof(index_offset), 1, file_);
+        std::fclose(file_);
+    }
+}
+
+bool CloudWriter::ok() const
+{
+    return thread_.joinable();
+}
+
+std::string CloudWriter::error() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+unsigned long CloudWriter::written() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return written_;
+}
+
+unsigned long CloudWriter::dropped() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+bool CloudWriter::submit(const float *points, int width, int height, const float *uv, const ImageView<const unsigned char> &bgrx,
+                         uint32_t sequence, uint32_t timestamp, const float *depth)
+{
+    // a free staging buffer, or the disk is behind and this frame goes
+    int slot = -1;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (int i = 0; i < Buffers && slot < 0 && ok(); i++) {
+            if (!staging_[i].busy)
+                slot = i;
+        }
+        if (slot < 0 || !points) {
+            dropped_++;
+            return false;
+        }
+        staging_[slot].busy = true;
+    }
+
+    // pack the valid points; the I/O thread does not look at a buffer until it is queued
+    Staging &s = staging_[slot];
+    const bool colour = uv != 0; // the layout follows uv only, so it stays put while colour frames come and go
+    const size_t n = (size_t)width * height;
+    s.bytes_per_point = colour ? 15 : 12;
+    if (s.data.size() < n * s.bytes_per_point)
+        s.data.resize(n * s.bytes_per_point);
+    unsigned char *out = &s.data[0];
+    uint32_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        const float *p = points + 3 * i;
+        if (!(p[2] > 0.0f))
+            continue; // no depth (NaN too)
+        std::memcpy(out, p, 12);
+        if (colour) {
+            out[12] = out[13] = out[14] = 0;
+            if (bgrx.data && uv[2 * i] >= 0.0f) {
+                const int cx = (int)(uv[2 * i] + 0.5f);
+                const int cy = (int)(uv[2 * i + 1] + 0.5f);
+                if (cx < bgrx.width && cy >= 0 && cy < bgrx.height) {
+                    const unsigned char *bgr = bgrx.row(cy) + 4 * cx;
+                    out[12] = bgr[2];
+                    out[13] = bgr[1];
+                    out[14] = bgr[0];
+                }
+            }
+        }
+        out += s.bytes_per_point;
+        count++;
+    }
+    s.count = count;
+    s.width = width;
+    s.height = height;
+    if ((flags_ & DepthRecord) && depth) {
+        s.depth_mm.resize(n);
+        DepthCodec::quantize(depth, &s.depth_mm[0], n);
+    }
+    else {
+        s.depth_mm.clear();
+    }
+    s.sequence = sequence;
+    s.timestamp = timestamp;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_[queued_++] = slot;
+    }
+    cond_.notify_one();
+    return true;
+}
+
+void CloudWriter::ioLoop()
+{
+    for (;;) {
+        int slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return queued_ > 0 || stop_; });
+            if (!queued_)
+                return;
+            slot = queue_[0];
+            for (int i = 1; i < queued_; i++)
+                queue_[i - 1] = queue_[i];
+            queued_--;
+        }
+
+        const bool ok = write(staging_[slot]);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        staging_[slot].busy = false;
+        if (ok)
+            written_++;
+        else
+            dropped_++;
+    }
+}
+
+bool CloudWriter::write(const Staging &staging)
+{
+    return format_ == Sequence ? writeFrame(staging) : writePly(staging);
+}
+
+bool CloudWriter::writePly(const Staging &staging)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "_%06lu.ply", (unsigned long)index_.size());
+    const std::string path = path_ + name;
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        fail("could not create " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    char header[512];
+    int length = snprintf(header, sizeof(header),
+                          "ply\n"
+                          "format binary_little_endian 1.0\n"
+                          "comment ta.jit.kinect2 sequence %u timestamp %u\n"
+                          "element vertex %u\n"
+                          "property float x\n"
+                          "property float y\n"
+                          "property float z\n"
+                          "%s"
+                          "end_header\n",
+                          staging.sequence, staging.timestamp, staging.count,
+                          staging.bytes_per_point == 15 ? "property uchar red\nproperty uchar green\nproperty uchar blue\n" : "");
+    const size_t bytes = (size_t)staging.count * staging.bytes_per_point;
+    bool ok = std::fwrite(header, length, 1, file) == 1 && (!bytes || std::fwrite(&staging.data[0], bytes, 1, file) == 1);
+    ok = std::fclose(file) == 0 && ok;
+    if (!ok) {
+        fail("could not write " + path + ": " + strerror(errno));
+        return false;
+    }
+
+    IndexEntry entry = { 0, staging.sequence, staging.timestamp, staging.count };
+    index_.push_back(entry); // numbers the files
+    return true;
+}
+
+bool CloudWriter::writeFrame(const Staging &staging)
+{
+    size_t depth_bytes = 0;
+    if (!staging.depth_mm.empty()) {
+        if (codec_.width() != staging.width || codec_.height() != staging.height)
+            codec_ = DepthCodec(staging.width, staging.height);
+        if (encoded_.size() < codec_.maxEncodedSize())
+            encoded_.resize(codec_.maxEncodedSize());
+        depth_bytes = codec_.encode(&staging.depth_mm[0], &encoded_[0]);
+    }
+
+    const uint32_t header[6] = { TA_CLOUD_FRAME_MAGIC, staging.sequence, staging.timestamp, staging.count, staging.bytes_per_point, (uint32_t)depth_bytes };
+    const size_t bytes = (size_t)staging.count * staging.bytes_per_point;
+    if (std::fwrite(header, sizeof(header), 1, file_) != 1 || (bytes && std::fwrite(&staging.data[0], bytes, 1, file_) != 1)
+        || (depth_bytes && std::fwrite(&encoded_[0], depth_bytes, 1, file_) != 1)) {
+        fail("could not write " + path_ + ": " + strerror(errno));
+        fseeko(file_, (off_t)offset_, SEEK_SET); // a partial frame would break the stream: the next one overwrites it
+        return false;
+    }
+
+    IndexEntry entry = { offset_, staging.sequence, staging.timestamp, staging.count };
+    index_.push_back(entry);
+    offset_ += sizeof(header) + bytes + depth_bytes;
+    return true;
+}
+
+void CloudWriter::fail(const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (error_.empty())
+        error_ = message;
+}
+
+} // namespace ta
@@ -0,0 +1,141 @@
+/**
+ @file
+ cloud_writer - streams point clouds to disk on a background thread, as
+ binary PLY files or one indexed sequence file
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_CLOUD_WRITER_H
+#define TA_CLOUD_WRITER_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "depth_codec.h"
+#include "frame_convert.h"
+
+namespace ta
+{
+
+// submit() packs the valid points of a frame (x, y, z float32 in the input's
+// units, then r, g, b bytes when there is a uv map) into one of two staging
+// buffers and returns; a thread of its own writes them out. If both buffers
+// are still waiting for the disk the frame is dropped and counted, the
+// caller never waits for I/O.
+//
+// PlyFiles: <path>_000000.ply, <path>_000001.ply, ... binary little endian,
+// the frame's sequence and timestamp in a comment.
+//
+// Sequence: a single file (all integers little endian)
+//     header   'TAKC', version, flags, 0                   4 x uint32
+//     frames   'TAKF', sequence, timestamp, count,          6 x uint32
+//              bytes per point (12 or 15), depth bytes,
+//              then the points, then the depth record
+//     index    per frame: offset of its 'TAKF' (uint64), sequence, timestamp, count, 0
+//     footer   'TAKI', frames (uint32), offset of the index (uint64)
+// The index is written when the writer is destroyed; a file without a
+// footer (crash) can still be read frame by frame from the start.
+// With the DepthRecord flag every frame that was given its raw depth also
+// carries it as a DepthCodec stream (width x height of the points, depth
+// bytes long, 0 = none), so the exact sensor frame can be recovered.
+//
+// Needs no Max and no libfreenect2.
+class CloudWriter
+{
+public:
+    enum Format
+    {
+        PlyFiles = 1,
+        Sequence
+    };
+
+    // header flags (Sequence only)
+    enum Flags
+    {
+        DepthRecord = 1
+    };
+
+    CloudWriter(const std::string &path, int format, unsigned int flags = 0);
+    ~CloudWriter(); // writes whatever is staged, then the index
+
+    // false if the file could not be created (see error())
+    bool ok() const;
+    std::string error() const;
+
+    // points: width x height x 3 (0 z = no point). uv (width x height x 2,
+    // colour pixel, -1 = none) and bgrx are optional; with uv and no bgrx the
+    // points still carry colour, black. depth (width x height in mm, as
+    // libfreenect2 delivers it) is optional and only kept with DepthRecord;
+    // it is quantized here and compressed on the writer's thread. False if dropped.
+    bool submit(const float *points, int width, int height, const float *uv, const ImageView<const unsigned char> &bgrx,
+                uint32_t sequence, uint32_t timestamp, const float *depth = 0);
+
+    unsigned long written() const;
+    unsigned long dropped() const;
+
+private:
+    enum
+    {
+        Buffers = 2
+    };
+
+    struct Staging
+    {
+        std::vector<unsigned char> data;
+        uint32_t count;
+        uint32_t bytes_per_point;
+        std::vector<uint16_t> depth_mm; // empty = no depth record
+        int width;
+        int height;
+        uint32_t sequence;
+        uint32_t timestamp;
+        bool busy; // filled or being written
+    };
+
+    struct IndexEntry
+    {
+        uint64_t offset;
+        uint32_t sequence;
+        uint32_t timestamp;
+        uint32_t count;
+    };
+
+    CloudWriter(const CloudWriter &);
+    CloudWriter &operator=(const CloudWriter &);
+
+    void ioLoop();
+    bool write(const Staging &staging);
+    bool writePly(const Staging &staging);
+    bool writeFrame(const Staging &staging);
+    void fail(const std::string &message);
+
+    std::string path_;
+    int format_;
+    unsigned int flags_;
+    FILE *file_; // Sequence
+    uint64_t offset_;
+    std::vector<IndexEntry> index_;
+    DepthCodec codec_;                  // I/O thread only
+    std::vector<unsigned char> encoded_; // its output
+
+    Staging staging_[Buffers];
+    int queue_[Buffers]; // filled buffers, oldest first
+    int queued_;
+    bool stop_;
+    unsigned long written_;
+    unsigned long dropped_;
+    std::string error_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::thread thread_;
+};
+
+} // namespace ta
+
+#endif // TA_CLOUD_WRITER_H
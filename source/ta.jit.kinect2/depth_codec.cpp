@@ -0,0 +1,280 @@
+/**
+ @file
+ depth_codec - lossless (at millimetre precision) compression of Kinect v2
+ depth frames, fast enough to run on the capture thread
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "depth_codec.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define TA_DEPTH_CODEC_MAGIC 0x444b4154 // 'TAKD'
+#define TA_DEPTH_CODEC_HEADER 16
+
+namespace ta
+{
+
+namespace
+{
+
+struct Header
+{
+    uint32_t magic;
+    uint16_t width;
+    uint16_t height;
+    uint32_t payload; // bytes after the header
+    uint32_t reserved;
+};
+
+inline uint16_t zigzag(uint16_t cur, uint16_t prev)
+{
+    int16_t r = (int16_t)(uint16_t)(cur - prev);
+    return (uint16_t)(((uint16_t)r << 1) ^ (uint16_t)(r >> 15));
+}
+
+inline uint16_t unzigzag(uint16_t z)
+{
+    return (uint16_t)((z >> 1) ^ (uint16_t)(0 - (z & 1)));
+}
+
+inline unsigned char *putVarint(unsigned char *p, uint32_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// continues a LEB128 value whose first byte was already read, false if it runs past end or overflows limit
+inline bool getVarint(const unsigned char *&p, const unsigned char *end, uint32_t first, uint32_t limit, uint32_t &v)
+{
+    v = first & 0x7f;
+    int shift = 7;
+    while (first & 0x80) {
+        if (p >= end || shift > 21)
+            return false;
+        first = *p++;
+        v |= (first & 0x7f) << shift;
+        shift += 7;
+    }
+    return v <= limit;
+}
+
+}
+
+DepthCodec::DepthCodec(int width, int height) :
+    width_(width),
+    height_(height),
+    mm_((size_t)width * height),
+    residual_((size_t)width * height)
+{
+}
+
+size_t DepthCodec::maxEncodedSize() const
+{
+    // a lone zero costs 2 bytes, the largest residual 3
+    return TA_DEPTH_CODEC_HEADER + (size_t)width_ * height_ * 3;
+}
+
+void DepthCodec::quantize(const float *depth, uint16_t *depth_mm, size_t count)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 top = _mm_set1_ps(65535.0f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= count; i += 8) {
+        // max_ps(NaN, 0) is 0; rounding is to nearest even, as lrintf below
+        __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(depth + i), zero), top));
+        __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(depth + i + 4), zero), top));
+        // no unsigned 32 -> 16 pack in SSE2: shift into signed range, pack, shift back
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+        _mm_storeu_si128((__m128i *)(depth_mm + i), _mm_xor_si128(packed, flip));
+    }
+#endif
+    for (; i < count; i++) {
+        float v = depth[i] > 0.0f ? depth[i] : 0.0f;
+        v = v < 65535.0f ? v : 65535.0f;
+        depth_mm[i] = (uint16_t)lrintf(v);
+    }
+}
+
+size_t DepthCodec::encode(const float *depth, unsigned char *out)
+{
+    quantize(depth, &mm_[0], mm_.size());
+    return encode(&mm_[0], out);
+}
+
+size_t DepthCodec::encode(const uint16_t *depth_mm, unsigned char *out)
+{
+    Header header = { TA_DEPTH_CODEC_MAGIC, (uint16_t)width_, (uint16_t)height_, 0, 0 };
+    header.payload = (uint32_t)encodeRows(depth_mm, out + TA_DEPTH_CODEC_HEADER);
+    std::memcpy(out, &header, sizeof(header));
+    return TA_DEPTH_CODEC_HEADER + header.payload;
+}
+
+size_t DepthCodec::encodeRows(const uint16_t *mm, unsigned char *out)
+{
+    const size_t n = residual_.size();
+    uint16_t *z = &residual_[0];
+
+    // prediction from the row above (zeros above the first row)
+    for (int y = 0; y < height_; y++) {
+        const uint16_t *cur = mm + (size_t)y * width_;
+        const uint16_t *prev = y ? cur - width_ : 0;
+        uint16_t *row = z + (size_t)y * width_;
+        int x = 0;
+#if defined(__SSE2__)
+        for (; x + 8 <= width_; x += 8) {
+            __m128i c = _mm_loadu_si128((const __m128i *)(cur + x));
+            __m128i r = prev ? _mm_sub_epi16(c, _mm_loadu_si128((const __m128i *)(prev + x))) : c;
+            _mm_storeu_si128((__m128i *)(row + x), _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15)));
+        }
+#endif
+        for (; x < width_; x++)
+            row[x] = zigzag(cur[x], prev ? prev[x] : 0);
+    }
+
+    unsigned char *p = out;
+    size_t i = 0;
+    while (i < n) {
+        if (z[i] == 0) {
+            size_t j = i + 1;
+#if defined(__SSE2__)
+            const __m128i zero = _mm_setzero_si128();
+            while (j + 8 <= n && _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(z + j)), zero)) == 0xffff)
+                j += 8;
+#endif
+            while (j < n && z[j] == 0)
+                j++;
+            *p++ = 0;
+            p = putVarint(p, (uint32_t)(j - i - 1));
+            i = j;
+            continue;
+        }
+#if defined(__SSE2__)
+        if (i + 8 <= n) {
+            // the common case: eight residuals of 1..127, one byte each
+            __m128i v = _mm_loadu_si128((const __m128i *)(z + i));
+            __m128i is_zero = _mm_cmpeq_epi16(v, _mm_setzero_si128());
+            __m128i is_small = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xff80)), _mm_setzero_si128());
+            if (_mm_movemask_epi8(_mm_andnot_si128(is_zero, is_small)) == 0xffff) {
+                _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(v, v));
+                p += 8;
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        p = putVarint(p, z[i]);
+        i++;
+    }
+    return (size_t)(p - out);
+}
+
+bool DepthCodec::decode(const unsigned char *data, size_t size, float *depth)
+{
+    if (!decode(data, size, &mm_[0]))
+        return false;
+    const uint16_t *mm = &mm_[0];
+    const size_t n = mm_.size();
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(mm + i));
+        _mm_storeu_ps(depth + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)));
+        _mm_storeu_ps(depth + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)));
+    }
+#endif
+    for (; i < n; i++)
+        depth[i] = (float)mm[i];
+    return true;
+}
+
+bool DepthCodec::decode(const unsigned char *data, size_t size, uint16_t *depth_mm)
+{
+    Header header;
+    if (size < TA_DEPTH_CODEC_HEADER)
+        return false;
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != TA_DEPTH_CODEC_MAGIC || header.width != width_ || header.height != height_
+        || header.payload != size - TA_DEPTH_CODEC_HEADER)
+        return false;
+
+    const unsigned char *p = data + TA_DEPTH_CODEC_HEADER;
+    const unsigned char *end = data + size;
+    const size_t n = residual_.size();
+    uint16_t *z = &residual_[0];
+    size_t i = 0;
+
+    while (i < n) {
+#if defined(__SSE2__)
+        if (p + 8 <= end && i + 8 <= n) {
+            // eight literal bytes (no run marker, no varint) widen straight to residuals
+            __m128i v = _mm_loadl_epi64((const __m128i *)p);
+            __m128i zero = _mm_setzero_si128();
+            if ((_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, zero), v)) & 0xff) == 0) {
+                _mm_storeu_si128((__m128i *)(z + i), _mm_unpacklo_epi8(v, zero));
+                p += 8;
+                i += 8;
+                continue;
+            }
+        }
+#endif
+        if (p >= end)
+            return false;
+        uint32_t b = *p++;
+        if (b == 0) {
+            uint32_t run;
+            if (p >= end)
+                return false;
+            uint32_t first = *p++;
+            if (!getVarint(p, end, first, (uint32_t)(n - i - 1), run))
+                return false;
+            std::memset(z + i, 0, (run + 1) * sizeof(uint16_t));
+            i += run + 1;
+        }
+        else {
+            uint32_t v;
+            if (!getVarint(p, end, b, 0xffff, v))
+                return false;
+            z[i++] = (uint16_t)v;
+        }
+    }
+    if (p != end)
+        return false;
+
+    // undo the prediction row by row
+    for (int y = 0; y < height_; y++) {
+        const uint16_t *row = z + (size_t)y * width_;
+        const uint16_t *prev = y ? depth_mm + (size_t)(y - 1) * width_ : 0;
+        uint16_t *cur = depth_mm + (size_t)y * width_;
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i one = _mm_set1_epi16(1);
+        for (; x + 8 <= width_; x += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+            __m128i r = _mm_xor_si128(_mm_srli_epi16(v, 1), _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(v, one)));
+            if (prev)
+                r = _mm_add_epi16(r, _mm_loadu_si128((const __m128i *)(prev + x)));
+            _mm_storeu_si128((__m128i *)(cur + x), r);
+        }
+#endif
+        for (; x < width_; x++)
+            cur[x] = (uint16_t)(unzigzag(row[x]) + (prev ? prev[x] : 0));
+    }
+    return true;
+}
+
+} // namespace ta
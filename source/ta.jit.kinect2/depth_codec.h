@@ -0,0 +1,66 @@
+/**
+ @file
+ depth_codec - lossless (at millimetre precision) compression of Kinect v2
+ depth frames, fast enough to run on the capture thread
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_DEPTH_CODEC_H
+#define TA_DEPTH_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace ta
+{
+
+// The sensor measures whole millimetres, so depth is first rounded to uint16
+// mm (NaN and negative become 0 = invalid, beyond 65535 saturates); from there
+// on the codec is lossless. Every pixel is predicted by the one above it, the
+// difference zigzag-mapped to unsigned and written as a byte stream:
+//
+//     0x00, n            run of n + 1 zero residuals (n as LEB128)
+//     0x01 .. 0x7f       residual 1 .. 127
+//     LEB128 (2-3 bytes) larger residual
+//
+// Invalid areas and flat surfaces turn into zero runs, sensor noise into
+// single bytes. Quantizing, prediction and the common cases of both the
+// encoder and the decoder are SSE2. Needs no Max and no libfreenect2.
+//
+// A codec keeps scratch rows, so use one per thread.
+class DepthCodec
+{
+public:
+    DepthCodec(int width = 512, int height = 424);
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+
+    // upper bound of what encode() writes
+    size_t maxEncodedSize() const;
+
+    // depth in mm as libfreenect2 delivers it, returns the number of bytes written to out
+    size_t encode(const float *depth, unsigned char *out);
+    size_t encode(const uint16_t *depth_mm, unsigned char *out);
+
+    // false if data is not a frame of this size or is truncated/corrupt
+    bool decode(const unsigned char *data, size_t size, float *depth);
+    bool decode(const unsigned char *data, size_t size, uint16_t *depth_mm);
+
+    // float mm to uint16 mm, as encode() sees it
+    static void quantize(const float *depth, uint16_t *depth_mm, size_t count);
+
+private:
+    size_t encodeRows(const uint16_t *mm, unsigned char *out);
+
+    int width_;
+    int height_;
+    std::vector<uint16_t> mm_;       // quantized frame (encode) / decoded frame (decode from float)
+    std::vector<uint16_t> residual_; // one row of zigzag residuals
+};
+
+} // namespace ta
+
+#endif // TA_DEPTH_CODEC_H
@@ -0,0 +1,504 @@
+/**
+ @file
+ depth_kernels - the images DepthStage derives from a Kinect v2 depth frame
+ (registration, pyramid, normals, motion, points), one band of rows at a time
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "depth_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// matrix dimensions
+#define RGB_WIDTH 1920
+#define RGB_HEIGHT 1080
+
+// as in libfreenect2::Registration
+#define FILTER_WIDTH_HALF 2
+#define FILTER_HEIGHT_HALF 1
+
+namespace ta
+{
+
+namespace
+{
+
+// invalid-aware 2x2 reductions: two input rows of 2 * width pixels into one row of width
+
+inline bool valid(float v)
+{
+    return v > 0.0f; // 0 = no depth, NaN fails too
+}
+
+template <int Reduction>
+inline float reduce4(float a, float b, float c, float d)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    a = valid(a) ? a : inf;
+    b = valid(b) ? b : inf;
+    c = valid(c) ? c : inf;
+    d = valid(d) ? d : inf;
+
+    if (Reduction == ReduceMin) {
+        float m = std::min(std::min(a, b), std::min(c, d));
+        return m == inf ? 0.0f : m;
+    }
+
+    // sorting network, invalid (+inf) pixels end up last
+    float t;
+    if (b < a) { t = a; a = b; b = t; }
+    if (d < c) { t = c; c = d; d = t; }
+    if (c < a) { t = a; a = c; c = t; }
+    if (d < b) { t = b; b = d; d = t; }
+    if (c < b) { t = b; b = c; c = t; }
+    int n = (a != inf) + (b != inf) + (c != inf) + (d != inf);
+    switch (n) {
+        case 4: return 0.5f * (b + c);
+        case 3: return b;
+        case 2: return 0.5f * (a + b);
+        case 1: return a;
+        default: return 0.0f;
+    }
+}
+
+template <int Reduction>
+void reduceRow(const float *r0, const float *r1, float *out, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    for (; x + 4 <= width; x += 4) {
+        // even / odd columns of both rows: the four pixels of four blocks
+        __m128 u0 = _mm_loadu_ps(r0 + 2 * x), u1 = _mm_loadu_ps(r0 + 2 * x + 4);
+        __m128 l0 = _mm_loadu_ps(r1 + 2 * x), l1 = _mm_loadu_ps(r1 + 2 * x + 4);
+        __m128 a = _mm_shuffle_ps(u0, u1, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 b = _mm_shuffle_ps(u0, u1, _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 c = _mm_shuffle_ps(l0, l1, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 d = _mm_shuffle_ps(l0, l1, _MM_SHUFFLE(3, 1, 3, 1));
+
+        // invalid -> +inf
+        __m128 va = _mm_cmpgt_ps(a, zero), vb = _mm_cmpgt_ps(b, zero), vc = _mm_cmpgt_ps(c, zero), vd = _mm_cmpgt_ps(d, zero);
+        a = _mm_or_ps(_mm_and_ps(va, a), _mm_andnot_ps(va, inf));
+        b = _mm_or_ps(_mm_and_ps(vb, b), _mm_andnot_ps(vb, inf));
+        c = _mm_or_ps(_mm_and_ps(vc, c), _mm_andnot_ps(vc, inf));
+        d = _mm_or_ps(_mm_and_ps(vd, d), _mm_andnot_ps(vd, inf));
+
+        __m128 result;
+        if (Reduction == ReduceMin) {
+            result = _mm_min_ps(_mm_min_ps(a, b), _mm_min_ps(c, d));
+        }
+        else {
+            __m128 t;
+            t = _mm_min_ps(a, b); b = _mm_max_ps(a, b); a = t;
+            t = _mm_min_ps(c, d); d = _mm_max_ps(c, d); c = t;
+            t = _mm_min_ps(a, c); c = _mm_max_ps(a, c); a = t;
+            t = _mm_min_ps(b, d); d = _mm_max_ps(b, d); b = t;
+            t = _mm_min_ps(b, c); c = _mm_max_ps(b, c); b = t;
+
+            // valid count is 4 - (number of +inf), picked with masks instead of a branch
+            __m128i count = _mm_add_epi32(_mm_add_epi32(_mm_castps_si128(va), _mm_castps_si128(vb)),
+                                              _mm_add_epi32(_mm_castps_si128(vc), _mm_castps_si128(vd))); // -n
+            const __m128 half = _mm_set1_ps(0.5f);
+            __m128 n4 = _mm_castsi128_ps(_mm_cmpeq_epi32(count, _mm_set1_epi32(-4)));
+            __m128 n3 = _mm_castsi128_ps(_mm_cmpeq_epi32(count, _mm_set1_epi32(-3)));
+            __m128 n2 = _mm_castsi128_ps(_mm_cmpeq_epi32(count, _mm_set1_epi32(-2)));
+            __m128 n1 = _mm_castsi128_ps(_mm_cmpeq_epi32(count, _mm_set1_epi32(-1)));
+            result = _mm_or_ps(_mm_or_ps(_mm_and_ps(n4, _mm_mul_ps(half, _mm_add_ps(b, c))), _mm_and_ps(n3, b)),
+                               _mm_or_ps(_mm_and_ps(n2, _mm_mul_ps(half, _mm_add_ps(a, b))), _mm_and_ps(n1, a)));
+        }
+        // a block without any valid pixel stays 0
+        __m128 none = _mm_cmpeq_ps(result, inf);
+        _mm_storeu_ps(out + x, _mm_andnot_ps(none, result));
+    }
+#endif
+    for (; x < width; x++)
+        out[x] = reduce4<Reduction>(r0[2 * x], r0[2 * x + 1], r1[2 * x], r1[2 * x + 1]);
+}
+
+}
+
+/************************************************************************************/
+// bigdepth: the filter map of Registration::apply, each thread owning a band of its rows
+
+void bigDepthRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &bigdepth, int first, int end)
+{
+    const libfreenect2::Freenect2Device::ColorCameraParams &color = maps.color();
+    const float *raw = depth.data;
+    float *out = bigdepth.data; // packed: the filter window wraps across rows as in Registration::apply
+    const int size_color = RGB_WIDTH * RGB_HEIGHT;
+    const float color_cx = color.cx + 0.5f; // 0.5f added for later rounding
+
+    // the band, as linear indices into bigdepth
+    const int band_first = first * RGB_WIDTH;
+    const int band_end = end * RGB_WIDTH;
+
+    std::fill(out + band_first, out + band_end, std::numeric_limits<float>::infinity());
+
+    // bigdepth row of a colour row is cy + FILTER_HEIGHT_HALF, the window reaches
+    // FILTER_HEIGHT_HALF rows further either way and can wrap into the next/previous row
+    for (int y = 0; y < DepthHeight; y++) {
+        if (maps.rowMaxYi(y) + 2 * FILTER_HEIGHT_HALF + 1 < first || maps.rowMinYi(y) - 1 >= end)
+            continue;
+
+        const int *map_dist = maps.distortMap() + y * DepthWidth;
+        const float *map_x = maps.mapX() + y * DepthWidth;
+        const int *map_yi = maps.mapYi() + y * DepthWidth;
+
+        for (int x = 0; x < DepthWidth; x++) {
+            const int index = map_dist[x];
+            if (index < 0)
+                continue;
+
+            const float z = raw[index];
+            if (z <= 0.0f)
+                continue;
+
+            const float rx = (map_x[x] + (color.shift_m / z)) * color.fx + color_cx;
+            const int cx = rx; // same as round for positive numbers (0.5f was already added to color_cx)
+            const int cy = map_yi[x];
+            const int c_off = cx + cy * RGB_WIDTH;
+            if (c_off < 0 || c_off >= size_color)
+                continue;
+
+            // same window as Registration::apply: its first row is cy - 1, which is bigdepth row cy
+            int yi = cy * RGB_WIDTH + cx - FILTER_WIDTH_HALF;
+            for (int r = -FILTER_HEIGHT_HALF; r <= FILTER_HEIGHT_HALF; ++r, yi += RGB_WIDTH) {
+                int i = yi;
+                for (int c = -FILTER_WIDTH_HALF; c <= FILTER_WIDTH_HALF; ++c, ++i) {
+                    if (i >= band_first && i < band_end && z < out[i])
+                        out[i] = z;
+                }
+            }
+        }
+    }
+}
+
+/************************************************************************************/
+// uv map: Registration::apply(dx, dy, dz, cx, cy) for every undistorted depth pixel,
+// dz being the depth it reads through the distortion map (as the whole-image apply)
+
+void uvRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &uv, int first, int end)
+{
+    const libfreenect2::Freenect2Device::ColorCameraParams &color = maps.color();
+    const float *raw = depth.data;
+
+    for (int y = first; y < end; y++) {
+        const int *map_dist = maps.distortMap() + y * DepthWidth;
+        const float *map_x = maps.mapX() + y * DepthWidth;
+        const float *map_y = maps.mapY() + y * DepthWidth;
+        float *out = uv.row(y);
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128 shift_m = _mm_set1_ps(color.shift_m);
+        const __m128 fx = _mm_set1_ps(color.fx);
+        const __m128 cx = _mm_set1_ps(color.cx);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 none = _mm_set1_ps(-1.0f);
+
+        for (; x < DepthWidth; x += 4) {
+            // no gather in SSE2, the four depth reads stay scalar (-1 reads a harmless 0)
+            float z[4];
+            for (int k = 0; k < 4; k++)
+                z[k] = map_dist[x + k] < 0 ? 0.0f : raw[map_dist[x + k]];
+            __m128 dz = _mm_loadu_ps(z);
+            __m128 valid = _mm_cmpgt_ps(dz, zero);
+
+            // rx = (map_x + shift_m / dz) * fx + cx, invalid lanes divide by 1 and are masked
+            __m128 safe = _mm_or_ps(_mm_and_ps(valid, dz), _mm_andnot_ps(valid, _mm_set1_ps(1.0f)));
+            __m128 rx = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(map_x + x), _mm_div_ps(shift_m, safe)), fx), cx);
+            __m128 ry = _mm_loadu_ps(map_y + x);
+            rx = _mm_or_ps(_mm_and_ps(valid, rx), _mm_andnot_ps(valid, none));
+            ry = _mm_or_ps(_mm_and_ps(valid, ry), _mm_andnot_ps(valid, none));
+
+            // interleave to x0 y0 x1 y1 ...
+            _mm_storeu_ps(out + 2 * x, _mm_unpacklo_ps(rx, ry));
+            _mm_storeu_ps(out + 2 * x + 4, _mm_unpackhi_ps(rx, ry));
+        }
+#endif
+
+        for (; x < DepthWidth; x++) {
+            const int index = map_dist[x];
+            const float z = index < 0 ? 0.0f : raw[index];
+            if (z <= 0.0f) {
+                out[2 * x] = -1.0f;
+                out[2 * x + 1] = -1.0f;
+                continue;
+            }
+            out[2 * x] = (map_x[x] + (color.shift_m / z)) * color.fx + color.cx;
+            out[2 * x + 1] = map_y[x];
+        }
+    }
+}
+
+/************************************************************************************/
+// pyramid: each output row of the selected level pulls its 2^level depth rows
+// through the levels while they are in cache, so no level is a separate frame pass
+
+void pyramidRows(const ImageView<const float> &depth, const ImageView<float> *levels, int level, int reduction, int first, int end)
+{
+    for (int r = first; r < end; r++) {
+        for (int l = 1; l <= level; l++) {
+            // the 2^(level - l) rows of level l under output row r, which no other band writes,
+            // from the rows of level l - 1 (the depth itself for level 1) just written
+            const ImageView<float> &out = levels[l - 1];
+            const int width = DepthWidth >> l;
+            const int row = r << (level - l);
+            for (int i = row; i < row + (1 << (level - l)); i++) {
+                const float *r0 = l == 1 ? depth.row(2 * i) : levels[l - 2].row(2 * i);
+                const float *r1 = l == 1 ? depth.row(2 * i + 1) : levels[l - 2].row(2 * i + 1);
+                if (reduction == ReduceMedian)
+                    reduceRow<ReduceMedian>(r0, r1, out.row(i), width);
+                else
+                    reduceRow<ReduceMin>(r0, r1, out.row(i), width);
+            }
+        }
+    }
+}
+
+/************************************************************************************/
+// normals: central differences of the undistorted point cloud (as Registration::getPointXYZ),
+// falling back to one side where a neighbour is invalid or across a depth jump
+
+namespace
+{
+
+// undistorted depth of one row, with an invalid pixel either side
+void undistortRow(const RegistrationMaps &maps, const float *depth, int y, float *row)
+{
+    row[0] = row[DepthWidth + 1] = 0.0f;
+    if (y < 0 || y >= DepthHeight) {
+        std::fill(row + 1, row + DepthWidth + 1, 0.0f);
+        return;
+    }
+    const int *map_dist = maps.distortMap() + y * DepthWidth;
+    for (int x = 0; x < DepthWidth; x++) {
+        const int index = map_dist[x];
+        const float z = index < 0 ? 0.0f : depth[index];
+        row[x + 1] = z > 0.0f ? z : 0.0f; // NaN too
+    }
+}
+
+// neighbours further than this fraction of the centre depth are another surface
+const float NormalMaxJump = 0.05f;
+
+// one pixel, the scalar version of the SSE2 loop: pointers are at the pixel's column
+inline void normalAt(const float *up, const float *mid, const float *down, const float *kx,
+                     float ky_up, float ky, float ky_down, float *out)
+{
+    const float zc = mid[0], zl = mid[-1], zr = mid[1], zu = up[0], zd = down[0];
+    const float limit = NormalMaxJump * zc;
+    const bool vc = zc > 0.0f;
+    const bool vl = zl > 0.0f && std::fabs(zl - zc) <= limit, vr = zr > 0.0f && std::fabs(zr - zc) <= limit;
+    const bool vu = zu > 0.0f && std::fabs(zu - zc) <= limit, vd = zd > 0.0f && std::fabs(zd - zc) <= limit;
+
+    const float cx = kx[0] * zc, cy = ky * zc;
+    const float rx = vr ? kx[1] * zr : cx, ry = vr ? ky * zr : cy, rz = vr ? zr : zc;
+    const float lx = vl ? kx[-1] * zl : cx, ly = vl ? ky * zl : cy, lz = vl ? zl : zc;
+    const float dx = vd ? kx[0] * zd : cx, dy = vd ? ky_down * zd : cy, dz = vd ? zd : zc;
+    const float ux = vu ? kx[0] * zu : cx, uy = vu ? ky_up * zu : cy, uz = vu ? zu : zc;
+
+    // tangents along x and y, normal = ty x tx (faces the camera, -z)
+    const float ax = rx - lx, ay = ry - ly, az = rz - lz;
+    const float bx = dx - ux, by = dy - uy, bz = dz - uz;
+    const float nx = by * az - bz * ay, ny = bz * ax - bx * az, nz = bx * ay - by * ax;
+    const float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+
+    // needs the centre and at least one neighbour along each axis
+    if (vc && length > 0.0f && (vl || vr) && (vu || vd)) {
+        const float inv = 1.0f / length;
+        out[0] = nx * inv;
+        out[1] = ny * inv;
+        out[2] = nz * inv;
+    }
+    else {
+        out[0] = out[1] = out[2] = 0.0f;
+    }
+}
+
+}
+
+void normalRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &normals, int first, int end)
+{
+    const libfreenect2::Freenect2Device::IrCameraParams &ir = maps.depth();
+
+    // x / z and y / z of every column / row, z in mm (units cancel in the normal)
+    float kx[DepthWidth + 2];
+    for (int x = 0; x < DepthWidth + 2; x++)
+        kx[x] = (x - 1 + 0.5f - ir.cx) / ir.fx;
+
+    // rolling window of undistorted rows y - 1, y, y + 1
+    float rows[3][DepthWidth + 2];
+    float *up = rows[0], *mid = rows[1], *down = rows[2];
+    undistortRow(maps, depth.data, first - 1, up);
+    undistortRow(maps, depth.data, first, mid);
+
+    for (int y = first; y < end; y++) {
+        undistortRow(maps, depth.data, y + 1, down);
+        const float ky_up = (y - 1 + 0.5f - ir.cy) / ir.fy;
+        const float ky = (y + 0.5f - ir.cy) / ir.fy;
+        const float ky_down = (y + 1 + 0.5f - ir.cy) / ir.fy;
+        float *out = normals.row(y);
+        int x = 0;
+
+#if defined(__SSE2__)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 jump = _mm_set1_ps(NormalMaxJump);
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 vky_up = _mm_set1_ps(ky_up), vky = _mm_set1_ps(ky), vky_down = _mm_set1_ps(ky_down);
+        for (; x + 4 <= DepthWidth; x += 4) {
+            const __m128 zc = _mm_loadu_ps(mid + x + 1);
+            const __m128 zl = _mm_loadu_ps(mid + x);
+            const __m128 zr = _mm_loadu_ps(mid + x + 2);
+            const __m128 zu = _mm_loadu_ps(up + x + 1);
+            const __m128 zd = _mm_loadu_ps(down + x + 1);
+            const __m128 kc = _mm_loadu_ps(kx + x + 1), kl = _mm_loadu_ps(kx + x), kr = _mm_loadu_ps(kx + x + 2);
+
+            // a neighbour counts when valid and on the same surface: |zn - zc| <= jump * zc
+            const __m128 limit = _mm_mul_ps(jump, zc);
+            const __m128 vc = _mm_cmpgt_ps(zc, zero);
+            const __m128 vl = _mm_and_ps(_mm_cmpgt_ps(zl, zero), _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(zl, zc)), limit));
+            const __m128 vr = _mm_and_ps(_mm_cmpgt_ps(zr, zero), _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(zr, zc)), limit));
+            const __m128 vu = _mm_and_ps(_mm_cmpgt_ps(zu, zero), _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(zu, zc)), limit));
+            const __m128 vd = _mm_and_ps(_mm_cmpgt_ps(zd, zero), _mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(zd, zc)), limit));
+
+            // points: centre, and per side the neighbour or (if it does not count) the centre again
+            const __m128 cx = _mm_mul_ps(kc, zc), cy = _mm_mul_ps(vky, zc);
+#define TA_SELECT(m, a, b) _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+            const __m128 rx = TA_SELECT(vr, _mm_mul_ps(kr, zr), cx), ry = TA_SELECT(vr, _mm_mul_ps(vky, zr), cy), rz = TA_SELECT(vr, zr, zc);
+            const __m128 lx = TA_SELECT(vl, _mm_mul_ps(kl, zl), cx), ly = TA_SELECT(vl, _mm_mul_ps(vky, zl), cy), lz = TA_SELECT(vl, zl, zc);
+            const __m128 dx = TA_SELECT(vd, _mm_mul_ps(kc, zd), cx), dy = TA_SELECT(vd, _mm_mul_ps(vky_down, zd), cy), dz = TA_SELECT(vd, zd, zc);
+            const __m128 ux = TA_SELECT(vu, _mm_mul_ps(kc, zu), cx), uy = TA_SELECT(vu, _mm_mul_ps(vky_up, zu), cy), uz = TA_SELECT(vu, zu, zc);
+#undef TA_SELECT
+
+            // tangents along x and y, normal = ty x tx (faces the camera, -z)
+            const __m128 ax = _mm_sub_ps(rx, lx), ay = _mm_sub_ps(ry, ly), az = _mm_sub_ps(rz, lz);
+            const __m128 bx = _mm_sub_ps(dx, ux), by = _mm_sub_ps(dy, uy), bz = _mm_sub_ps(dz, uz);
+            __m128 nx = _mm_sub_ps(_mm_mul_ps(by, az), _mm_mul_ps(bz, ay));
+            __m128 ny = _mm_sub_ps(_mm_mul_ps(bz, ax), _mm_mul_ps(bx, az));
+            __m128 nz = _mm_sub_ps(_mm_mul_ps(bx, ay), _mm_mul_ps(by, ax));
+            const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+
+            // needs the centre and at least one neighbour along each axis
+            const __m128 ok = _mm_and_ps(_mm_and_ps(vc, _mm_cmpgt_ps(length, zero)), _mm_and_ps(_mm_or_ps(vl, vr), _mm_or_ps(vu, vd)));
+            const __m128 inv = _mm_and_ps(ok, _mm_div_ps(_mm_set1_ps(1.0f), _mm_or_ps(length, _mm_andnot_ps(ok, _mm_set1_ps(1.0f)))));
+            nx = _mm_mul_ps(nx, inv);
+            ny = _mm_mul_ps(ny, inv);
+            nz = _mm_mul_ps(nz, inv);
+
+            // planar to interleaved xyz
+            float px[4], py[4], pz[4];
+            _mm_storeu_ps(px, nx);
+            _mm_storeu_ps(py, ny);
+            _mm_storeu_ps(pz, nz);
+            for (int k = 0; k < 4; k++) {
+                out[3 * (x + k)] = px[k];
+                out[3 * (x + k) + 1] = py[k];
+                out[3 * (x + k) + 2] = pz[k];
+            }
+        }
+#endif
+
+        for (; x < DepthWidth; x++)
+            normalAt(up + x + 1, mid + x + 1, down + x + 1, kx + x + 1, ky_up, ky, ky_down, out + 3 * (size_t)x);
+
+        // slide the window down a row
+        float *t = up;
+        up = mid;
+        mid = down;
+        down = t;
+    }
+}
+
+/************************************************************************************/
+// motion: sum of absolute differences against the previous frame, per 16x16 tile
+
+void motionRows(const ImageView<const float> &depth, const ImageView<float> &previous, const ImageView<float> &motion, int first, int end)
+{
+    for (int ty = first; ty < end; ty++) {
+        const int y0 = ty * MotionTile;
+        const int y1 = std::min(y0 + (int)MotionTile, (int)DepthHeight);
+        float sums[MotionTilesX];
+
+#if defined(__SSE2__)
+        // per tile a vector of four partial sums; NaN differences clamp to the maximum
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 clamp = _mm_set1_ps(MotionMaxDifference);
+        __m128 acc[MotionTilesX];
+        for (int tx = 0; tx < MotionTilesX; tx++)
+            acc[tx] = _mm_setzero_ps();
+        for (int y = y0; y < y1; y++) {
+            const float *cur = depth.row(y);
+            const float *prev = previous.row(y);
+            for (int tx = 0; tx < MotionTilesX; tx++) {
+                const int x0 = tx * MotionTile;
+                __m128 sum = acc[tx];
+                for (int k = 0; k < MotionTile; k += 4) {
+                    __m128 d = _mm_andnot_ps(sign, _mm_sub_ps(_mm_loadu_ps(cur + x0 + k), _mm_loadu_ps(prev + x0 + k)));
+                    sum = _mm_add_ps(sum, _mm_min_ps(d, clamp));
+                }
+                acc[tx] = sum;
+            }
+        }
+        for (int tx = 0; tx < MotionTilesX; tx++) {
+            float lanes[4];
+            _mm_storeu_ps(lanes, acc[tx]);
+            sums[tx] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+#else
+        for (int tx = 0; tx < MotionTilesX; tx++)
+            sums[tx] = 0.0f;
+        for (int y = y0; y < y1; y++) {
+            const float *cur = depth.row(y);
+            const float *prev = previous.row(y);
+            for (int x = 0; x < DepthWidth; x++) {
+                const float d = std::fabs(cur[x] - prev[x]);
+                sums[x / MotionTile] += d < MotionMaxDifference ? d : MotionMaxDifference; // NaN fails the test too
+            }
+        }
+#endif
+
+        const float scale = 1.0f / ((y1 - y0) * MotionTile);
+        float *out = motion.row(ty);
+        for (int tx = 0; tx < MotionTilesX; tx++)
+            out[tx] = sums[tx] * scale;
+
+        // these rows are compared and no other band reads them: keep them for the next frame
+        for (int y = y0; y < y1; y++)
+            std::copy(depth.row(y), depth.row(y) + DepthWidth, previous.row(y));
+    }
+}
+
+/************************************************************************************/
+// points: the undistorted depth back-projected with the IR intrinsics, in metres
+
+void pointRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &points, int first, int end)
+{
+    const libfreenect2::Freenect2Device::IrCameraParams &ir = maps.depth();
+    float row[DepthWidth + 2];
+    float kx[DepthWidth];
+    for (int x = 0; x < DepthWidth; x++)
+        kx[x] = (x + 0.5f - ir.cx) / ir.fx;
+
+    for (int y = first; y < end; y++) {
+        undistortRow(maps, depth.data, y, row);
+        const float ky = (y + 0.5f - ir.cy) / ir.fy;
+        float *out = points.row(y);
+        for (int x = 0; x < DepthWidth; x++, out += 3) {
+            const float z = row[x + 1] * 0.001f; // invalid is already 0
+            out[0] = kx[x] * z;
+            out[1] = ky * z;
+            out[2] = z;
+        }
+    }
+}
+
+} // namespace ta
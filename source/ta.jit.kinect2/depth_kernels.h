@@ -0,0 +1,70 @@
+/**
+ @file
+ depth_kernels - the images DepthStage derives from a Kinect v2 depth frame
+ (registration, pyramid, normals, motion, points), one band of rows at a time
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_DEPTH_KERNELS_H
+#define TA_DEPTH_KERNELS_H
+
+#include "frame_convert.h"
+#include "registration_maps.h"
+
+namespace ta
+{
+
+// Every kernel writes rows [first, end) of its output and reads whatever
+// input rows those need, so a RowPool can split a frame between threads
+// with no band touching another's output. depth is a libfreenect2 depth frame
+// (512x424 float mm, 0 = none); where it goes through the registration maps,
+// which index it linearly, it must be packed. Outputs are caller-owned.
+// Needs no Max and no libfreenect2 (the camera parameters come from its headers).
+enum
+{
+    DepthWidth = 512,
+    DepthHeight = 424,
+    BigDepthWidth = 1920,
+    BigDepthHeight = 1082, // colour rows plus one filter row above and below
+    PyramidLevels = 3,     // 256x212, 128x106, 64x53
+    MotionTile = 16,
+    MotionTilesX = (DepthWidth + MotionTile - 1) / MotionTile,
+    MotionTilesY = (DepthHeight + MotionTile - 1) / MotionTile, // the last row of tiles is 8 pixels high
+    MotionTiles = MotionTilesX * MotionTilesY
+};
+
+// how pyramidRows reduces each 2x2 block of valid (> 0) pixels
+enum PyramidReduction
+{
+    ReduceMin = 0,
+    ReduceMedian
+};
+
+// a motion pixel counts at most this many mm, so a pixel flickering between no depth and
+// depth (edges, hair, glass) cannot mark a tile alone
+const float MotionMaxDifference = 200.0f;
+
+// bigdepth (packed 1920 x 1082) as Registration::apply's, its rows [first, end)
+void bigDepthRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &bigdepth, int first, int end);
+
+// uv (512 x 424 x 2): colour pixel (x, y) of every undistorted depth pixel, -1 if none
+void uvRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &uv, int first, int end);
+
+// levels[l - 1] ((512 >> l) x (424 >> l)) for l = 1 .. level, 0 where a block had no valid pixel;
+// first / end are rows of the deepest level, whose source rows are read once
+void pyramidRows(const ImageView<const float> &depth, const ImageView<float> *levels, int level, int reduction, int first, int end);
+
+// normals (512 x 424 x 3): unit normals of the undistorted depth facing the camera, 0 where invalid
+void normalRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &normals, int first, int end);
+
+// motion (MotionTilesX x MotionTilesY): mean clamped |depth - previous| in mm per tile, for tile
+// rows [first, end); those rows of depth are then copied into previous (512 x 424)
+void motionRows(const ImageView<const float> &depth, const ImageView<float> &previous, const ImageView<float> &motion, int first, int end);
+
+// points (512 x 424 x 3): the undistorted depth back-projected with the IR intrinsics, in metres
+void pointRows(const RegistrationMaps &maps, const ImageView<const float> &depth, const ImageView<float> &points, int first, int end);
+
+} // namespace ta
+
+#endif // TA_DEPTH_KERNELS_H
@@ -0,0 +1,228 @@
+/**
+ @file
+ depth_stage - derives extra images from every depth frame on the depth
+ processor thread, before the frame reaches the listeners
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "depth_stage.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace ta
+{
+
+DepthStage::DepthStage(libfreenect2::FrameListener *next, size_t num_threads) :
+    next_(next),
+    pool_(num_threads),
+    maps_(0),
+    products_(0),
+    pyramid_level_(1),
+    pyramid_reduction_(ReduceMin),
+    motion_threshold_(15.0f),
+    sink_(0),
+    previous_(0),
+    has_previous_(false),
+    age_(0)
+{
+    for (int i = 0; i < Slots; i++) {
+        slots_[i].products.sequence = 0;
+        slots_[i].products.valid = 0;
+        slots_[i].products.bigdepth = 0;
+        slots_[i].products.uv = 0;
+        for (int l = 0; l < PyramidLevels; l++)
+            slots_[i].products.pyramid[l] = 0;
+        slots_[i].products.pyramid_level = 0;
+        slots_[i].products.normals = 0;
+        slots_[i].products.motion = 0;
+        slots_[i].products.changed = 0;
+        slots_[i].products.changed_count = 0;
+        slots_[i].products.activity = 0.0f;
+        slots_[i].products.points = 0;
+        slots_[i].ready = false;
+        slots_[i].pinned = false;
+        slots_[i].age = 0;
+    }
+}
+
+DepthStage::~DepthStage()
+{
+    for (int i = 0; i < Slots; i++) {
+        std::free(slots_[i].products.bigdepth);
+        std::free(slots_[i].products.uv);
+        std::free(slots_[i].products.pyramid[0]);
+        std::free(slots_[i].products.normals);
+        std::free(slots_[i].products.motion);
+        std::free(slots_[i].products.changed);
+        std::free(slots_[i].products.points);
+    }
+    std::free(previous_);
+}
+
+bool DepthStage::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    const RegistrationMaps *maps = maps_.load();
+    unsigned int products = products_.load();
+
+    capture_policy_.apply(); // a refusal is kept for captureThreadPolicyFailed()
+
+    if (type == libfreenect2::Frame::Depth && !(products & Motion))
+        has_previous_ = false; // a later Motion compares with its own first frame, not a stale one
+
+    // bigdepth, uv, normals and points need the registration maps, pyramid and motion only the depth
+    if (type == libfreenect2::Frame::Depth && products) {
+        // oldest slot nobody is reading (the newest two stay available)
+        Slot *slot = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int i = 0; i < Slots; i++) {
+                if (!slots_[i].pinned && (!slot || slots_[i].age < slot->age))
+                    slot = &slots_[i];
+            }
+            slot->ready = false;
+        }
+
+        DepthProducts &out = slot->products;
+        out.valid = 0;
+        const ImageView<const float> depth = ImageView<const float>::packed((const float *)frame->data, DepthWidth, DepthHeight, 1);
+
+        if ((products & BigDepth) && maps) {
+            if (!out.bigdepth)
+                out.bigdepth = (float *)std::malloc(BigDepthWidth * BigDepthHeight * sizeof(float));
+            const ImageView<float> bigdepth = ImageView<float>::packed(out.bigdepth, BigDepthWidth, BigDepthHeight, 1);
+            pool_.run([maps, &depth, &bigdepth](int first, int end) {
+                bigDepthRows(*maps, depth, bigdepth, first, end);
+            }, BigDepthHeight);
+            out.valid |= BigDepth;
+        }
+
+        if ((products & UvMap) && maps) {
+            if (!out.uv)
+                out.uv = (float *)std::malloc(DepthWidth * DepthHeight * 2 * sizeof(float));
+            const ImageView<float> uv = ImageView<float>::packed(out.uv, DepthWidth, DepthHeight, 2);
+            pool_.run([maps, &depth, &uv](int first, int end) {
+                uvRows(*maps, depth, uv, first, end);
+            }, DepthHeight);
+            out.valid |= UvMap;
+        }
+
+        if (products & Pyramid) {
+            // one pass: every band reads its depth rows once and reduces them down to the selected level,
+            // keeping the levels in between
+            if (!out.pyramid[0]) {
+                size_t size = 0;
+                for (int l = 1; l <= PyramidLevels; l++)
+                    size += (DepthWidth >> l) * (DepthHeight >> l);
+                out.pyramid[0] = (float *)std::malloc(size * sizeof(float));
+                for (int l = 1; l < PyramidLevels; l++)
+                    out.pyramid[l] = out.pyramid[l - 1] + (DepthWidth >> l) * (DepthHeight >> l);
+            }
+            ImageView<float> levels[PyramidLevels];
+            for (int l = 1; l <= PyramidLevels; l++)
+                levels[l - 1] = ImageView<float>::packed(out.pyramid[l - 1], DepthWidth >> l, DepthHeight >> l, 1);
+            const int level = pyramid_level_.load();
+            const int reduction = pyramid_reduction_.load();
+            pool_.run([&depth, &levels, level, reduction](int first, int end) {
+                pyramidRows(depth, levels, level, reduction, first, end);
+            }, DepthHeight >> level);
+            out.pyramid_level = level;
+            out.valid |= Pyramid;
+        }
+
+        if ((products & Normals) && maps) {
+            if (!out.normals)
+                out.normals = (float *)std::malloc(DepthWidth * DepthHeight * 3 * sizeof(float));
+            const ImageView<float> normals = ImageView<float>::packed(out.normals, DepthWidth, DepthHeight, 3);
+            pool_.run([maps, &depth, &normals](int first, int end) {
+                normalRows(*maps, depth, normals, first, end);
+            }, DepthHeight);
+            out.valid |= Normals;
+        }
+
+        if (products & Motion) {
+            if (!out.motion) {
+                out.motion = (float *)std::malloc(MotionTiles * sizeof(float));
+                out.changed = (uint16_t *)std::malloc(MotionTiles * sizeof(uint16_t));
+            }
+            if (!previous_)
+                previous_ = (float *)std::malloc(DepthWidth * DepthHeight * sizeof(float));
+            float *motion = out.motion;
+            if (has_previous_) {
+                const ImageView<float> previous = ImageView<float>::packed(previous_, DepthWidth, DepthHeight, 1);
+                const ImageView<float> tiles = ImageView<float>::packed(motion, MotionTilesX, MotionTilesY, 1);
+                pool_.run([&depth, &previous, &tiles](int first, int end) {
+                    motionRows(depth, previous, tiles, first, end);
+                }, MotionTilesY);
+            }
+            else {
+                // nothing to compare the first frame with: all of it is new
+                std::fill(motion, motion + MotionTiles, MotionMaxDifference);
+                std::copy(depth.data, depth.data + DepthWidth * DepthHeight, previous_);
+                has_previous_ = true;
+            }
+
+            const float threshold = motion_threshold_.load();
+            int count = 0;
+            for (int i = 0; i < MotionTiles; i++) {
+                if (motion[i] > threshold)
+                    out.changed[count++] = (uint16_t)i;
+            }
+            out.changed_count = count;
+            out.activity = (float)count / MotionTiles;
+            out.valid |= Motion;
+        }
+
+        if ((products & Points) && maps) {
+            if (!out.points)
+                out.points = (float *)std::malloc(DepthWidth * DepthHeight * 3 * sizeof(float));
+            const ImageView<float> points = ImageView<float>::packed(out.points, DepthWidth, DepthHeight, 3);
+            pool_.run([maps, &depth, &points](int first, int end) {
+                pointRows(*maps, depth, points, first, end);
+            }, DepthHeight);
+            out.valid |= Points;
+            PointSink *sink = sink_.load();
+            if (sink)
+                sink->onPoints(out.points, DepthWidth, DepthHeight);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.sequence = frame->sequence;
+        slot->age = ++age_;
+        slot->ready = true;
+    }
+
+    return next_->onNewFrame(type, frame);
+}
+
+void DepthStage::setPyramid(int level, int reduction)
+{
+    pyramid_level_.store(level < 1 ? 1 : level > PyramidLevels ? PyramidLevels : level);
+    pyramid_reduction_.store(reduction == ReduceMedian ? ReduceMedian : ReduceMin);
+}
+
+const DepthProducts *DepthStage::acquire(uint32_t sequence)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < Slots; i++) {
+        if (slots_[i].ready && slots_[i].products.sequence == sequence) {
+            slots_[i].pinned = true;
+            return &slots_[i].products;
+        }
+    }
+    return 0;
+}
+
+void DepthStage::release(const DepthProducts *products)
+{
+    if (!products)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < Slots; i++) {
+        if (&slots_[i].products == products)
+            slots_[i].pinned = false;
+    }
+}
+
+} // namespace ta
@@ -0,0 +1,138 @@
+/**
+ @file
+ depth_stage - derives extra images from every depth frame on the depth
+ processor thread, before the frame reaches the listeners
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_DEPTH_STAGE_H
+#define TA_DEPTH_STAGE_H
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+#include <frame_listener.hpp>
+
+#include "depth_kernels.h"
+#include "row_pool.h"
+#include "thread_policy.h"
+
+namespace ta
+{
+
+// What DepthStage computed for one depth frame. Only the products that were
+// enabled (and possible: bigdepth, uv, normals and points need the maps) are valid.
+struct DepthProducts
+{
+    uint32_t sequence;  // of the depth frame they belong to
+    unsigned int valid; // DepthStage::Product bits
+    float *bigdepth;    // 1920 x 1082, depth in colour camera space (as Registration::apply's bigdepth)
+    float *uv;          // 512 x 424 x 2 interleaved, colour pixel (x, y) of every undistorted depth pixel, -1 if none
+    float *pyramid[PyramidLevels]; // level l at [l - 1]: (512 >> l) x (424 >> l) reduced depth, 0 where the whole block was invalid
+    int pyramid_level;  // the selected level, every level from 1 up to it is valid
+    float *normals;     // 512 x 424 x 3 interleaved unit normals of the undistorted depth, facing the camera, 0 where invalid
+    float *motion;      // 32 x 27 tiles of 16 x 16 raw depth pixels: mean clamped |depth - previous depth| in mm
+    uint16_t *changed;  // indices (row * 32 + column) of the tiles above the motion threshold, ascending
+    int changed_count;
+    float activity;     // changed tiles / all tiles, 0 .. 1
+    float *points;      // 512 x 424 x 3 interleaved undistorted points in metres (as Registration::getPointXYZ), 0 where invalid
+};
+
+// Gets the Points product of every depth frame on the depth processor
+// thread, right after it is computed (points stay valid during the call).
+class PointSink
+{
+public:
+    virtual ~PointSink() {}
+    virtual void onPoints(const float *points, int width, int height) = 0;
+};
+
+// FrameListener in front of the depth listener: for each depth frame it
+// computes the enabled products (the kernels of depth_kernels.h) row-parallel
+// on its own RowPool, then passes
+// the frame on. Products sit in a few slots keyed by frame sequence, so
+// whoever takes depth frame N from the listener can fetch N's products even
+// if N+1 is already being processed.
+class DepthStage : public libfreenect2::FrameListener
+{
+public:
+    enum Product
+    {
+        BigDepth = 1,
+        UvMap = 2,
+        Pyramid = 4,
+        Normals = 8,
+        Motion = 16,
+        Points = 32
+    };
+
+    DepthStage(libfreenect2::FrameListener *next, size_t num_threads);
+    virtual ~DepthStage();
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+    // maps must stay alive until the stage is gone or another one is set
+    void setRegistration(const RegistrationMaps *maps) { maps_.store(maps); }
+
+    // Product bits, may be changed while streaming
+    void setProducts(unsigned int products) { products_.store(products); }
+
+    // pyramid level (1 .. PyramidLevels) and PyramidReduction, may be changed while streaming
+    void setPyramid(int level, int reduction);
+
+    // mean clamped difference in mm above which a tile counts as changed, may be changed while streaming
+    void setMotionThreshold(float threshold) { motion_threshold_.store(threshold); }
+
+    // receives the points while Points is on (0 = nobody), must outlive the stage
+    void setPointSink(PointSink *sink) { sink_.store(sink); }
+
+    // the worker threads of its RowPool, false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error) { return pool_.setThreadPolicy(policy, error); }
+
+    // applied by the next depth frame, on the thread that delivers it (libfreenect2's depth processor thread)
+    void setCaptureThreadPolicy(const ThreadPolicy &policy) { capture_policy_.set(policy); }
+
+    // true once, with why, after that thread refused the capture policy
+    bool captureThreadPolicyFailed(std::string &error) { return capture_policy_.failed(error); }
+
+    // the products of depth frame sequence (0 if there are none), pinned until release()
+    const DepthProducts *acquire(uint32_t sequence);
+    void release(const DepthProducts *products);
+
+private:
+    enum
+    {
+        Slots = 4 // one being read, two published, one being written
+    };
+
+    struct Slot
+    {
+        DepthProducts products;
+        bool ready;
+        bool pinned;
+        unsigned long age;
+    };
+
+    libfreenect2::FrameListener *next_;
+    RowPool pool_;
+    std::atomic<const RegistrationMaps *> maps_;
+    std::atomic<unsigned int> products_;
+    std::atomic<int> pyramid_level_;
+    std::atomic<int> pyramid_reduction_;
+    std::atomic<float> motion_threshold_;
+    std::atomic<PointSink *> sink_;
+    DeferredThreadPolicy capture_policy_;
+
+    float *previous_; // last depth frame seen while Motion was on (depth processor thread only)
+    bool has_previous_;
+
+    Slot slots_[Slots];
+    unsigned long age_;
+    std::mutex mutex_;
+};
+
+} // namespace ta
+
+#endif // TA_DEPTH_STAGE_H
@@ -0,0 +1,237 @@
+/**
+ @file
+ frame_convert - copies and converts frames into caller-owned images
+ described as a pointer plus row stride, no Max involved
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "frame_convert.h"
+
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ta
+{
+
+namespace
+{
+
+/************************************************************************************/
+// element conversions, picked at compile time by the destination type
+
+// colour bytes: char and long keep 0..255, floats get 0..1
+template <typename T> inline T fromByte(unsigned char b) { return (T)b; }
+template <> inline float fromByte<float>(unsigned char b) { return b * (1.0f / 255.0f); }
+template <> inline double fromByte<double>(unsigned char b) { return b * (1.0 / 255.0); }
+
+// float values: char scaled, offset and clamped, long rounded, non-finite -> 0 for both
+template <typename T> inline T fromFloat(float v, float scale, float offset);
+template <> inline unsigned char fromFloat<unsigned char>(float v, float scale, float offset)
+{
+    if (!std::isfinite(v))
+        return 0;
+    v = v * scale + offset;
+    return v > 0.0f ? (v < 255.0f ? (unsigned char)(v + 0.5f) : 255) : 0;
+}
+template <> inline int32_t fromFloat<int32_t>(float v, float, float)
+{
+    return (v > -2147483520.0f && v < 2147483520.0f) ? (int32_t)lrintf(v) : 0;
+}
+template <> inline float fromFloat<float>(float v, float, float) { return v; }
+template <> inline double fromFloat<double>(float v, float, float) { return v; }
+
+inline unsigned char luma(const unsigned char *bgrx)
+{
+    return (unsigned char)((29 * bgrx[0] + 150 * bgrx[1] + 77 * bgrx[2] + 128) >> 8); // ITU-R 601
+}
+
+/************************************************************************************/
+// colour kernels: Planes is the destination planecount, 0 = any (read at run time)
+
+template <typename T, int Planes>
+void colorRows(const ImageView<const unsigned char> &in, const ImageView<T> &out, int width, int height)
+{
+    const int planes = Planes ? Planes : out.planes;
+    for (int y = 0; y < height; y++) {
+        const unsigned char *s = in.row(y);
+        T *d = out.row(y);
+        for (int x = 0; x < width; x++, s += 4, d += planes) {
+            if (Planes == 1) {
+                d[0] = fromByte<T>(luma(s));
+            }
+            else if (Planes == 2) {
+                d[0] = fromByte<T>(s[3]);
+                d[1] = fromByte<T>(luma(s));
+            }
+            else if (Planes == 3) {
+                d[0] = fromByte<T>(s[2]);
+                d[1] = fromByte<T>(s[1]);
+                d[2] = fromByte<T>(s[0]);
+            }
+            else {
+                d[0] = fromByte<T>(s[3]);
+                d[1] = fromByte<T>(s[2]);
+                d[2] = fromByte<T>(s[1]);
+                d[3] = fromByte<T>(s[0]);
+                for (int k = 4; k < planes; k++)
+                    d[k] = 0;
+            }
+        }
+    }
+}
+
+// the default output (char ARGB) is a byte swap of every 32 bit pixel
+template <>
+void colorRows<unsigned char, 4>(const ImageView<const unsigned char> &in, const ImageView<unsigned char> &out, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const unsigned char *s = in.row(y);
+        unsigned char *d = out.row(y);
+        int x = 0;
+#if defined(__SSE2__)
+        const __m128i lo = _mm_set1_epi32(0x0000ff00);
+        const __m128i hi = _mm_set1_epi32(0x00ff0000);
+        for (; x + 4 <= width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + 4 * x));
+            __m128i swapped = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(v, 24), _mm_srli_epi32(v, 24)),
+                                           _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), hi),
+                                                        _mm_and_si128(_mm_srli_epi32(v, 8), lo)));
+            _mm_storeu_si128((__m128i *)(d + 4 * x), swapped);
+        }
+#endif
+        for (; x < width; x++) {
+            d[4 * x] = s[4 * x + 3];     // alpha
+            d[4 * x + 1] = s[4 * x + 2]; // red
+            d[4 * x + 2] = s[4 * x + 1]; // green
+            d[4 * x + 3] = s[4 * x];     // blue
+        }
+    }
+}
+
+template <typename T>
+void colorDispatch(const ImageView<const unsigned char> &in, const MatrixView &out, int width, int height)
+{
+    ImageView<T> view((T *)out.data, out.width, out.height, out.planes, out.stride);
+    switch (out.planes) {
+        case 1: colorRows<T, 1>(in, view, width, height); break;
+        case 2: colorRows<T, 2>(in, view, width, height); break;
+        case 3: colorRows<T, 3>(in, view, width, height); break;
+        case 4: colorRows<T, 4>(in, view, width, height); break;
+        default: colorRows<T, 0>(in, view, width, height); break;
+    }
+}
+
+/************************************************************************************/
+// float kernels: SrcPlanes / Planes are the source / destination planecounts, 0 = any
+
+template <typename T, int SrcPlanes, int Planes>
+void floatRows(const ImageView<const float> &in, float scale, float offset, const ImageView<T> &out, int width, int height)
+{
+    const int src_planes = SrcPlanes ? SrcPlanes : in.planes;
+    const int planes = Planes ? Planes : out.planes;
+    for (int y = 0; y < height; y++) {
+        const float *s = in.row(y);
+        T *d = out.row(y);
+        for (int x = 0; x < width; x++, s += src_planes, d += planes) {
+            if (SrcPlanes == 1) {
+                const T v = fromFloat<T>(s[0], scale, offset);
+                for (int k = 0; k < planes; k++)
+                    d[k] = v;
+            }
+            else {
+                for (int k = 0; k < planes; k++)
+                    d[k] = k < src_planes ? fromFloat<T>(s[k], scale, offset) : 0;
+            }
+        }
+    }
+}
+
+// same layout in and out is a plain copy
+template <int Planes>
+void copyRows(const ImageView<const float> &in, const ImageView<float> &out, int width, int height)
+{
+    const size_t bytes = (size_t)width * Planes * sizeof(float);
+    for (int y = 0; y < height; y++)
+        std::memcpy(out.row(y), in.row(y), bytes);
+}
+
+template <typename T, int SrcPlanes>
+void floatDispatchPlanes(const ImageView<const float> &in, float scale, float offset, const ImageView<T> &out, int width, int height)
+{
+    switch (out.planes) {
+        case 1: floatRows<T, SrcPlanes, 1>(in, scale, offset, out, width, height); break;
+        case 2: floatRows<T, SrcPlanes, 2>(in, scale, offset, out, width, height); break;
+        case 3: floatRows<T, SrcPlanes, 3>(in, scale, offset, out, width, height); break;
+        case 4: floatRows<T, SrcPlanes, 4>(in, scale, offset, out, width, height); break;
+        default: floatRows<T, SrcPlanes, 0>(in, scale, offset, out, width, height); break;
+    }
+}
+
+template <typename T>
+void floatDispatch(const ImageView<const float> &in, float scale, float offset, const MatrixView &out, int width, int height)
+{
+    ImageView<T> view((T *)out.data, out.width, out.height, out.planes, out.stride);
+    switch (in.planes) {
+        case 1: floatDispatchPlanes<T, 1>(in, scale, offset, view, width, height); break;
+        case 2: floatDispatchPlanes<T, 2>(in, scale, offset, view, width, height); break;
+        case 3: floatDispatchPlanes<T, 3>(in, scale, offset, view, width, height); break;
+        default: floatDispatchPlanes<T, 0>(in, scale, offset, view, width, height); break;
+    }
+}
+
+}
+
+bool convertColor(const ImageView<const unsigned char> &bgrx, const MatrixView &out)
+{
+    if (!bgrx.data || !out.data || bgrx.planes != 4 || out.planes < 1)
+        return false;
+    const int width = bgrx.width < out.width ? bgrx.width : out.width;
+    const int height = bgrx.height < out.height ? bgrx.height : out.height;
+
+    switch (out.type) {
+        case ElementChar: colorDispatch<unsigned char>(bgrx, out, width, height); break;
+        case ElementLong: colorDispatch<int32_t>(bgrx, out, width, height); break;
+        case ElementFloat32: colorDispatch<float>(bgrx, out, width, height); break;
+        case ElementFloat64: colorDispatch<double>(bgrx, out, width, height); break;
+    }
+    return true;
+}
+
+bool convertFloat(const ImageView<const float> &src, float char_scale, const MatrixView &out)
+{
+    return convertFloat(src, char_scale, 0.0f, out);
+}
+
+bool convertFloat(const ImageView<const float> &src, float char_scale, float char_offset, const MatrixView &out)
+{
+    if (!src.data || !out.data || src.planes < 1 || out.planes < 1)
+        return false;
+    const int width = src.width < out.width ? src.width : out.width;
+    const int height = src.height < out.height ? src.height : out.height;
+
+    if (out.type == ElementFloat32 && out.planes == src.planes && src.planes <= 3) {
+        ImageView<float> view((float *)out.data, out.width, out.height, out.planes, out.stride);
+        switch (src.planes) {
+            case 1: copyRows<1>(src, view, width, height); break;
+            case 2: copyRows<2>(src, view, width, height); break;
+            default: copyRows<3>(src, view, width, height); break;
+        }
+        return true;
+    }
+
+    switch (out.type) {
+        case ElementChar: floatDispatch<unsigned char>(src, char_scale, char_offset, out, width, height); break;
+        case ElementLong: floatDispatch<int32_t>(src, char_scale, char_offset, out, width, height); break;
+        case ElementFloat32: floatDispatch<float>(src, char_scale, char_offset, out, width, height); break;
+        case ElementFloat64: floatDispatch<double>(src, char_scale, char_offset, out, width, height); break;
+    }
+    return true;
+}
+
+} // namespace ta
@@ -0,0 +1,83 @@
+/**
+ @file
+ frame_convert - copies and converts frames into caller-owned images
+ described as a pointer plus row stride, no Max involved
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_FRAME_CONVERT_H
+#define TA_FRAME_CONVERT_H
+
+#include <stddef.h>
+
+namespace ta
+{
+
+// A 2D image of planes-sized cells of T, rows stride bytes apart (jitter pads
+// its matrix rows, libfreenect2 frames are packed). T is const for sources.
+template <typename T>
+struct ImageView
+{
+    T *data;
+    int width;
+    int height;
+    int planes;
+    ptrdiff_t stride;
+
+    ImageView() : data(0), width(0), height(0), planes(0), stride(0) {}
+    ImageView(T *data, int width, int height, int planes, ptrdiff_t stride) :
+        data(data), width(width), height(height), planes(planes), stride(stride) {}
+
+    // a tightly packed image
+    static ImageView packed(T *data, int width, int height, int planes)
+    {
+        return ImageView(data, width, height, planes, (ptrdiff_t)width * planes * sizeof(T));
+    }
+
+    T *row(int y) const { return (T *)((char *)data + y * stride); }
+};
+
+// the element types of a jitter matrix
+enum ElementType
+{
+    ElementChar = 0, // unsigned 8 bit
+    ElementLong,     // signed 32 bit
+    ElementFloat32,
+    ElementFloat64
+};
+
+// A destination whose element type is only known at run time (a jitter
+// matrix). The converters below look at type and planes once and run a kernel
+// compiled for exactly that combination, so there is no per-pixel switch.
+struct MatrixView
+{
+    void *data;
+    ElementType type;
+    int width;
+    int height;
+    int planes; // any count, 1..4 have their own kernels
+    ptrdiff_t stride;
+};
+
+// Every conversion covers the overlap of source and destination and leaves
+// the rest of the destination alone. Both return false for an empty view.
+
+// libfreenect2 colour (BGRX, 4 bytes per pixel). By planecount: 4 = ARGB (X
+// becoming alpha), 3 = RGB, 2 = alpha + luma, 1 = luma, more = ARGB and zeros.
+// char and long get 0..255, float32/float64 0..1 (as jitter converts char).
+bool convertColor(const ImageView<const unsigned char> &bgrx, const MatrixView &out);
+
+// float planes (depth/IR in mm, bigdepth, uv map, normals). Source planes are copied
+// in order, a single-plane source fills every destination plane, missing
+// planes are 0. float32/float64 get the values as they are, long rounds them,
+// char gets value * char_scale clamped to 0..255. Integer types turn
+// non-finite values (bigdepth's +inf = no depth) into 0.
+bool convertFloat(const ImageView<const float> &src, float char_scale, const MatrixView &out);
+
+// the same, char getting value * char_scale + char_offset (signed values such as normals)
+bool convertFloat(const ImageView<const float> &src, float char_scale, float char_offset, const MatrixView &out);
+
+} // namespace ta
+
+#endif // TA_FRAME_CONVERT_H
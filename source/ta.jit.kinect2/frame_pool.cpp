@@ -0,0 +1,150 @@
+/**
+ @file
+ frame_pool - preallocated, recycling libfreenect2 frames
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "frame_pool.h"
+
+#include <new>
+#include <stdexcept>
+#include <stdlib.h>
+
+namespace ta
+{
+
+namespace
+{
+
+const size_t CACHE_LINE = 64;
+const int MAX_POOLS = 16;
+
+// live pools, so recycle() can find the owner of any frame
+std::atomic<FramePool *> s_pools[MAX_POOLS];
+
+}
+
+/************************************************************************************/
+// PooledFrame
+
+PooledFrame::PooledFrame(size_t width, size_t height, size_t bytes_per_pixel, unsigned char *storage) :
+    libfreenect2::Frame(0, 0, 0)
+{
+    // the base constructor allocated a (tiny) buffer of its own, drop it once
+    delete[] rawdata;
+    rawdata = 0;
+
+    this->width = width;
+    this->height = height;
+    this->bytes_per_pixel = bytes_per_pixel;
+    timestamp = 0;
+    sequence = 0;
+    data = storage;
+}
+
+/************************************************************************************/
+// FramePool
+
+FramePool::FramePool(size_t width, size_t height, size_t bytes_per_pixel, size_t count) :
+    width_(width),
+    height_(height),
+    bytes_per_pixel_(bytes_per_pixel),
+    count_(count),
+    head_(0)
+{
+    // first: a pool recycle() cannot find would have its frames deleted, a heap corruption
+    int slot = 0;
+    for (; slot < MAX_POOLS; slot++) {
+        FramePool *expected = 0;
+        if (s_pools[slot].compare_exchange_strong(expected, this))
+            break;
+    }
+    if (slot == MAX_POOLS)
+        throw std::runtime_error("frame pool: too many pools alive");
+
+    stride_ = (width * height * bytes_per_pixel + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+
+    void *slab = 0;
+    if (posix_memalign(&slab, CACHE_LINE, stride_ * count) != 0) {
+        s_pools[slot].store(0);
+        throw std::bad_alloc();
+    }
+    slab_ = static_cast<unsigned char *>(slab);
+
+    frames_ = static_cast<PooledFrame *>(::operator new(sizeof(PooledFrame) * count));
+    next_ = new std::atomic<uint32_t>[count];
+    for (size_t i = 0; i < count; i++) {
+        new (&frames_[i]) PooledFrame(width, height, bytes_per_pixel, slab_ + i * stride_);
+        next_[i].store(0);
+    }
+    for (size_t i = count; i > 0; i--)
+        release(&frames_[i - 1]);
+}
+
+FramePool::~FramePool()
+{
+    for (int i = 0; i < MAX_POOLS; i++) {
+        FramePool *expected = this;
+        if (s_pools[i].compare_exchange_strong(expected, 0))
+            break;
+    }
+
+    for (size_t i = 0; i < count_; i++)
+        frames_[i].~PooledFrame();
+    ::operator delete(frames_);
+    delete[] next_;
+    free(slab_);
+}
+
+libfreenect2::Frame *FramePool::acquire()
+{
+    uint64_t old_head = head_.load(std::memory_order_acquire);
+    while ((uint32_t)old_head != 0) {
+        uint32_t index = (uint32_t)old_head - 1;
+        // bumping the tag on every pop makes a stale head fail the exchange (ABA)
+        uint64_t new_head = ((old_head >> 32) + 1) << 32 | next_[index].load(std::memory_order_relaxed);
+        if (head_.compare_exchange_weak(old_head, new_head, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            PooledFrame *frame = &frames_[index];
+            frame->width = width_;
+            frame->height = height_;
+            frame->bytes_per_pixel = bytes_per_pixel_;
+            return frame;
+        }
+    }
+    return 0;
+}
+
+void FramePool::release(libfreenect2::Frame *frame)
+{
+    uint32_t index = (uint32_t)(static_cast<PooledFrame *>(frame) - frames_);
+    uint64_t old_head = head_.load(std::memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        next_[index].store((uint32_t)old_head, std::memory_order_relaxed);
+        new_head = (old_head >> 32) << 32 | (index + 1);
+    } while (!head_.compare_exchange_weak(old_head, new_head, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool FramePool::owns(const libfreenect2::Frame *frame) const
+{
+    uintptr_t p = reinterpret_cast<uintptr_t>(frame);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(frames_);
+    return p >= begin && p < begin + sizeof(PooledFrame) * count_;
+}
+
+void FramePool::recycle(libfreenect2::Frame *frame)
+{
+    if (!frame)
+        return;
+    for (int i = 0; i < MAX_POOLS; i++) {
+        FramePool *pool = s_pools[i].load(std::memory_order_acquire);
+        if (pool && pool->owns(frame)) {
+            pool->release(frame);
+            return;
+        }
+    }
+    delete frame;
+}
+
+} // namespace ta
@@ -0,0 +1,68 @@
+/**
+ @file
+ frame_pool - preallocated, recycling libfreenect2 frames
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_FRAME_POOL_H
+#define TA_FRAME_POOL_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include <frame_listener.hpp>
+
+namespace ta
+{
+
+// A libfreenect2::Frame whose pixels live in a FramePool slab instead of its
+// own new[] buffer. libfreenect2::Frame has no virtual destructor, so a
+// PooledFrame must never be deleted: hand every frame that may be pooled to
+// FramePool::recycle() instead.
+class PooledFrame : public libfreenect2::Frame
+{
+public:
+    PooledFrame(size_t width, size_t height, size_t bytes_per_pixel, unsigned char *storage);
+};
+
+// Fixed set of equally sized frames carved out of one cache-line aligned slab,
+// handed out and taken back through a lock-free (tagged index) free list, so
+// processor threads and the Max threads can swap frames without locking and
+// the steady state does no heap allocation at all.
+class FramePool
+{
+public:
+    // throws std::bad_alloc, or std::runtime_error when 16 pools are already alive
+    // (recycle() could not find a 17th)
+    FramePool(size_t width, size_t height, size_t bytes_per_pixel, size_t count);
+    ~FramePool();
+
+    // 0 when every frame is in use
+    libfreenect2::Frame *acquire();
+    void release(libfreenect2::Frame *frame);
+    bool owns(const libfreenect2::Frame *frame) const;
+
+    size_t size() const { return count_; }
+    size_t frameBytes() const { return stride_; }
+
+    // gives frame back to whichever live pool owns it, or deletes it if it
+    // was allocated by libfreenect2 itself (frame may be 0)
+    static void recycle(libfreenect2::Frame *frame);
+
+private:
+    FramePool(const FramePool &);
+    FramePool &operator=(const FramePool &);
+
+    size_t width_, height_, bytes_per_pixel_;
+    size_t count_;
+    size_t stride_;
+    unsigned char *slab_;
+    PooledFrame *frames_;
+    std::atomic<uint32_t> *next_;
+    std::atomic<uint64_t> head_; // generation tag << 32 | (index + 1), 0 = empty
+};
+
+} // namespace ta
+
+#endif // TA_FRAME_POOL_H
@@ -0,0 +1,43 @@
+/**
+ @file
+ frame_window - the last N frames of a stream as one contiguous block,
+ oldest first, without copying the window when a frame arrives
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "frame_window.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ta
+{
+
+FrameWindow::FrameWindow(size_t frame_size, int frames) :
+    frame_size_(frame_size),
+    frames_(frames > 0 ? frames : 1),
+    head_(0),
+    count_(0),
+    storage_(frame_size * 2 * (frames > 0 ? frames : 1), 0.0f)
+{
+}
+
+void FrameWindow::push(const float *frame)
+{
+    // both copies of the slot: the window starting at any head sees it
+    const size_t bytes = frame_size_ * sizeof(float);
+    std::memcpy(&storage_[(size_t)head_ * frame_size_], frame, bytes);
+    std::memcpy(&storage_[(size_t)(head_ + frames_) * frame_size_], frame, bytes);
+    head_ = (head_ + 1) % frames_;
+    count_ = std::min(count_ + 1, frames_);
+}
+
+void FrameWindow::clear()
+{
+    std::fill(storage_.begin(), storage_.end(), 0.0f);
+    head_ = 0;
+    count_ = 0;
+}
+
+} // namespace ta
@@ -0,0 +1,51 @@
+/**
+ @file
+ frame_window - the last N frames of a stream as one contiguous block,
+ oldest first, without copying the window when a frame arrives
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_FRAME_WINDOW_H
+#define TA_FRAME_WINDOW_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace ta
+{
+
+// A ring of N frames stored twice over (2N slots, frame k in slot k and
+// k + N). Whatever the write position, the N slots starting there hold the
+// window oldest to newest back to back, so window() is a single pointer a
+// 3D matrix can reference: a new frame costs two frame copies instead of a
+// copy of the whole window. Slots not yet written are zero. Needs no Max.
+class FrameWindow
+{
+public:
+    // frame_size in floats
+    FrameWindow(size_t frame_size, int frames);
+
+    int frames() const { return frames_; }
+    size_t frameSize() const { return frame_size_; }
+
+    // frames pushed so far (saturates at frames())
+    int count() const { return count_; }
+
+    void push(const float *frame);
+    void clear();
+
+    // frames() x frameSize() floats, oldest first; moves with every push
+    const float *window() const { return &storage_[0] + (size_t)head_ * frame_size_; }
+
+private:
+    size_t frame_size_;
+    int frames_;
+    int head_; // slot the next frame goes to = start of the window
+    int count_;
+    std::vector<float> storage_;
+};
+
+} // namespace ta
+
+#endif // TA_FRAME_WINDOW_H
@@ -0,0 +1,212 @@
+/**
+ @file
+ fusion_target - merges the point clouds of several sensors into one, in a
+ shared frame given by each sensor's extrinsics
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "fusion_target.h"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ta
+{
+
+namespace
+{
+
+std::mutex &registryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::map<std::string, FusionTarget *> &registry()
+{
+    static std::map<std::string, FusionTarget *> targets;
+    return targets;
+}
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// the valid points of in, transformed by m (3 x 4), packed as x y z slot; returns how many
+int transformPoints(const float *in, size_t n, const float *m, float slot, float *out)
+{
+    float *begin = out;
+#if defined(__SSE2__)
+    // one point per register: the columns of m, the slot riding in the fourth lane of the translation
+    const __m128 c0 = _mm_setr_ps(m[0], m[4], m[8], 0.0f);
+    const __m128 c1 = _mm_setr_ps(m[1], m[5], m[9], 0.0f);
+    const __m128 c2 = _mm_setr_ps(m[2], m[6], m[10], 0.0f);
+    const __m128 c3 = _mm_setr_ps(m[3], m[7], m[11], slot);
+    for (size_t i = 0; i < n; i++, in += 3) {
+        if (!(in[2] > 0.0f))
+            continue; // no depth (NaN too)
+        __m128 r = _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(in[0])), c3);
+        r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[2])));
+        _mm_storeu_ps(out, r);
+        out += FusionTarget::Planes;
+    }
+#else
+    for (size_t i = 0; i < n; i++, in += 3) {
+        if (!(in[2] > 0.0f))
+            continue;
+        out[0] = m[0] * in[0] + m[1] * in[1] + m[2] * in[2] + m[3];
+        out[1] = m[4] * in[0] + m[5] * in[1] + m[6] * in[2] + m[7];
+        out[2] = m[8] * in[0] + m[9] * in[1] + m[10] * in[2] + m[11];
+        out[3] = slot;
+        out += FusionTarget::Planes;
+    }
+#endif
+    return (int)((out - begin) / FusionTarget::Planes);
+}
+
+}
+
+FusionTarget::FusionTarget(const std::string &name) :
+    name_(name),
+    references_(0),
+    generation_(0)
+{
+    for (int i = 0; i < MaxSensors; i++) {
+        sensors_[i].joined = false;
+        sensors_[i].count = 0;
+        sensors_[i].time = 0;
+    }
+}
+
+FusionTarget *FusionTarget::attach(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+    FusionTarget *&target = registry()[name];
+    if (!target)
+        target = new FusionTarget(name);
+    target->references_++;
+    return target;
+}
+
+void FusionTarget::detach(FusionTarget *target)
+{
+    if (!target)
+        return;
+    std::lock_guard<std::mutex> lock(registryMutex());
+    if (--target->references_ == 0) {
+        registry().erase(target->name_);
+        delete target;
+    }
+}
+
+int FusionTarget::join()
+{
+    static const float identity[12] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 };
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < MaxSensors; i++) {
+        Sensor &s = sensors_[i];
+        if (!s.joined) {
+            s.joined = true;
+            std::memcpy(s.transform, identity, sizeof(identity));
+            s.count = 0;
+            s.time = 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void FusionTarget::leave(int sensor)
+{
+    if (sensor < 0 || sensor >= MaxSensors)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Sensor &s = sensors_[sensor];
+    s.joined = false;
+    s.count = 0;
+    s.time = 0;
+    std::vector<float>().swap(s.back);
+    std::vector<float>().swap(s.front);
+    generation_++; // its points leave the merged cloud
+}
+
+void FusionTarget::setTransform(int sensor, const float *matrix)
+{
+    if (sensor < 0 || sensor >= MaxSensors || !matrix)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::memcpy(sensors_[sensor].transform, matrix, sizeof(sensors_[sensor].transform));
+}
+
+void FusionTarget::contribute(int sensor, const float *points, int width, int height)
+{
+    if (sensor < 0 || sensor >= MaxSensors || !points)
+        return;
+    Sensor &s = sensors_[sensor];
+    float transform[12];
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!s.joined)
+            return;
+        std::memcpy(transform, s.transform, sizeof(transform));
+    }
+
+    // back belongs to this sensor's thread (one contributor per slot), no lock while transforming
+    const size_t n = (size_t)width * height;
+    if (s.back.size() < n * Planes)
+        s.back.resize(n * Planes);
+    const int count = transformPoints(points, n, transform, (float)sensor, &s.back[0]);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!s.joined)
+        return;
+    s.back.swap(s.front);
+    s.count = count;
+    s.time = now();
+    generation_++;
+}
+
+bool FusionTarget::merge(Cloud &cloud, int window_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (generation_ == cloud.generation)
+        return false;
+
+    int64_t newest = 0;
+    int total = 0;
+    for (int i = 0; i < MaxSensors; i++) {
+        if (sensors_[i].joined && sensors_[i].time > newest)
+            newest = sensors_[i].time;
+    }
+    for (int i = 0; i < MaxSensors; i++) {
+        const Sensor &s = sensors_[i];
+        if (s.joined && s.time && newest - s.time <= window_ms)
+            total += s.count;
+    }
+
+    if (cloud.points.size() < (size_t)total * Planes)
+        cloud.points.resize((size_t)total * Planes);
+    cloud.count = 0;
+    cloud.sensors = 0;
+    for (int i = 0; i < MaxSensors; i++) {
+        const Sensor &s = sensors_[i];
+        if (!s.joined || !s.time || newest - s.time > window_ms)
+            continue;
+        if (s.count)
+            std::memcpy(&cloud.points[(size_t)cloud.count * Planes], &s.front[0], (size_t)s.count * Planes * sizeof(float));
+        cloud.count += s.count;
+        cloud.sensors++;
+    }
+    cloud.generation = generation_;
+    return true;
+}
+
+} // namespace ta
@@ -0,0 +1,93 @@
+/**
+ @file
+ fusion_target - merges the point clouds of several sensors into one, in a
+ shared frame given by each sensor's extrinsics
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_FUSION_TARGET_H
+#define TA_FUSION_TARGET_H
+
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace ta
+{
+
+// Targets are process-wide and found by name: every instance that attaches
+// to "stage" shares one. Each sensor joins it and gets a slot; its depth
+// thread hands every cloud to contribute(), which transforms the valid
+// points by the sensor's 4 x 4 extrinsic matrix (SSE2) into the slot's back
+// buffer without holding any lock, then swaps it in. So sensors contribute
+// in parallel, each from its own thread. merge() takes the latest cloud of
+// every sensor whose cloud arrived within window ms of the newest one
+// (device clocks are not comparable, arrival time on the host is), so a
+// stalled sensor drops out instead of freezing part of the scene.
+// Needs no Max and no libfreenect2.
+class FusionTarget
+{
+public:
+    enum
+    {
+        MaxSensors = 8,
+        Planes = 4 // x, y, z (as the input, transformed), sensor slot
+    };
+
+    // what an instance last merged
+    struct Cloud
+    {
+        Cloud() : count(0), sensors(0), generation(0) {}
+        std::vector<float> points; // count x Planes
+        int count;
+        int sensors;              // how many sensors it came from
+        unsigned long generation; // of the target when merged
+    };
+
+    // the target called name, created by the first attach; detach once per attach
+    static FusionTarget *attach(const std::string &name);
+    static void detach(FusionTarget *target);
+
+    const std::string &name() const { return name_; }
+
+    // a free slot (-1 if all MaxSensors are taken), its transform is the identity
+    int join();
+    void leave(int sensor); // once its thread no longer calls contribute()
+
+    // 4 x 4, row by row, the translation in the fourth column (the bottom row is not used)
+    void setTransform(int sensor, const float *matrix);
+
+    // the sensor's thread: points are width x height x 3, 0 z = no point
+    void contribute(int sensor, const float *points, int width, int height);
+
+    // false (cloud untouched) if nothing was contributed since cloud was merged
+    bool merge(Cloud &cloud, int window_ms);
+
+private:
+    struct Sensor
+    {
+        bool joined;
+        float transform[12];
+        std::vector<float> back;  // the contributing thread's, outside the lock
+        std::vector<float> front; // under mutex_
+        int count;
+        int64_t time; // arrival, ms (steady clock), 0 = nothing yet
+    };
+
+    explicit FusionTarget(const std::string &name);
+    FusionTarget(const FusionTarget &);
+    FusionTarget &operator=(const FusionTarget &);
+
+    std::string name_;
+    int references_; // under the registry's lock
+
+    Sensor sensors_[MaxSensors];
+    unsigned long generation_;
+    std::mutex mutex_;
+};
+
+} // namespace ta
+
+#endif // TA_FUSION_TARGET_H
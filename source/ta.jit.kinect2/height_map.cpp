@@ -0,0 +1,106 @@
+/**
+ @file
+ height_map - projects a point cloud onto the floor: a plan-view grid of
+ the highest point or the number of points over each cell
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "height_map.h"
+
+#include <algorithm>
+
+namespace ta
+{
+
+HeightMap::HeightMap(size_t num_threads) :
+    pool_(num_threads),
+    grid_width_(0),
+    grid_height_(0)
+{
+    partials_.resize(pool_.numThreads());
+}
+
+void HeightMap::scatterRows(float *partial, const float *points, int width, int first, int end, const float *t,
+                            float inv_cell, int mode, float min_height, float max_height) const
+{
+    // grid coordinates of the floor origin, so a cell is just a truncation away
+    const float cx = grid_width_ * 0.5f;
+    const float cy = grid_height_ * 0.5f;
+
+    for (int y = first; y < end; y++) {
+        const float *p = points + (size_t)y * width * 3;
+        for (int x = 0; x < width; x++, p += 3) {
+            if (!(p[2] > 0.0f))
+                continue; // no depth (NaN too)
+            const float h = t[8] * p[0] + t[9] * p[1] + t[10] * p[2] + t[11];
+            if (!(h >= min_height && h <= max_height))
+                continue;
+            const float gx = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2] + t[3]) * inv_cell + cx;
+            const float gy = (t[4] * p[0] + t[5] * p[1] + t[6] * p[2] + t[7]) * inv_cell + cy;
+            if (!(gx >= 0.0f && gx < grid_width_ && gy >= 0.0f && gy < grid_height_))
+                continue;
+            float &cell = partial[(size_t)(int)gy * grid_width_ + (int)gx];
+            if (mode == HitCount)
+                cell += 1.0f;
+            else if (h > cell)
+                cell = h;
+        }
+    }
+}
+
+void HeightMap::mergeRows(int mode, int first, int end)
+{
+    const size_t begin = (size_t)first * grid_width_;
+    const size_t stop = (size_t)end * grid_width_;
+    float *out = &grid_[0];
+
+    std::fill(out + begin, out + stop, 0.0f);
+    for (size_t b = 0; b < partials_.size(); b++) {
+        float *partial = &partials_[b][0];
+        if (mode == HitCount) {
+            for (size_t i = begin; i < stop; i++)
+                out[i] += partial[i];
+        }
+        else {
+            for (size_t i = begin; i < stop; i++)
+                out[i] = std::max(out[i], partial[i]);
+        }
+        std::fill(partial + begin, partial + stop, 0.0f);
+    }
+}
+
+void HeightMap::build(const float *points, int width, int height, const float *transform,
+                      float cell_size, int grid_width, int grid_height, int mode,
+                      float min_height, float max_height)
+{
+    grid_width = std::min(std::max(grid_width, 1), (int)MaxDim);
+    grid_height = std::min(std::max(grid_height, 1), (int)MaxDim);
+    if (grid_width != grid_width_ || grid_height != grid_height_) {
+        grid_width_ = grid_width;
+        grid_height_ = grid_height;
+        for (size_t b = 0; b < partials_.size(); b++)
+            partials_[b].assign((size_t)grid_width_ * grid_height_, 0.0f);
+    }
+    grid_.assign((size_t)grid_width_ * grid_height_, 0.0f);
+    if (!points || !transform || !(cell_size > 0.0f))
+        return;
+    const float inv_cell = 1.0f / cell_size;
+    if (mode != HitCount)
+        min_height = std::max(min_height, 0.0f); // 0 means empty
+
+    // scatter: each "row" of the pool job is a band of image rows with a grid of its own
+    const int bands = (int)partials_.size();
+    pool_.run([this, points, width, height, transform, inv_cell, mode, min_height, max_height, bands](int first, int end) {
+        for (int b = first; b < end; b++)
+            scatterRows(&partials_[b][0], points, width, height * b / bands, height * (b + 1) / bands, transform,
+                        inv_cell, mode, min_height, max_height);
+    }, bands);
+
+    // merge: now the rows are grid rows
+    pool_.run([this, mode](int first, int end) {
+        mergeRows(mode, first, end);
+    }, grid_height_);
+}
+
+} // namespace ta
@@ -0,0 +1,75 @@
+/**
+ @file
+ height_map - projects a point cloud onto the floor: a plan-view grid of
+ the highest point or the number of points over each cell
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_HEIGHT_MAP_H
+#define TA_HEIGHT_MAP_H
+
+#include <vector>
+
+#include "row_pool.h"
+
+namespace ta
+{
+
+// Every point goes through a floor transform (camera -> floor: x and y on
+// the floor, z up) and lands in a cell of a grid centred on the floor
+// origin, row 0 at -y. Every band of rows scatters into a grid of its own,
+// so the scatter needs no atomics; the band grids are then merged (max or
+// sum), one band of grid rows per thread, and cleared on the way. Only
+// points whose height is within [min_height, max_height] count, which
+// keeps the floor itself and the ceiling out. Needs no Max and no
+// libfreenect2.
+class HeightMap
+{
+public:
+    enum Mode
+    {
+        MaxHeight = 1, // highest point over the cell, 0 = none above min_height
+        HitCount       // points over the cell
+    };
+
+    enum
+    {
+        MaxDim = 1024
+    };
+
+    explicit HeightMap(size_t num_threads);
+
+    // points: width x height x 3 (0 z = no point). transform: 3 x 4, row by
+    // row, the translation in the fourth column (the bottom row of a 4 x 4
+    // is not needed). grid_width, grid_height are clamped to 1..MaxDim.
+    void build(const float *points, int width, int height, const float *transform,
+               float cell_size, int grid_width, int grid_height, int mode,
+               float min_height, float max_height);
+
+    // gridWidth() x gridHeight() floats, valid until the next build()
+    const float *grid() const { return grid_.empty() ? 0 : &grid_[0]; }
+    int gridWidth() const { return grid_width_; }
+    int gridHeight() const { return grid_height_; }
+
+    // the worker threads of its RowPool, false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error) { return pool_.setThreadPolicy(policy, error); }
+
+private:
+    HeightMap(const HeightMap &);
+    HeightMap &operator=(const HeightMap &);
+
+    void scatterRows(float *partial, const float *points, int width, int first, int end, const float *transform,
+                     float inv_cell, int mode, float min_height, float max_height) const;
+    void mergeRows(int mode, int first, int end);
+
+    RowPool pool_;
+    std::vector<std::vector<float> > partials_; // one per band, all 0 between builds
+    std::vector<float> grid_;
+    int grid_width_;
+    int grid_height_;
+};
+
+} // namespace ta
+
+#endif // TA_HEIGHT_MAP_H
@@ -0,0 +1,658 @@
+/**
+ @file
+ kinect2_session - owns one Kinect v2 device and brings it up / tears it down
+ on a worker thread, so neither the Max main thread nor the scheduler block
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "kinect2_session.h"
+#include "parallel_depth_packet_processor.h"
+#include "parallel_rgb_packet_processor.h"
+#include "ring_logger.h"
+
+#include <chrono>
+#include <exception>
+#include <sstream>
+
+// matrix dimensions
+#define RGB_WIDTH 1920
+#define RGB_HEIGHT 1080
+#define DEPTH_WIDTH 512
+#define DEPTH_HEIGHT 424
+
+namespace ta
+{
+
+Kinect2Session::Kinect2Session(NotifyFunction notify, void *owner) :
+    notify_(notify),
+    owner_(owner),
+    state_(Closed),
+    reconnect_delay_(ReconnectDelayMin),
+    next_reconnect_(0),
+    context_(0),
+    device_(0),
+    rgb_pool_(0),
+    depth_pool_(0),
+    calibration_cache_(0),
+    registration_(0),
+    depth_stage_(0),
+    rgb_parser_(0),
+    depth_products_(0),
+    pyramid_level_(1),
+    pyramid_reduction_(ReduceMin),
+    motion_threshold_(15.0f),
+    fusion_target_(0),
+    fusion_sensor_(-1),
+    sync_listener_(0),
+    color_listener_(0),
+    held_color_(0),
+    depth_listener_(0),
+    pair_listener_(0),
+    watchdog_(0),
+    share_ring_(0),
+    share_listener_(0)
+{
+    for (int i = 0; i < 2; i++) {
+        delivered_[i].sequence = 0;
+        delivered_[i].timestamp = 0;
+        delivered_[i].generation = 0;
+    }
+    worker_ = std::thread(&Kinect2Session::workerLoop, this);
+}
+
+Kinect2Session::~Kinect2Session()
+{
+    {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        commands_.clear();
+        commands_.push_back(CommandQuit);
+    }
+    command_cond_.notify_one();
+    worker_.join();
+}
+
+const char *Kinect2Session::stateName(State state)
+{
+    switch (state) {
+        case Closed:
+            return "closed";
+        case Opening:
+            return "opening";
+        case Streaming:
+            return "streaming";
+        case Closing:
+            return "closing";
+        case Reconnecting:
+            return "reconnecting";
+        default:
+            return "error";
+    }
+}
+
+void Kinect2Session::open(const Config &config)
+{
+    {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        pending_config_ = config;
+        commands_.push_back(CommandOpen);
+    }
+    command_cond_.notify_one();
+}
+
+void Kinect2Session::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(command_mutex_);
+        commands_.push_back(CommandClose);
+    }
+    command_cond_.notify_one();
+}
+
+bool Kinect2Session::popTransition(State &state, std::string &message)
+{
+    std::lock_guard<std::mutex> lock(transitions_mutex_);
+    if (transitions_.empty())
+        return false;
+    state = transitions_.front().first;
+    message = transitions_.front().second;
+    transitions_.pop_front();
+    return true;
+}
+
+void Kinect2Session::setState(State state, const std::string &message)
+{
+    state_.store(state);
+    {
+        std::lock_guard<std::mutex> lock(transitions_mutex_);
+        transitions_.push_back(std::make_pair(state, message));
+    }
+    if (notify_)
+        notify_(owner_);
+}
+
+/************************************************************************************/
+// session thread
+
+void Kinect2Session::workerLoop()
+{
+    while (true) {
+        Command command;
+        Config config;
+        {
+            std::unique_lock<std::mutex> lock(command_mutex_);
+            while (commands_.empty()) {
+                // only wake up periodically while there is something to watch
+                State current = state();
+                if ((current == Streaming && config_.watchdog > 0) || current == Reconnecting) {
+                    if (command_cond_.wait_for(lock, std::chrono::milliseconds(WatchdogTick)) == std::cv_status::timeout
+                        && commands_.empty()) {
+                        lock.unlock();
+                        checkWatchdog();
+                        lock.lock();
+                    }
+                }
+                else {
+                    command_cond_.wait(lock);
+                }
+            }
+            command = commands_.front();
+            commands_.pop_front();
+            config = pending_config_;
+        }
+
+        switch (command) {
+            case CommandOpen: {
+                if (state() == Opening || state() == Streaming) {
+                    logMessage(libfreenect2::Logger::Info, "device already opened");
+                    break;
+                }
+                // also cancels a pending reconnect
+                config_ = config;
+                std::string error;
+                setState(Opening);
+                if (bringUp(error))
+                    setState(Streaming, serial_);
+                else
+                    setState(Error, error);
+                break;
+            }
+
+            case CommandClose:
+                if (state() == Streaming) {
+                    setState(Closing);
+                    tearDown();
+                    setState(Closed);
+                }
+                else if (state() == Reconnecting) {
+                    setState(Closed); // device already torn down, just stop retrying
+                }
+                break;
+
+            case CommandQuit:
+                if (state() == Streaming)
+                    tearDown();
+                delete context_;
+                context_ = 0;
+                return;
+        }
+    }
+}
+
+void Kinect2Session::checkWatchdog()
+{
+    if (state() == Reconnecting) {
+        if (WatchdogFrameListener::now() >= next_reconnect_)
+            reconnect();
+        return;
+    }
+
+    int64_t timeout = config_.watchdog;
+    if (!watchdog_->started() && timeout < StartupGrace)
+        timeout = StartupGrace;
+    int64_t silence = watchdog_->silence();
+    if (silence < timeout)
+        return;
+
+    std::ostringstream message;
+    message << "no frames for " << silence << " ms";
+    logMessage(libfreenect2::Logger::Warning, "device " + serial_ + " stalled, reconnecting...");
+    setState(Reconnecting, message.str());
+
+    tearDown();
+    // a fresh context, so the lost device really is enumerated again
+    delete context_;
+    context_ = 0;
+
+    config_.serial = serial_; // same device, same pipeline settings
+    reconnect_delay_ = ReconnectDelayMin;
+    next_reconnect_ = WatchdogFrameListener::now() + reconnect_delay_;
+}
+
+void Kinect2Session::reconnect()
+{
+    std::string error;
+    if (bringUp(error)) {
+        setState(Streaming, serial_);
+        return;
+    }
+
+    reconnect_delay_ *= 2;
+    if (reconnect_delay_ > ReconnectDelayMax)
+        reconnect_delay_ = ReconnectDelayMax;
+    next_reconnect_ = WatchdogFrameListener::now() + reconnect_delay_;
+
+    std::ostringstream message;
+    message << "reconnect failed (" << error << "), next attempt in " << reconnect_delay_ << " ms";
+    logMessage(libfreenect2::Logger::Info, message.str());
+}
+
+libfreenect2::PacketPipeline *Kinect2Session::createPipeline()
+{
+    libfreenect2::PacketPipeline *pipeline = 0;
+    const size_t decode_threads = config_.decode_threads > 0 ? config_.decode_threads : 0;
+
+    if (decode_threads) {
+        // decode colour on a thread pool instead of the stock single TurboJPEG thread,
+        // into frames recycled through a pool (decoders + listener history + the one held by sync 0 + the one being converted)
+        try {
+            rgb_pool_ = new FramePool(RGB_WIDTH, RGB_HEIGHT, 4, 2 * decode_threads + 7);
+        }
+        catch (const std::exception &e) {
+            // the decoders allocate their own frames then
+            logMessage(libfreenect2::Logger::Warning, std::string("no colour frame pool: ") + e.what());
+        }
+    }
+
+    switch (config_.depth_processor) {
+        case 0:
+            if (decode_threads)
+                pipeline = new ParallelRgbPacketPipeline<libfreenect2::CpuPacketPipeline>(decode_threads, rgb_pool_);
+            else
+                pipeline = new libfreenect2::CpuPacketPipeline();
+            logMessage(libfreenect2::Logger::Info, "using CPU packet pipeline...");
+            break;
+
+        case 2:
+            if (decode_threads)
+                pipeline = new ParallelRgbPacketPipeline<libfreenect2::OpenCLPacketPipeline>(decode_threads, rgb_pool_);
+            else
+                pipeline = new libfreenect2::OpenCLPacketPipeline();
+            logMessage(libfreenect2::Logger::Info, "using OpenCL packet pipeline...");
+            break;
+
+        case 3: {
+            size_t threads = config_.depth_threads > 0 ? config_.depth_threads : RowPool::defaultThreads();
+            unsigned int validate = config_.depth_validate > 0 ? config_.depth_validate : 0;
+            try {
+                // IR + depth in the processor, the listeners' history and the frame set being converted
+                depth_pool_ = new FramePool(DEPTH_WIDTH, DEPTH_HEIGHT, 4, 16);
+            }
+            catch (const std::exception &e) {
+                logMessage(libfreenect2::Logger::Warning, std::string("no depth frame pool: ") + e.what());
+            }
+            if (decode_threads)
+                pipeline = new ParallelRgbPacketPipeline<ParallelCpuPacketPipeline>(decode_threads, rgb_pool_, threads, validate, depth_pool_);
+            else
+                pipeline = new ParallelCpuPacketPipeline(threads, validate, depth_pool_);
+            std::ostringstream message;
+            message << "using multithreaded CPU packet pipeline (" << threads << " threads)...";
+            logMessage(libfreenect2::Logger::Info, message.str());
+            break;
+        }
+
+        default: // validated by the caller, OpenGL is not available in this build
+            delete rgb_pool_;
+            rgb_pool_ = 0;
+            return 0;
+    }
+    return pipeline;
+}
+
+bool Kinect2Session::bringUp(std::string &error)
+{
+    if (!context_)
+        context_ = new libfreenect2::Freenect2();
+
+    // check for connected devices
+    if (context_->enumerateDevices() == 0) {
+        error = "no device connected";
+        return false;
+    }
+
+    libfreenect2::PacketPipeline *pipeline = createPipeline();
+    if (!pipeline) {
+        error = "packet pipeline not available";
+        return false;
+    }
+
+    // libfreenect2 takes ownership of the pipeline (and deletes it if opening fails)
+    if (config_.serial.empty())
+        device_ = context_->openDefaultDevice(pipeline);
+    else
+        device_ = context_->openDevice(config_.serial, pipeline);
+
+    if (!device_) {
+        delete rgb_pool_;
+        rgb_pool_ = 0;
+        delete depth_pool_;
+        depth_pool_ = 0;
+        error = "failed to open device";
+        return false;
+    }
+
+    if (config_.calibration_cache) {
+        calibration_cache_ = new CalibrationCache(CalibrationCache::defaultDirectory(), device_->getSerialNumber(), device_->getFirmwareVersion());
+        // only the project's own depth processor can use it, the stock ones rebuild their tables
+        ParallelCpuDepthPacketProcessor *processor = dynamic_cast<ParallelCpuDepthPacketProcessor *>(pipeline->getDepthPacketProcessor());
+        if (processor)
+            processor->setCalibrationCache(calibration_cache_);
+    }
+
+    libfreenect2::FrameListener *color_listener, *depth_listener;
+    if (config_.sync == 2) {
+        // each depth frame goes out with the colour frame closest in time, waiting up to 100 ms
+        // for the colour frame after it (15 fps colour is a frame every 67 ms)
+        pair_listener_ = new NearestPairFrameListener(4, 100);
+        color_listener = depth_listener = pair_listener_;
+    }
+    else if (config_.sync) {
+        sync_listener_ = new SyncFrameListener(libfreenect2::Frame::Color | libfreenect2::Frame::Depth);
+        color_listener = depth_listener = sync_listener_;
+    }
+    else {
+        // one listener per stream, so depth never waits for the JPEG decode
+        color_listener_ = new LatestFrameListener(libfreenect2::Frame::Color);
+        depth_listener_ = new LatestFrameListener(libfreenect2::Frame::Depth);
+        color_listener = color_listener_;
+        depth_listener = depth_listener_;
+    }
+    {
+        // setDepthProducts() may look at the stage from the Max side
+        std::lock_guard<std::mutex> lock(stage_mutex_);
+        depth_stage_ = new DepthStage(depth_listener, config_.depth_threads > 0 ? config_.depth_threads : RowPool::defaultThreads());
+        depth_stage_->setProducts(depth_products_.load());
+        depth_stage_->setPyramid(pyramid_level_.load(), pyramid_reduction_.load());
+        depth_stage_->setMotionThreshold(motion_threshold_.load());
+        depth_stage_->setPointSink(this);
+    }
+    applyThreadPolicies(pipeline);
+    watchdog_ = new WatchdogFrameListener(color_listener, depth_stage_);
+    serial_ = device_->getSerialNumber();
+
+    libfreenect2::FrameListener *device_listener = watchdog_;
+    if (config_.share) {
+        // other local processes read the frames by serial, see shared_frame_ring.h
+        share_ring_ = new SharedFrameRingWriter(serial_, ShareSlots);
+        if (share_ring_->ok()) {
+            share_listener_ = new ShareFrameListener(share_ring_, watchdog_);
+            device_listener = share_listener_;
+            logMessage(libfreenect2::Logger::Info, "sharing frames as " + share_ring_->name());
+        }
+        else {
+            logMessage(libfreenect2::Logger::Warning, "could not share frames (" + share_ring_->error() + ")");
+            delete share_ring_;
+            share_ring_ = 0;
+        }
+    }
+    device_->setColorFrameListener(device_listener);
+    device_->setIrAndDepthFrameListener(device_listener);
+
+    watchdog_->reset();
+    device_->start(); // loads the calibration into the depth processor
+
+    // camera parameters are only known once the device has started
+    registration_ = new RegistrationMaps(device_->getIrCameraParams(), device_->getColorCameraParams(), calibration_cache_);
+    depth_stage_->setRegistration(registration_);
+
+    if (calibration_cache_ && !calibration_cache_->save())
+        logMessage(libfreenect2::Logger::Warning, "could not write calibration cache " + calibration_cache_->path());
+    return true;
+}
+
+// releases the device, pipeline, listeners and pool (in that order), without reporting a state
+void Kinect2Session::tearDown()
+{
+    {
+        std::lock_guard<std::mutex> lock(frames_mutex_);
+        rgb_parser_ = 0; // goes with the pipeline
+    }
+    device_->stop();
+    device_->close();
+    delete device_; // also deletes the pipeline, whose processors may hold pooled frames
+    device_ = 0;
+
+    {
+        // waits for a matrix_calc that is still converting
+        std::lock_guard<std::mutex> lock(frames_mutex_);
+        if (sync_listener_)
+            sync_listener_->release(frame_map_);
+        if (color_listener_)
+            color_listener_->release(held_color_);
+        held_color_ = 0;
+        DepthStage *stage;
+        {
+            std::lock_guard<std::mutex> stage_lock(stage_mutex_);
+            stage = depth_stage_;
+            depth_stage_ = 0;
+        }
+        delete share_listener_;
+        delete watchdog_;
+        delete stage;
+        delete sync_listener_;
+        delete color_listener_;
+        delete depth_listener_;
+        delete pair_listener_;
+        share_listener_ = 0;
+        watchdog_ = 0;
+        sync_listener_ = 0;
+        color_listener_ = 0;
+        depth_listener_ = 0;
+        pair_listener_ = 0;
+    }
+
+    delete share_ring_; // readers see it die and can follow a reopened device
+    share_ring_ = 0;
+
+    delete rgb_pool_; // only after everything that may still hold pooled frames is gone
+    rgb_pool_ = 0;
+    delete depth_pool_;
+    depth_pool_ = 0;
+
+    delete registration_;
+    registration_ = 0;
+
+    delete calibration_cache_; // the depth processor and registration maps reading from its mapping are gone
+    calibration_cache_ = 0;
+}
+
+// ours right away, libfreenect2's when they first call into us; refusals only cost latency, they are logged
+void Kinect2Session::applyThreadPolicies(libfreenect2::PacketPipeline *pipeline)
+{
+    std::string error;
+    if (!config_.worker.isDefault()) {
+        ParallelCpuDepthPacketProcessor *processor = dynamic_cast<ParallelCpuDepthPacketProcessor *>(pipeline->getDepthPacketProcessor());
+        if (!depth_stage_->setThreadPolicy(config_.worker, error) || (processor && !processor->setThreadPolicy(config_.worker, error)))
+            logMessage(libfreenect2::Logger::Warning, "worker threads: " + error);
+    }
+    ParallelRgbPacketProcessor *decoder = dynamic_cast<ParallelRgbPacketProcessor *>(pipeline->getRgbPacketProcessor());
+    if (decoder && !config_.decode.isDefault() && !decoder->setThreadPolicy(config_.decode, error))
+        logMessage(libfreenect2::Logger::Warning, "decode threads: " + error);
+    RgbStreamParser *parser = dynamic_cast<RgbStreamParser *>(pipeline->getRgbPacketParser());
+    if (parser)
+        parser->setCaptureThreadPolicy(config_.capture);
+    depth_stage_->setCaptureThreadPolicy(config_.capture);
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    rgb_parser_ = parser;
+}
+
+// libfreenect2's threads take the capture policy with their first frame and keep a refusal for us
+// (called with frames_mutex_ held while streaming)
+void Kinect2Session::reportThreadPolicyFailures()
+{
+    std::string error;
+    if (rgb_parser_ && rgb_parser_->captureThreadPolicyFailed(error))
+        logMessage(libfreenect2::Logger::Warning, "USB thread: " + error);
+    if (depth_stage_ && depth_stage_->captureThreadPolicyFailed(error))
+        logMessage(libfreenect2::Logger::Warning, "depth processor thread: " + error);
+}
+
+void Kinect2Session::setDepthProducts(unsigned int products)
+{
+    depth_products_.store(products);
+    std::lock_guard<std::mutex> lock(stage_mutex_);
+    if (depth_stage_)
+        depth_stage_->setProducts(products);
+}
+
+void Kinect2Session::setDepthPyramid(int level, int reduction)
+{
+    pyramid_level_.store(level);
+    pyramid_reduction_.store(reduction);
+    std::lock_guard<std::mutex> lock(stage_mutex_);
+    if (depth_stage_)
+        depth_stage_->setPyramid(level, reduction);
+}
+
+void Kinect2Session::setDepthMotionThreshold(float threshold)
+{
+    motion_threshold_.store(threshold);
+    std::lock_guard<std::mutex> lock(stage_mutex_);
+    if (depth_stage_)
+        depth_stage_->setMotionThreshold(threshold);
+}
+
+void Kinect2Session::setFusion(FusionTarget *target, int sensor)
+{
+    std::lock_guard<std::mutex> lock(fusion_mutex_); // waits for a contribution in progress
+    fusion_target_ = target;
+    fusion_sensor_ = sensor;
+}
+
+// depth processor thread: every device contributes from its own, in parallel
+void Kinect2Session::onPoints(const float *points, int width, int height)
+{
+    std::lock_guard<std::mutex> lock(fusion_mutex_);
+    if (fusion_target_)
+        fusion_target_->contribute(fusion_sensor_, points, width, height);
+}
+
+/************************************************************************************/
+// frame access (scheduler / main thread)
+
+// a frame with the sequence and timestamp of the last one handed out is the same frame again
+static bool is_repeat(const libfreenect2::Frame *frame, uint32_t sequence, uint32_t timestamp, unsigned long generation)
+{
+    return generation && frame->sequence == sequence && frame->timestamp == timestamp;
+}
+
+bool Kinect2Session::hasNewFrame()
+{
+    if (state() != Streaming)
+        return false;
+
+    std::lock_guard<std::mutex> lock(frames_mutex_);
+    if (sync_listener_)
+        return sync_listener_->hasNewFrame();
+    if (pair_listener_)
+        return pair_listener_->hasNewFrame();
+    if (depth_listener_ && color_listener_)
+        return depth_listener_->hasNewFrame(libfreenect2::Frame::Depth) || color_listener_->hasNewFrame(libfreenect2::Frame::Color);
+    return false;
+}
+
+bool Kinect2Session::acquire(FrameSet &frames)
+{
+    frames.color = 0;
+    frames.depth = 0;
+    frames.skew = 0;
+    frames.products = 0;
+    frames.taken_color = 0;
+    frames.taken_depth = 0;
+
+    if (state() != Streaming)
+        return false;
+
+    frames_mutex_.lock();
+    if (state() != Streaming) {
+        frames_mutex_.unlock();
+        return false;
+    }
+    reportThreadPolicyFailures();
+
+    if (sync_listener_) {
+        if (sync_listener_->waitForNewFrame(frame_map_, 0)) {
+            frames.color = frame_map_[libfreenect2::Frame::Color];
+            frames.depth = frame_map_[libfreenect2::Frame::Depth];
+            frames.skew = (int32_t)(frames.color->timestamp - frames.depth->timestamp);
+        }
+    }
+    else if (pair_listener_) {
+        pair_listener_->takePair(frames.color, frames.depth, frames.skew);
+    }
+    else if (depth_listener_ && color_listener_) {
+        frames.depth = depth_listener_->take(libfreenect2::Frame::Depth);
+        frames.color = color_listener_->take(libfreenect2::Frame::Color);
+        if (!frames.color)
+            frames.color = held_color_; // a repeat, so only taken_color will show it
+    }
+
+    // a repeat (e.g. the colour frame nearest to two depth frames) is hidden from the caller, still released
+    frames.taken_color = frames.color;
+    frames.taken_depth = frames.depth;
+    Delivered &color = delivered_[0], &depth = delivered_[1];
+    bool new_color = frames.color && !is_repeat(frames.color, color.sequence, color.timestamp, color.generation);
+    bool new_depth = frames.depth && !is_repeat(frames.depth, depth.sequence, depth.timestamp, depth.generation);
+    if (!new_color)
+        frames.color = 0;
+    if (!new_depth)
+        frames.depth = 0;
+    if (!new_color && !new_depth) {
+        if (frames.taken_color || frames.taken_depth)
+            release(frames); // unlocks
+        else
+            frames_mutex_.unlock();
+        return false;
+    }
+    if (new_color) {
+        color.sequence = frames.color->sequence;
+        color.timestamp = frames.color->timestamp;
+        color.generation++;
+    }
+    if (new_depth) {
+        depth.sequence = frames.depth->sequence;
+        depth.timestamp = frames.depth->timestamp;
+        depth.generation++;
+    }
+    if (frames.depth)
+        frames.products = depth_stage_->acquire(frames.depth->sequence);
+    return true;
+}
+
+void Kinect2Session::release(FrameSet &frames)
+{
+    if (sync_listener_) {
+        sync_listener_->release(frame_map_);
+    }
+    else if (pair_listener_) {
+        pair_listener_->releasePair(frames.taken_color, frames.taken_depth);
+    }
+    else {
+        if (frames.taken_depth)
+            depth_listener_->release(frames.taken_depth);
+        if (frames.taken_color && frames.taken_color != held_color_) {
+            // kept: the next depth frame may come before the next colour frame
+            color_listener_->release(held_color_);
+            held_color_ = frames.taken_color;
+        }
+    }
+    depth_stage_->release(frames.products);
+    frames.color = 0;
+    frames.depth = 0;
+    frames.taken_color = 0;
+    frames.taken_depth = 0;
+    frames.products = 0;
+    frames_mutex_.unlock();
+}
+
+} // namespace ta
@@ -0,0 +1,210 @@
+/**
+ @file
+ kinect2_session - owns one Kinect v2 device and brings it up / tears it down
+ on a worker thread, so neither the Max main thread nor the scheduler block
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_KINECT2_SESSION_H
+#define TA_KINECT2_SESSION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <libfreenect2.hpp>
+#include <frame_listener_impl.h>
+#include <packet_pipeline.h>
+
+#include "calibration_cache.h"
+#include "depth_stage.h"
+#include "frame_pool.h"
+#include "fusion_target.h"
+#include "latest_frame_listener.h"
+#include "nearest_pair_frame_listener.h"
+#include "share_frame_listener.h"
+#include "sync_frame_listener.h"
+#include "thread_policy.h"
+#include "watchdog_frame_listener.h"
+
+namespace ta
+{
+
+class RgbStreamParser;
+
+class Kinect2Session : private PointSink
+{
+public:
+    enum State
+    {
+        Closed = 0,
+        Opening,
+        Streaming,
+        Closing,
+        Error,
+        Reconnecting  // stream stalled, the device is gone and is re-enumerated in the background
+    };
+
+    struct Config
+    {
+        long depth_processor; // 0 CPU, 1 OpenGL, 2 OpenCL, 3 multithreaded CPU
+        long depth_threads;   // depth_processor 3 only, 0 = one per core but one
+        long depth_validate;  // depth_processor 3 only, compare every Nth frame with the stock CPU processor, 0 = off
+        long decode_threads;  // 0 = stock TurboJPEG processor
+        long sync;            // 0 independent streams, 1 strict pairs, 2 nearest-timestamp pairs
+        std::string serial;   // empty = default device
+        long watchdog;        // ms without frames before the device is considered lost, 0 = off
+        long calibration_cache; // reuse tables derived from the device calibration across opens
+        long share;           // publish every frame into a shared-memory ring other processes can read
+        ThreadPolicy capture; // libfreenect2's depth processor thread (and USB thread with decode_threads)
+        ThreadPolicy decode;  // decode_threads only
+        ThreadPolicy worker;  // row pools: depth products, depth_processor 3
+    };
+
+    // frames for one matrix_calc; color/depth are 0 when that stream has nothing new
+    struct FrameSet
+    {
+        libfreenect2::Frame *color;
+        libfreenect2::Frame *depth;
+        int32_t skew;  // colour minus depth timestamp (device ticks) when both are set
+        const DepthProducts *products; // derived from depth, 0 if none were computed for it
+        libfreenect2::Frame *taken_color; // what release() gives back (color/depth hide repeats); whenever
+                                          // depth is set it is the newest colour frame, if there was any
+        libfreenect2::Frame *taken_depth;
+    };
+
+    // called from the worker thread after every state change, should only
+    // schedule a call to popTransition() on the thread that owns the outlets
+    typedef void (*NotifyFunction)(void *owner);
+
+    Kinect2Session(NotifyFunction notify, void *owner);
+    ~Kinect2Session(); // tears the device down synchronously
+
+    // both return immediately, the work happens on the session thread
+    void open(const Config &config);
+    void close();
+
+    State state() const { return (State)state_.load(); }
+    static const char *stateName(State state);
+
+    // oldest state change not yet reported, with an error/info message
+    bool popTransition(State &state, std::string &message);
+
+    // never blocks: false when not streaming or when nothing is new. On true
+    // the frames stay valid (and teardown waits) until release() is called.
+    bool acquire(FrameSet &frames);
+    void release(FrameSet &frames);
+
+    // cheap poll: would acquire() return anything? Never blocks on a frame.
+    bool hasNewFrame();
+
+    // DepthStage::Product bits to compute for every depth frame, applies immediately
+    void setDepthProducts(unsigned int products);
+
+    // DepthStage::setPyramid(), applies immediately
+    void setDepthPyramid(int level, int reduction);
+
+    // DepthStage::setMotionThreshold(), applies immediately
+    void setDepthMotionThreshold(float threshold);
+
+    // points of every depth frame go to target's slot sensor from the depth
+    // thread while Points is on (0 = nowhere). Once it returns the previous
+    // target gets nothing more, so its slot can be left.
+    void setFusion(FusionTarget *target, int sensor);
+
+private:
+    enum Command
+    {
+        CommandOpen,
+        CommandClose,
+        CommandQuit
+    };
+
+    // watchdog timing (ms)
+    enum
+    {
+        WatchdogTick = 100,
+        StartupGrace = 5000,     // first frames may take a while (OpenCL kernel build)
+        ReconnectDelayMin = 500,
+        ReconnectDelayMax = 30000
+    };
+
+    enum
+    {
+        ShareSlots = 4 // per stream in the shared-memory ring
+    };
+
+    void workerLoop();
+    void checkWatchdog();
+    void reconnect();
+    bool bringUp(std::string &error);
+    void tearDown();
+    libfreenect2::PacketPipeline *createPipeline();
+    void applyThreadPolicies(libfreenect2::PacketPipeline *pipeline);
+    void reportThreadPolicyFailures();
+    void setState(State state, const std::string &message = std::string());
+    virtual void onPoints(const float *points, int width, int height);
+
+    NotifyFunction notify_;
+    void *owner_;
+
+    std::thread worker_;
+    std::mutex command_mutex_;
+    std::condition_variable command_cond_;
+    std::deque<Command> commands_;
+    Config pending_config_;
+
+    std::atomic<int> state_;
+    std::mutex transitions_mutex_;
+    std::deque<std::pair<State, std::string> > transitions_;
+
+    // everything below belongs to the session thread, except while frames_mutex_
+    // is held by acquire()/release()
+    Config config_;
+    std::string serial_; // of the opened device, reconnects go to this one
+    long reconnect_delay_;
+    int64_t next_reconnect_;
+    libfreenect2::Freenect2 *context_;
+    libfreenect2::Freenect2Device *device_;
+    FramePool *rgb_pool_;
+    FramePool *depth_pool_; // depth_processor 3 only
+    CalibrationCache *calibration_cache_;
+    RegistrationMaps *registration_;
+    DepthStage *depth_stage_; // set and cleared under stage_mutex_ too, for the setters
+    RgbStreamParser *rgb_parser_; // the pipeline's, while it has ours (cleared under frames_mutex_ before it goes)
+    std::atomic<unsigned int> depth_products_;
+    std::atomic<int> pyramid_level_;
+    std::atomic<int> pyramid_reduction_;
+    std::atomic<float> motion_threshold_;
+    FusionTarget *fusion_target_; // under fusion_mutex_, held while contributing
+    int fusion_sensor_;
+    std::mutex fusion_mutex_;
+    SyncFrameListener *sync_listener_;
+    LatestFrameListener *color_listener_;
+    libfreenect2::Frame *held_color_; // sync 0: the newest colour frame, handed out until a newer one arrives
+    LatestFrameListener *depth_listener_;
+    NearestPairFrameListener *pair_listener_;
+    WatchdogFrameListener *watchdog_;
+    SharedFrameRingWriter *share_ring_;
+    ShareFrameListener *share_listener_;
+    libfreenect2::FrameMap frame_map_;
+    std::mutex frames_mutex_;
+    std::mutex stage_mutex_; // the setters' only lock: frames_mutex_ is held through a whole matrix_calc
+
+    // what acquire() handed out last per stream (Color, Depth), to drop repeats
+    struct Delivered
+    {
+        uint32_t sequence;
+        uint32_t timestamp;
+        unsigned long generation;
+    };
+    Delivered delivered_[2];
+};
+
+} // namespace ta
+
+#endif // TA_KINECT2_SESSION_H
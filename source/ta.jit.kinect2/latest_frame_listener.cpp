@@ -0,0 +1,76 @@
+/**
+ @file
+ latest_frame_listener - single-slot frame listener used when colour and depth
+ are delivered independently (sync 0)
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "latest_frame_listener.h"
+#include "frame_pool.h"
+
+namespace ta
+{
+
+LatestFrameListener::LatestFrameListener(unsigned int frame_types) :
+    frame_types_(frame_types)
+{
+    for (int i = 0; i < 3; i++)
+        latest_[i] = 0;
+}
+
+LatestFrameListener::~LatestFrameListener()
+{
+    for (int i = 0; i < 3; i++)
+        FramePool::recycle(latest_[i]);
+}
+
+int LatestFrameListener::slot(libfreenect2::Frame::Type type)
+{
+    switch (type) {
+        case libfreenect2::Frame::Color:
+            return 0;
+        case libfreenect2::Frame::Ir:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+bool LatestFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    if (!(frame_types_ & type))
+        return false; // not ours, the processor keeps (and reuses) it
+
+    libfreenect2::Frame *stale;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int i = slot(type);
+        stale = latest_[i];
+        latest_[i] = frame;
+    }
+    FramePool::recycle(stale); // outside the lock, this is the processor thread
+    return true;
+}
+
+bool LatestFrameListener::hasNewFrame(libfreenect2::Frame::Type type) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latest_[slot(type)] != 0;
+}
+
+libfreenect2::Frame *LatestFrameListener::take(libfreenect2::Frame::Type type)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int i = slot(type);
+    libfreenect2::Frame *frame = latest_[i];
+    latest_[i] = 0;
+    return frame;
+}
+
+void LatestFrameListener::release(libfreenect2::Frame *frame)
+{
+    FramePool::recycle(frame);
+}
+
+} // namespace ta
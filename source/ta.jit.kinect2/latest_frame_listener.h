@@ -0,0 +1,46 @@
+/**
+ @file
+ latest_frame_listener - single-slot frame listener used when colour and depth
+ are delivered independently (sync 0)
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_LATEST_FRAME_LISTENER_H
+#define TA_LATEST_FRAME_LISTENER_H
+
+#include <mutex>
+
+#include <frame_listener.hpp>
+
+namespace ta
+{
+
+// Keeps only the newest frame of each type it listens to. A frame that was
+// never taken is dropped when a newer one arrives, so a slow consumer never
+// holds up the processor thread and never sees stale data.
+class LatestFrameListener : public libfreenect2::FrameListener
+{
+public:
+    explicit LatestFrameListener(unsigned int frame_types);
+    virtual ~LatestFrameListener();
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+    bool hasNewFrame(libfreenect2::Frame::Type type) const;
+
+    // returns the newest unread frame (caller releases it) or 0 if there is none
+    libfreenect2::Frame *take(libfreenect2::Frame::Type type);
+    void release(libfreenect2::Frame *frame);
+
+private:
+    static int slot(libfreenect2::Frame::Type type);
+
+    unsigned int frame_types_;
+    libfreenect2::Frame *latest_[3];
+    mutable std::mutex mutex_;
+};
+
+} // namespace ta
+
+#endif // TA_LATEST_FRAME_LISTENER_H
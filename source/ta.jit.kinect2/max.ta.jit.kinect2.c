@@ -17,6 +17,20 @@
 #define RGB_HEIGHT 1080
 #define DEPTH_WIDTH 512
 #define DEPTH_HEIGHT 424
+#define BIGDEPTH_HEIGHT 1082
+
+// TA: bits returned by the jitter object's "getupdated" method
+#define TA_KINECT2_UPDATED_DEPTH 1
+#define TA_KINECT2_UPDATED_RGB 2
+#define TA_KINECT2_UPDATED_BIGDEPTH 4
+#define TA_KINECT2_UPDATED_UVMAP 8
+#define TA_KINECT2_UPDATED_PYRAMID 16
+#define TA_KINECT2_UPDATED_NORMALS 32
+#define TA_KINECT2_UPDATED_MOTION 64
+#define TA_KINECT2_UPDATED_BATCH 128
+#define TA_KINECT2_UPDATED_VOXELS 256
+#define TA_KINECT2_UPDATED_HEIGHTMAP 512
+#define TA_KINECT2_UPDATED_FUSED 1024
 
 
 
@@ -25,6 +39,7 @@
 typedef struct _max_ta_jit_kinect2 {
     t_object	ob;
     void		*obex;
+    t_symbol    *servername; // TA: registered name of the jitter object, for state notifications
 } t_max_ta_jit_kinect2;
 
 
@@ -36,6 +51,8 @@ void		max_ta_jit_kinect2_free(t_max_ta_jit_kinect2 *x);
 //TA: own methods
 void        max_ta_jit_kinect2_outputmatrix(t_max_ta_jit_kinect2 *x);
 void        max_ta_jit_kinect2_bang(t_max_ta_jit_kinect2 *x);
+void        max_ta_jit_kinect2_outputstream(t_max_ta_jit_kinect2 *x, long index);
+t_jit_err   max_ta_jit_kinect2_notify(t_max_ta_jit_kinect2 *x, t_symbol *s, t_symbol *msg, void *ob, void *data);
 END_USING_C_LINKAGE
 
 // globals
@@ -55,12 +72,13 @@ void ext_main(void *r)
     
     jit_class = jit_class_findbyname(gensym("ta_jit_kinect2"));
     
-    max_jit_class_mop_wrap(max_class, jit_class, MAX_JIT_MOP_FLAGS_OWN_OUTPUTMATRIX|MAX_JIT_MOP_FLAGS_OWN_JIT_MATRIX|MAX_JIT_MOP_FLAGS_OWN_BANG|MAX_JIT_MOP_FLAGS_OWN_TYPE|MAX_JIT_MOP_FLAGS_OWN_PLANECOUNT|MAX_JIT_MOP_FLAGS_OWN_DIM|MAX_JIT_MOP_FLAGS_OWN_ADAPT|MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);			// attrs & methods for name, type, dim, planecount, bang, outputmatrix, etc // TA: overriding methods and attributes
+    max_jit_class_mop_wrap(max_class, jit_class, MAX_JIT_MOP_FLAGS_OWN_OUTPUTMATRIX|MAX_JIT_MOP_FLAGS_OWN_JIT_MATRIX|MAX_JIT_MOP_FLAGS_OWN_BANG|MAX_JIT_MOP_FLAGS_OWN_TYPE|MAX_JIT_MOP_FLAGS_OWN_PLANECOUNT|MAX_JIT_MOP_FLAGS_OWN_DIM|MAX_JIT_MOP_FLAGS_OWN_ADAPT|MAX_JIT_MOP_FLAGS_OWN_OUTPUTMODE);			// attrs & methods for name, type, dim, planecount, bang, outputmatrix, etc // TA: overriding methods and attributes (per outlet @<name>_type / @<name>_planecount instead)
     
     max_jit_class_wrap_standard(max_class, jit_class, 0);		// attrs & methods for getattributes, dumpout, maxjitclassaddmethods, etc
     
     class_addmethod(max_class, (method)max_ta_jit_kinect2_outputmatrix, "outputmatrix", A_USURP_LOW, 0); // TA: override outputmatrix method
     class_addmethod(max_class, (method)max_ta_jit_kinect2_bang, "bang"); // TA: override bang method (it shouldn't be necessary but I'm not getting it to work be only overriding the outputmatrix method)
+    class_addmethod(max_class, (method)max_ta_jit_kinect2_notify, "notify", A_CANT, 0); // TA: state changes from the jitter object
     class_addmethod(max_class, (method)max_jit_mop_assist, "assist", A_CANT, 0);	// standard matrix-operator (mop) assist fn
     
     class_register(CLASS_BOX, max_class);
@@ -84,6 +102,14 @@ void *max_ta_jit_kinect2_new(t_symbol *s, long argc, t_atom *argv)
             max_jit_attr_args(x, argc, argv);
             t_atom_long depthdim[2] = {DEPTH_WIDTH, DEPTH_HEIGHT};
             t_atom_long rgbdim[2] = {RGB_WIDTH, RGB_HEIGHT};
+            t_atom_long bigdepthdim[2] = {RGB_WIDTH, BIGDEPTH_HEIGHT};
+            t_atom_long uvdim[2] = {DEPTH_WIDTH, DEPTH_HEIGHT};
+            t_atom_long pyramiddim[2] = {DEPTH_WIDTH / 2, DEPTH_HEIGHT / 2};
+            t_atom_long normalsdim[2] = {DEPTH_WIDTH, DEPTH_HEIGHT};
+            t_atom_long batchdim[2] = {DEPTH_WIDTH, DEPTH_HEIGHT};
+            t_atom_long voxeldim[2] = {1, 1};
+            t_atom_long heightmapdim[2] = {256, 256};
+            t_atom_long fuseddim[2] = {1, 1};
             
             //TA: set depth matrix initial attributes
             void *output = max_jit_mop_getoutput(x, 1);
@@ -96,7 +122,59 @@ void *max_ta_jit_kinect2_new(t_symbol *s, long argc, t_atom *argv)
             jit_attr_setsym(output, _jit_sym_type, _jit_sym_char);
             jit_attr_setlong_array(output, _jit_sym_dim, 2, rgbdim);
             jit_attr_setlong(output, _jit_sym_planecount, 4);
-
+            
+            //TA: set bigdepth matrix initial attributes
+            output = max_jit_mop_getoutput(x, 3);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, bigdepthdim);
+            jit_attr_setlong(output, _jit_sym_planecount, 1);
+            
+            //TA: set uv map matrix initial attributes
+            output = max_jit_mop_getoutput(x, 4);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, uvdim);
+            jit_attr_setlong(output, _jit_sym_planecount, 2);
+            
+            //TA: set pyramid matrix initial attributes (the jitter object resizes it to the selected level)
+            output = max_jit_mop_getoutput(x, 5);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, pyramiddim);
+            jit_attr_setlong(output, _jit_sym_planecount, 1);
+            
+            //TA: set normals matrix initial attributes
+            output = max_jit_mop_getoutput(x, 6);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, normalsdim);
+            jit_attr_setlong(output, _jit_sym_planecount, 3);
+            
+            //TA: set batch matrix initial attributes (with @batch on it becomes 512x424xN, referencing the jitter object's frames)
+            output = max_jit_mop_getoutput(x, 7);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, batchdim);
+            jit_attr_setlong(output, _jit_sym_planecount, 1);
+            
+            //TA: set voxel cloud matrix initial attributes (N x 1, x y z r g b; the jitter object sets N every frame)
+            output = max_jit_mop_getoutput(x, 8);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, voxeldim);
+            jit_attr_setlong(output, _jit_sym_planecount, 6);
+            
+            //TA: set height map matrix initial attributes (the jitter object follows @heightmap_dim)
+            output = max_jit_mop_getoutput(x, 9);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, heightmapdim);
+            jit_attr_setlong(output, _jit_sym_planecount, 1);
+            
+            //TA: set fused cloud matrix initial attributes (N x 1, x y z sensor; the jitter object sets N every merge)
+            output = max_jit_mop_getoutput(x, 10);
+            jit_attr_setsym(output, _jit_sym_type, _jit_sym_float32);
+            jit_attr_setlong_array(output, _jit_sym_dim, 2, fuseddim);
+            jit_attr_setlong(output, _jit_sym_planecount, 4);
+            
+            //TA: listen to the jitter object's state changes
+            x->servername = jit_symbol_unique();
+            jit_object_register(o, x->servername);
+            jit_object_attach(x->servername, x);
         }
         else {
             jit_object_error((t_object *)x, "ta.jit.kinect2: could not allocate object");
@@ -111,6 +189,8 @@ void *max_ta_jit_kinect2_new(t_symbol *s, long argc, t_atom *argv)
 void max_ta_jit_kinect2_free(t_max_ta_jit_kinect2 *x)
 {
     max_jit_mop_free(x);
+    jit_object_detach(x->servername, x);
+    jit_object_unregister(max_jit_obex_jitob_get(x));
     jit_object_free(max_jit_obex_jitob_get(x));
     max_jit_object_free(x);
 }
@@ -131,11 +211,65 @@ void max_ta_jit_kinect2_outputmatrix(t_max_ta_jit_kinect2 *x)
             jit_error_code(x,err);
         }
         else {
-            max_jit_mop_outputmatrix(x);
+            // TA: with sync off only the streams that got a new frame are output
+            t_atom_long updated = (t_atom_long)jit_object_method(max_jit_obex_jitob_get(x), gensym("getupdated"));
+            
+            // TA: right to left, as max_jit_mop_outputmatrix would; the depth-derived outlets only while they are enabled
+            if (updated & TA_KINECT2_UPDATED_MOTION) {
+                long ac = 0;
+                t_atom *av = (t_atom *)jit_object_method(max_jit_obex_jitob_get(x), gensym("getmotion"), &ac);
+                if (av && ac)
+                    max_jit_obex_dumpout(x, gensym("motion"), ac, av);
+            }
+            if (updated & TA_KINECT2_UPDATED_FUSED)
+                max_ta_jit_kinect2_outputstream(x, 10);
+            if (updated & TA_KINECT2_UPDATED_HEIGHTMAP)
+                max_ta_jit_kinect2_outputstream(x, 9);
+            if (updated & TA_KINECT2_UPDATED_VOXELS)
+                max_ta_jit_kinect2_outputstream(x, 8);
+            if (updated & TA_KINECT2_UPDATED_BATCH)
+                max_ta_jit_kinect2_outputstream(x, 7);
+            if (updated & TA_KINECT2_UPDATED_NORMALS)
+                max_ta_jit_kinect2_outputstream(x, 6);
+            if (updated & TA_KINECT2_UPDATED_PYRAMID)
+                max_ta_jit_kinect2_outputstream(x, 5);
+            if (updated & TA_KINECT2_UPDATED_UVMAP)
+                max_ta_jit_kinect2_outputstream(x, 4);
+            if (updated & TA_KINECT2_UPDATED_BIGDEPTH)
+                max_ta_jit_kinect2_outputstream(x, 3);
+            if (updated & TA_KINECT2_UPDATED_RGB)
+                max_ta_jit_kinect2_outputstream(x, 2);
+            if (updated & TA_KINECT2_UPDATED_DEPTH)
+                max_ta_jit_kinect2_outputstream(x, 1);
         }
     }
 }
 
+//TA: output a single mop output matrix (1-based index, like max_jit_mop_getoutput)
+void max_ta_jit_kinect2_outputstream(t_max_ta_jit_kinect2 *x, long index)
+{
+    void *matrix = max_jit_mop_getoutput(x, index);
+    void *outlet = max_jit_mop_getoutlet(x, index);
+    t_atom a;
+    
+    if (matrix && outlet) {
+        jit_atom_setsym(&a, jit_attr_getsym(matrix, _jit_sym_name));
+        outlet_anything(outlet, _jit_sym_jit_matrix, 1, &a);
+    }
+}
+
+//TA: "state" notifications go out the dumpout as "state <closed|opening|streaming|closing|error|reconnecting> [message]"
+t_jit_err max_ta_jit_kinect2_notify(t_max_ta_jit_kinect2 *x, t_symbol *s, t_symbol *msg, void *ob, void *data)
+{
+    if (msg == gensym("state") && data) {
+        t_atom *av = (t_atom *)data;
+        t_symbol *message = jit_atom_getsym(av + 1);
+        long ac = (message && message != _jit_sym_nothing && message->s_name[0]) ? 2 : 1;
+        max_jit_obex_dumpout(x, msg, ac, av);
+    }
+    return JIT_ERR_NONE;
+}
+
 void max_ta_jit_kinect2_bang(t_max_ta_jit_kinect2 *x){
     max_ta_jit_kinect2_outputmatrix(x);
 }
@@ -154,6 +288,30 @@ void max_ta_jit_kinect2_assist(t_max_ta_jit_kinect2 *x, void *b, long msg, long
                 sprintf(s, "(matrix) rgb");
                 break;
             case 2:
+                sprintf(s, "(matrix) bigdepth");
+                break;
+            case 3:
+                sprintf(s, "(matrix) uvmap");
+                break;
+            case 4:
+                sprintf(s, "(matrix) pyramid");
+                break;
+            case 5:
+                sprintf(s, "(matrix) normals");
+                break;
+            case 6:
+                sprintf(s, "(matrix) batch");
+                break;
+            case 7:
+                sprintf(s, "(matrix) voxels");
+                break;
+            case 8:
+                sprintf(s, "(matrix) heightmap");
+                break;
+            case 9:
+                sprintf(s, "(matrix) fused");
+                break;
+            case 10:
                 sprintf(s, "dumpout");
                 break;
         }
@@ -0,0 +1,139 @@
+/**
+ @file
+ nearest_pair_frame_listener - pairs each depth frame with the colour frame
+ closest in time (sync 2)
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "nearest_pair_frame_listener.h"
+#include "frame_pool.h"
+
+#include <chrono>
+
+namespace ta
+{
+
+namespace
+{
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+NearestPairFrameListener::NearestPairFrameListener(size_t history, int max_wait_ms) :
+    max_wait_(max_wait_ms)
+{
+    history_.reserve(history < 2 ? 2 : history);
+    depths_.reserve(history < 2 ? 2 : history);
+}
+
+NearestPairFrameListener::~NearestPairFrameListener()
+{
+    for (size_t i = 0; i < history_.size(); i++)
+        FramePool::recycle(history_[i].frame);
+    for (size_t i = 0; i < depths_.size(); i++)
+        FramePool::recycle(depths_[i].frame);
+}
+
+bool NearestPairFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    libfreenect2::Frame *stale = 0;
+
+    if (type == libfreenect2::Frame::Depth) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (depths_.size() == depths_.capacity()) {
+            stale = depths_.front().frame; // never paired, nobody holds it
+            depths_.erase(depths_.begin());
+        }
+        Waiting waiting = { frame, now() };
+        depths_.push_back(waiting);
+    }
+    else if (type == libfreenect2::Frame::Color) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (history_.size() == history_.capacity()) {
+            // evict the oldest frame nobody is reading
+            size_t i = 0;
+            while (i < history_.size() && history_[i].pinned)
+                i++;
+            if (i == history_.size())
+                return false; // everything pinned, skip this frame
+            stale = history_[i].frame;
+            history_.erase(history_.begin() + i);
+        }
+        Slot slot = { frame, false };
+        history_.push_back(slot);
+    }
+    else {
+        return false; // IR is not used
+    }
+
+    FramePool::recycle(stale);
+    return true;
+}
+
+size_t NearestPairFrameListener::settled(int64_t time) const
+{
+    if (history_.empty())
+        return 0;
+    const uint32_t newest_color = history_.back().frame->timestamp;
+    // newer depth frames have waited less and need a newer colour frame: the settled ones are the oldest
+    size_t n = 0;
+    while (n < depths_.size() &&
+           ((int32_t)(newest_color - depths_[n].frame->timestamp) >= 0 || time - depths_[n].arrival >= max_wait_))
+        n++;
+    return n;
+}
+
+bool NearestPairFrameListener::hasNewFrame() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return settled(now()) > 0;
+}
+
+bool NearestPairFrameListener::takePair(libfreenect2::Frame *&color, libfreenect2::Frame *&depth, int32_t &skew)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t n = settled(now());
+    if (!n)
+        return false;
+
+    // the newest settled one, those before it are too late now (recycling is a lock-free push)
+    depth = depths_[n - 1].frame;
+    for (size_t i = 0; i + 1 < n; i++)
+        FramePool::recycle(depths_[i].frame);
+    depths_.erase(depths_.begin(), depths_.begin() + n);
+
+    size_t best = 0;
+    int32_t best_skew = 0;
+    for (size_t i = 0; i < history_.size(); i++) {
+        // signed difference copes with the 32 bit timestamp wrapping
+        int32_t d = (int32_t)(history_[i].frame->timestamp - depth->timestamp);
+        if (i == 0 || (d < 0 ? -d : d) <= (best_skew < 0 ? -best_skew : best_skew)) {
+            best = i;
+            best_skew = d;
+        }
+    }
+
+    history_[best].pinned = true;
+    color = history_[best].frame;
+    skew = best_skew;
+    return true;
+}
+
+void NearestPairFrameListener::releasePair(libfreenect2::Frame *color, libfreenect2::Frame *depth)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < history_.size(); i++) {
+            if (history_[i].frame == color)
+                history_[i].pinned = false;
+        }
+    }
+    FramePool::recycle(depth);
+}
+
+} // namespace ta
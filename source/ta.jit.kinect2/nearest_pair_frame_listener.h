@@ -0,0 +1,66 @@
+/**
+ @file
+ nearest_pair_frame_listener - pairs each depth frame with the colour frame
+ closest in time (sync 2)
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_NEAREST_PAIR_FRAME_LISTENER_H
+#define TA_NEAREST_PAIR_FRAME_LISTENER_H
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include <frame_listener.hpp>
+
+namespace ta
+{
+
+// Listens to both streams, each into a short history ring. A depth frame is
+// paired once its match is settled: when a colour frame at least as new has
+// arrived (a later one can only be further away), or when it has waited
+// max_wait ms for one (a stalled or 15 fps colour stream). It then gets the
+// colour frame whose timestamp is nearest. takePair() hands out the newest
+// settled depth frame and drops the older ones, so a slow consumer sees the
+// latest pair, never a backlog. The returned colour frame stays pinned in
+// the ring until releasePair().
+class NearestPairFrameListener : public libfreenect2::FrameListener
+{
+public:
+    NearestPairFrameListener(size_t history, int max_wait_ms);
+    virtual ~NearestPairFrameListener();
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+    bool hasNewFrame() const;
+
+    // skew is colour minus depth timestamp, in device ticks (0.1 ms)
+    bool takePair(libfreenect2::Frame *&color, libfreenect2::Frame *&depth, int32_t &skew);
+    void releasePair(libfreenect2::Frame *color, libfreenect2::Frame *depth);
+
+private:
+    struct Slot
+    {
+        libfreenect2::Frame *frame;
+        bool pinned;
+    };
+
+    struct Waiting
+    {
+        libfreenect2::Frame *frame;
+        int64_t arrival; // ms, steady clock
+    };
+
+    size_t settled(int64_t now) const; // how many of the oldest depth frames can be paired, under mutex_
+
+    std::vector<Slot> history_;    // colour, oldest first
+    std::vector<Waiting> depths_;  // oldest first
+    int max_wait_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace ta
+
+#endif // TA_NEAREST_PAIR_FRAME_LISTENER_H
@@ -0,0 +1,719 @@
+/**
+ @file
+ parallel_depth_packet_processor - CPU depth decoding (phase unwrapping and
+ filters) split into row bands over a pool of threads, with SSE where it pays
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "parallel_depth_packet_processor.h"
+#include "ring_logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+namespace ta
+{
+
+static float *allocPlane(size_t count)
+{
+    void *p = 0;
+    if (posix_memalign(&p, 64, count * sizeof(float)) != 0)
+        return 0;
+    std::memset(p, 0, count * sizeof(float));
+    return (float *)p;
+}
+
+/************************************************************************************/
+// validation against the stock processor
+
+// keeps the stock processor's depth frame (which stays owned by it) for comparison
+class ReferenceListener : public libfreenect2::FrameListener
+{
+public:
+    ReferenceListener() : depth(0) {}
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+    {
+        if (type == libfreenect2::Frame::Depth)
+            depth = frame;
+        return false;
+    }
+    libfreenect2::Frame *depth;
+};
+
+namespace
+{
+
+// command response layout as in libfreenect2's protocol/response.h
+struct P0TablesResponse
+{
+    uint32_t headersize;
+    uint32_t unknown1;
+    uint32_t unknown2;
+    uint32_t tablesize;
+    uint32_t unknown3;
+    uint32_t unknown4;
+    uint32_t unknown5;
+    uint32_t unknown6;
+
+    uint16_t unknown7;
+    uint16_t p0table0[512 * 424];
+    uint16_t unknown8;
+
+    uint16_t unknown9;
+    uint16_t p0table1[512 * 424];
+    uint16_t unknown10;
+
+    uint16_t unknown11;
+    uint16_t p0table2[512 * 424];
+    uint16_t unknown12;
+};
+
+}
+
+/************************************************************************************/
+// ParallelCpuDepthPacketProcessor
+
+ParallelCpuDepthPacketProcessor::ParallelCpuDepthPacketProcessor(size_t num_threads, unsigned int validate_every, FramePool *frames) :
+    enable_bilateral_filter_(true),
+    enable_edge_filter_(true),
+    pool_(num_threads),
+    frame_pool_(frames),
+    validate_every_(validate_every),
+    packets_(0),
+    reference_(0),
+    reference_listener_(0)
+{
+    params_.min_depth = config_.MinDepth * 1000.0f;
+    params_.max_depth = config_.MaxDepth * 1000.0f;
+
+    std::memset(lut11to16_, 0, sizeof(lut11to16_));
+    x_table_ = allocPlane(Pixels);
+    z_table_ = allocPlane(Pixels);
+    trig_storage_ = allocPlane(3 * 6 * Pixels);
+    for (int f = 0; f < 3; f++)
+        for (int k = 0; k < 6; k++)
+            trig_table_[f][k] = trig_storage_ + (f * 6 + k) * Pixels;
+    cache_ = 0;
+    for (int p = 0; p < Planes; p++) {
+        m_[p] = allocPlane(Pixels);
+        m_filtered_[p] = allocPlane(Pixels);
+    }
+    max_edge_test_ = (unsigned char *)std::malloc(Pixels);
+    std::memset(max_edge_test_, 1, Pixels); // stays 1 when the bilateral filter is off
+    raw_depth_ = allocPlane(Pixels);
+    edge_depth_ = allocPlane(Pixels);
+    ir_sum_ = allocPlane(Pixels);
+
+    ir_frame_ = newFrame();
+    depth_frame_ = newFrame();
+
+    if (validate_every_ > 0) {
+        reference_ = new libfreenect2::CpuDepthPacketProcessor();
+        reference_listener_ = new ReferenceListener();
+        reference_->setFrameListener(reference_listener_);
+    }
+}
+
+ParallelCpuDepthPacketProcessor::~ParallelCpuDepthPacketProcessor()
+{
+    delete reference_;
+    delete reference_listener_;
+    FramePool::recycle(ir_frame_);
+    FramePool::recycle(depth_frame_);
+
+    std::free(x_table_);
+    std::free(z_table_);
+    std::free(trig_storage_);
+    for (int p = 0; p < Planes; p++) {
+        std::free(m_[p]);
+        std::free(m_filtered_[p]);
+    }
+    std::free(max_edge_test_);
+    std::free(raw_depth_);
+    std::free(edge_depth_);
+    std::free(ir_sum_);
+}
+
+void ParallelCpuDepthPacketProcessor::setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config)
+{
+    DepthPacketProcessor::setConfiguration(config);
+    params_.min_depth = config.MinDepth * 1000.0f;
+    params_.max_depth = config.MaxDepth * 1000.0f;
+    enable_bilateral_filter_ = config.EnableBilateralFilter;
+    enable_edge_filter_ = config.EnableEdgeAwareFilter;
+
+    if (reference_)
+        reference_->setConfiguration(config);
+}
+
+void ParallelCpuDepthPacketProcessor::loadP0TablesFromCommandResponse(unsigned char *buffer, size_t buffer_length)
+{
+    if (reference_)
+        reference_->loadP0TablesFromCommandResponse(buffer, buffer_length);
+
+    if (buffer_length < sizeof(P0TablesResponse)) {
+        logMessage(libfreenect2::Logger::Error, "P0Table response too short!");
+        return;
+    }
+    const P0TablesResponse *p0table = reinterpret_cast<const P0TablesResponse *>(buffer);
+    const size_t trig_bytes = 3 * 6 * Pixels * sizeof(float);
+
+    // keyed by the P0 tables and the phases they are combined with
+    uint64_t key = 0;
+    if (cache_) {
+        key = CalibrationCache::hash(params_.phase_in_rad, sizeof(params_.phase_in_rad));
+        key = CalibrationCache::hash(p0table->p0table0, sizeof(p0table->p0table0), key);
+        key = CalibrationCache::hash(p0table->p0table1, sizeof(p0table->p0table1), key);
+        key = CalibrationCache::hash(p0table->p0table2, sizeof(p0table->p0table2), key);
+
+        if (const float *cached = (const float *)cache_->find(CalibrationCache::TrigTables, key, trig_bytes)) {
+            // read straight from the mapping (64 byte aligned, as the SSE loads need)
+            for (int f = 0; f < 3; f++)
+                for (int k = 0; k < 6; k++)
+                    trig_table_[f][k] = const_cast<float *>(cached) + (f * 6 + k) * Pixels;
+            logMessage(libfreenect2::Logger::Info, "P0 trig tables loaded from " + cache_->path());
+            return;
+        }
+    }
+
+    for (int f = 0; f < 3; f++)
+        for (int k = 0; k < 6; k++)
+            trig_table_[f][k] = trig_storage_ + (f * 6 + k) * Pixels;
+
+    fillTrigTables(p0table->p0table0, 0);
+    fillTrigTables(p0table->p0table1, 1);
+    fillTrigTables(p0table->p0table2, 2);
+
+    if (cache_)
+        cache_->store(CalibrationCache::TrigTables, key, trig_storage_, trig_bytes);
+}
+
+void ParallelCpuDepthPacketProcessor::fillTrigTables(const uint16_t *p0_table, int frequency)
+{
+    float **trig = trig_table_[frequency];
+
+    for (int y = 0; y < Height; ++y) {
+        const uint16_t *row = p0_table + y * Width;
+        for (int x = 0; x < Width; ++x) {
+            int i = y * Width + x;
+            // the stock processor flips the tables horizontally
+            float p0 = -((float)row[Width - 1 - x]) * 0.000031 * M_PI;
+
+            float tmp0 = p0 + params_.phase_in_rad[0];
+            float tmp1 = p0 + params_.phase_in_rad[1];
+            float tmp2 = p0 + params_.phase_in_rad[2];
+
+            trig[0][i] = std::cos(tmp0);
+            trig[1][i] = std::cos(tmp1);
+            trig[2][i] = std::cos(tmp2);
+
+            trig[3][i] = std::sin(-tmp0);
+            trig[4][i] = std::sin(-tmp1);
+            trig[5][i] = std::sin(-tmp2);
+        }
+    }
+}
+
+void ParallelCpuDepthPacketProcessor::loadXZTables(const float *xtable, const float *ztable)
+{
+    if (reference_)
+        reference_->loadXZTables(xtable, ztable);
+    std::memcpy(x_table_, xtable, Pixels * sizeof(float));
+    std::memcpy(z_table_, ztable, Pixels * sizeof(float));
+}
+
+void ParallelCpuDepthPacketProcessor::loadLookupTable(const short *lut)
+{
+    if (reference_)
+        reference_->loadLookupTable(lut);
+    std::memcpy(lut11to16_, lut, sizeof(lut11to16_));
+}
+
+/************************************************************************************/
+// stage 1: unpack the 11 bit measurements and project them on the P0 phases
+
+void ParallelCpuDepthPacketProcessor::decodeRows(const unsigned char *data, int first, int end)
+{
+    float raw[Planes][Width]; // nine measurements of one row, as planes
+
+    for (int y = first; y < end; ++y) {
+        // rows are stored from the centre outwards
+        int src_row = y < 212 ? y + 212 : 423 - y;
+
+        for (int sub = 0; sub < Planes; ++sub) {
+            // 298496 = 512 * 424 * 11 / 8 = number of bytes per sub image
+            const uint16_t *ptr = reinterpret_cast<const uint16_t *>(data + 298496 * sub) + 352 * src_row;
+            float *out = raw[sub];
+
+            out[0] = lut11to16_[0];
+            out[Width - 1] = lut11to16_[0];
+            for (int x = 1; x < Width - 1; ++x) {
+                int r1zi = (x >> 2) + ((x & 0x3) << 7);
+                r1zi = r1zi * 11; // range 0..5610
+
+                int r1yi = r1zi >> 4; // range 0..350
+                r1zi = r1zi & 15;
+
+                int i1 = ptr[r1yi];
+                int i2 = ptr[r1yi + 1];
+                i1 = i1 >> r1zi;
+                i2 = i2 << (16 - r1zi);
+
+                out[x] = (float)(int32_t)lut11to16_[((i1 | i2) & 2047)];
+            }
+        }
+
+        int x = 0;
+        size_t row = (size_t)y * Width;
+        for (int f = 0; f < 3; ++f) {
+            float **trig = trig_table_[f];
+            const float *m0 = raw[f * 3], *m1 = raw[f * 3 + 1], *m2 = raw[f * 3 + 2];
+            float *a_out = m_[f * 3] + row, *b_out = m_[f * 3 + 1] + row, *amp_out = m_[f * 3 + 2] + row;
+            float multiplier = params_.ab_multiplier_per_frq[f];
+            x = 0;
+
+#if defined(__SSE2__)
+            // same operations in the same order as the scalar loop, four pixels at a time
+            const __m128 mult = _mm_set1_ps(multiplier);
+            const __m128 ab_mult = _mm_set1_ps(params_.ab_multiplier);
+            for (; x + 4 <= Width; x += 4) {
+                size_t i = row + x;
+                __m128 r0 = _mm_loadu_ps(m0 + x), r1 = _mm_loadu_ps(m1 + x), r2 = _mm_loadu_ps(m2 + x);
+
+                __m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(trig[0] + i), r0),
+                                                 _mm_mul_ps(_mm_load_ps(trig[1] + i), r1)),
+                                      _mm_mul_ps(_mm_load_ps(trig[2] + i), r2));
+                __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(trig[3] + i), r0),
+                                                 _mm_mul_ps(_mm_load_ps(trig[4] + i), r1)),
+                                      _mm_mul_ps(_mm_load_ps(trig[5] + i), r2));
+                a = _mm_mul_ps(a, mult);
+                b = _mm_mul_ps(b, mult);
+                __m128 amp = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b))), ab_mult);
+
+                _mm_store_ps(a_out + x, a);
+                _mm_store_ps(b_out + x, b);
+                _mm_store_ps(amp_out + x, amp);
+            }
+#endif
+            for (; x < Width; ++x) {
+                size_t i = row + x;
+                float a = trig[0][i] * m0[x] + trig[1][i] * m1[x] + trig[2][i] * m2[x];
+                float b = trig[3][i] * m0[x] + trig[4][i] * m1[x] + trig[5][i] * m2[x];
+                a *= multiplier;
+                b *= multiplier;
+                a_out[x] = a;
+                b_out[x] = b;
+                amp_out[x] = std::sqrt(a * a + b * b) * params_.ab_multiplier;
+            }
+        }
+    }
+}
+
+/************************************************************************************/
+// joint bilateral filter over the three (a, b) pairs
+
+void ParallelCpuDepthPacketProcessor::bilateralRows(int first, int end)
+{
+    const float inf = std::numeric_limits<float>::infinity();
+
+    for (int y = first; y < end; ++y) {
+        for (int x = 0; x < Width; ++x) {
+            size_t i = (size_t)y * Width + x;
+
+            if (x < 1 || y < 1 || x > 510 || y > 422) {
+                for (int p = 0; p < Planes; ++p)
+                    m_filtered_[p][i] = m_[p][i];
+                max_edge_test_[i] = 1;
+                continue;
+            }
+
+            bool max_edge_test = true;
+
+            for (int f = 0; f < 3; ++f) {
+                const float *a_plane = m_[f * 3], *b_plane = m_[f * 3 + 1];
+                float a = a_plane[i], b = b_plane[i];
+
+                float norm2 = a * a + b * b;
+                float inv_norm = 1.0f / std::sqrt(norm2);
+                inv_norm = (inv_norm == inv_norm) ? inv_norm : inf;
+
+                float m_normalized[2] = { a * inv_norm, b * inv_norm };
+
+                float weight_acc = 0.0f;
+                float weighted_m_acc[2] = { 0.0f, 0.0f };
+
+                float threshold = (params_.joint_bilateral_ab_threshold * params_.joint_bilateral_ab_threshold) / (params_.ab_multiplier * params_.ab_multiplier);
+                float joint_bilateral_exp = params_.joint_bilateral_exp;
+
+                if (norm2 < threshold) {
+                    threshold = 0.0f;
+                    joint_bilateral_exp = 0.0f;
+                }
+
+                float dist_acc = 0.0f;
+                int j = 0;
+
+                for (int yi = -1; yi < 2; ++yi) {
+                    for (int xi = -1; xi < 2; ++xi, ++j) {
+                        if (yi == 0 && xi == 0) {
+                            weight_acc += params_.gaussian_kernel[j];
+
+                            weighted_m_acc[0] += params_.gaussian_kernel[j] * a;
+                            weighted_m_acc[1] += params_.gaussian_kernel[j] * b;
+                            continue;
+                        }
+
+                        size_t o = i + yi * Width + xi;
+                        float other_a = a_plane[o], other_b = b_plane[o];
+                        float other_norm2 = other_a * other_a + other_b * other_b;
+                        float other_inv_norm = 1.0f / std::sqrt(other_norm2);
+                        other_inv_norm = (other_inv_norm == other_inv_norm) ? other_inv_norm : inf;
+
+                        float dist = -(other_a * other_inv_norm * m_normalized[0] + other_b * other_inv_norm * m_normalized[1]);
+                        dist += 1.0f;
+                        dist *= 0.5f;
+
+                        float weight = 0.0f;
+
+                        if (other_norm2 >= threshold) {
+                            weight = (params_.gaussian_kernel[j] * std::exp(-1.442695f * joint_bilateral_exp * dist));
+                            dist_acc += dist;
+                        }
+
+                        weighted_m_acc[0] += weight * other_a;
+                        weighted_m_acc[1] += weight * other_b;
+
+                        weight_acc += weight;
+                    }
+                }
+
+                max_edge_test = max_edge_test && dist_acc < params_.joint_bilateral_max_edge;
+
+                m_filtered_[f * 3][i] = 0.0f < weight_acc ? weighted_m_acc[0] / weight_acc : 0.0f;
+                m_filtered_[f * 3 + 1][i] = 0.0f < weight_acc ? weighted_m_acc[1] / weight_acc : 0.0f;
+                m_filtered_[f * 3 + 2][i] = m_[f * 3 + 2][i];
+            }
+
+            max_edge_test_[i] = max_edge_test ? 1 : 0;
+        }
+    }
+}
+
+/************************************************************************************/
+// stage 2: phase unwrapping, depth and IR
+
+void ParallelCpuDepthPacketProcessor::processPixelStage2(int x, int y, const float *m, float &ir_out, float &depth_out, float &ir_sum_out) const
+{
+    const float *m0 = m, *m1 = m + 3, *m2 = m + 6;
+
+    float tmp0 = std::atan2((m0[1]), (m0[0]));
+    float tmp1 = std::atan2((m1[1]), (m1[0]));
+    float tmp2 = std::atan2((m2[1]), (m2[0]));
+
+    float ir_sum = m0[2] + m1[2] + m2[2];
+
+    float phase;
+    // formula given < 0 ? (given + 2 * M_PI) : given;
+    tmp0 = tmp0 < 0 ? tmp0 + M_PI * 2.0f : tmp0;
+    tmp0 = (tmp0 != tmp0) ? 0 : tmp0;
+    tmp1 = tmp1 < 0 ? tmp1 + M_PI * 2.0f : tmp1;
+    tmp1 = (tmp1 != tmp1) ? 0 : tmp1;
+    tmp2 = tmp2 < 0 ? tmp2 + M_PI * 2.0f : tmp2;
+    tmp2 = (tmp2 != tmp2) ? 0 : tmp2;
+
+    // ir min amplitude
+    float ir_min = std::min(std::min(m0[2], m1[2]), m2[2]);
+
+    if (ir_min < params_.individual_ab_threshold || ir_sum < params_.ab_threshold) {
+        phase = 0;
+    }
+    else {
+        float t0 = tmp0 / (2.0f * M_PI) * 3.0f;
+        float t1 = tmp1 / (2.0f * M_PI) * 15.0f;
+        float t2 = tmp2 / (2.0f * M_PI) * 2.0f;
+
+        float t5 = (std::floor((t1 - t0) * 0.333333f + 0.5f) * 3.0f + t0);
+        float t3 = (-t2 + t5);
+        float t4 = t3 * 2.0f;
+
+        bool c1 = t4 >= -t4; // true if t4 positive
+
+        float f1 = c1 ? 2.0f : -2.0f;
+        float f2 = c1 ? 0.5f : -0.5f;
+        t3 *= f2;
+        t3 = (t3 - std::floor(t3)) * f1;
+
+        bool c2 = 0.5f < std::abs(t3) && std::abs(t3) < 1.5f;
+
+        float t6 = c2 ? t5 + 15.0f : t5;
+        float t7 = c2 ? t1 + 15.0f : t1;
+
+        float t8 = (std::floor((-t2 + t6) * 0.5f + 0.5f) * 2.0f + t2) * 0.5f;
+
+        t6 *= 0.333333f; // = / 3
+        t7 *= 0.066667f; // = / 15
+
+        float t9 = (t8 + t6 + t7); // transformed phase measurements
+        float t10 = t9 * 0.333333f; // some avg
+
+        t6 *= 2.0f * M_PI;
+        t7 *= 2.0f * M_PI;
+        t8 *= 2.0f * M_PI;
+
+        // some cross product
+        float t8_new = t7 * 0.826977f - t8 * 0.110264f;
+        float t6_new = t8 * 0.551318f - t6 * 0.826977f;
+        float t7_new = t6 * 0.110264f - t7 * 0.551318f;
+
+        t8 = t8_new;
+        t6 = t6_new;
+        t7 = t7_new;
+
+        float norm = t8 * t8 + t6 * t6 + t7 * t7;
+        float mask = t9 >= 0.0f ? 1.0f : 0.0f;
+        t10 *= mask;
+
+        bool slope_positive = 0 < params_.ab_confidence_slope;
+
+        float ir_min_ = std::min(std::min(m0[2], m1[2]), m2[2]);
+        float ir_max_ = std::max(std::max(m0[2], m1[2]), m2[2]);
+
+        float ir_x = slope_positive ? ir_min_ : ir_max_;
+
+        ir_x = std::log(ir_x);
+        ir_x = (ir_x * params_.ab_confidence_slope * 0.301030f + params_.ab_confidence_offset) * 3.321928f;
+        ir_x = std::exp(ir_x);
+        ir_x = std::min(params_.max_dealias_confidence, std::max(params_.min_dealias_confidence, ir_x));
+        ir_x *= ir_x;
+
+        float mask2 = ir_x >= norm ? 1.0f : 0.0f;
+
+        // libfreenect2 always takes the confidence-masked phase (mode bit 2)
+        phase = t10 * mask2;
+    }
+
+    // this seems to be the phase to depth mapping :)
+    size_t i = (size_t)y * Width + x;
+    float zmultiplier = z_table_[i];
+    float xmultiplier = x_table_[i];
+
+    phase = 0 < phase ? phase + params_.phase_offset : phase;
+
+    float depth_linear = zmultiplier * phase;
+    float max_depth = phase * params_.unambigious_dist * 2;
+
+    bool cond1 = 0 < depth_linear && 0 < max_depth;
+
+    xmultiplier = (xmultiplier * 90) / (max_depth * max_depth * 8192.0);
+
+    float depth_fit = depth_linear / (-depth_linear * xmultiplier + 1);
+
+    depth_fit = depth_fit < 0 ? 0 : depth_fit;
+    float depth = cond1 ? depth_fit : depth_linear;
+
+    depth_out = depth;
+    ir_sum_out = ir_sum;
+
+    // ir avg
+    ir_out = std::min((m0[2] + m1[2] + m2[2]) * 0.3333333f * params_.ab_output_multiplier, 65535.0f);
+}
+
+void ParallelCpuDepthPacketProcessor::depthRows(int first, int end)
+{
+    float *const *planes = enable_bilateral_filter_ ? m_filtered_ : m_;
+    float *ir_out = (float *)ir_frame_->data;
+    float *depth_out = (float *)depth_frame_->data;
+    float m[Planes];
+
+    for (int y = first; y < end; ++y) {
+        // output is flipped vertically
+        float *ir_row = ir_out + (size_t)(423 - y) * Width;
+        float *depth_row = depth_out + (size_t)(423 - y) * Width;
+
+        for (int x = 0; x < Width; ++x) {
+            size_t i = (size_t)y * Width + x;
+            for (int p = 0; p < Planes; ++p)
+                m[p] = planes[p][i];
+
+            float raw_depth, ir_sum;
+            processPixelStage2(x, y, m, ir_row[x], raw_depth, ir_sum);
+
+            if (enable_edge_filter_) {
+                raw_depth_[i] = raw_depth;
+                edge_depth_[i] = max_edge_test_[i] == 1 ? raw_depth : 0;
+                ir_sum_[i] = ir_sum;
+            }
+            else {
+                depth_row[x] = raw_depth;
+            }
+        }
+    }
+}
+
+/************************************************************************************/
+// edge aware filter
+
+void ParallelCpuDepthPacketProcessor::filterPixelStage2(int x, int y, bool max_edge_test_ok, float &depth_out) const
+{
+    size_t i = (size_t)y * Width + x;
+    float raw_depth = raw_depth_[i], ir_sum = ir_sum_[i];
+
+    if (raw_depth >= params_.min_depth && raw_depth <= params_.max_depth) {
+        if (x < 1 || y < 1 || x > 510 || y > 422) {
+            depth_out = raw_depth;
+        }
+        else {
+            float ir_sum_acc = ir_sum, squared_ir_sum_acc = ir_sum * ir_sum, min_depth = raw_depth, max_depth = raw_depth;
+
+            for (int yi = -1; yi < 2; ++yi) {
+                for (int xi = -1; xi < 2; ++xi) {
+                    if (yi == 0 && xi == 0)
+                        continue;
+
+                    size_t o = i + yi * Width + xi;
+                    float other_ir_sum = ir_sum_[o], other_depth = edge_depth_[o];
+
+                    ir_sum_acc += other_ir_sum;
+                    squared_ir_sum_acc += other_ir_sum * other_ir_sum;
+
+                    if (0.0f < other_depth) {
+                        min_depth = std::min(min_depth, other_depth);
+                        max_depth = std::max(max_depth, other_depth);
+                    }
+                }
+            }
+
+            float tmp0 = std::sqrt(squared_ir_sum_acc * 9.0f - ir_sum_acc * ir_sum_acc) / 9.0f;
+            float edge_avg = std::max(ir_sum_acc / 9.0f, params_.edge_ab_avg_min_value);
+            tmp0 /= edge_avg;
+
+            float abs_min_diff = std::abs(raw_depth - min_depth);
+            float abs_max_diff = std::abs(raw_depth - max_depth);
+
+            float avg_diff = (abs_min_diff + abs_max_diff) * 0.5f;
+            float max_abs_diff = std::max(abs_min_diff, abs_max_diff);
+
+            bool cond0 =
+                0.0f < raw_depth &&
+                tmp0 >= params_.edge_ab_std_dev_threshold &&
+                params_.edge_close_delta_threshold < abs_min_diff &&
+                params_.edge_far_delta_threshold < abs_max_diff &&
+                params_.edge_max_delta_threshold < max_abs_diff &&
+                params_.edge_avg_delta_threshold < avg_diff;
+
+            // libfreenect2's edge count is always 0, so only the bilateral edge test is left
+            depth_out = (!cond0 && max_edge_test_ok) ? raw_depth : 0.0f;
+        }
+    }
+    else {
+        depth_out = 0.0f;
+    }
+}
+
+void ParallelCpuDepthPacketProcessor::edgeRows(int first, int end)
+{
+    float *depth_out = (float *)depth_frame_->data;
+
+    for (int y = first; y < end; ++y) {
+        float *depth_row = depth_out + (size_t)(423 - y) * Width;
+        for (int x = 0; x < Width; ++x)
+            filterPixelStage2(x, y, max_edge_test_[(size_t)y * Width + x] == 1, depth_row[x]);
+    }
+}
+
+/************************************************************************************/
+
+void ParallelCpuDepthPacketProcessor::process(const libfreenect2::DepthPacket &packet)
+{
+    // every stage reads neighbouring rows of the previous one, hence one run per stage
+    pool_.run(std::bind(&ParallelCpuDepthPacketProcessor::decodeRows, this, packet.buffer, std::placeholders::_1, std::placeholders::_2));
+    if (enable_bilateral_filter_)
+        pool_.run(std::bind(&ParallelCpuDepthPacketProcessor::bilateralRows, this, std::placeholders::_1, std::placeholders::_2));
+    pool_.run(std::bind(&ParallelCpuDepthPacketProcessor::depthRows, this, std::placeholders::_1, std::placeholders::_2));
+    if (enable_edge_filter_)
+        pool_.run(std::bind(&ParallelCpuDepthPacketProcessor::edgeRows, this, std::placeholders::_1, std::placeholders::_2));
+
+    if (reference_ && (packets_++ % validate_every_) == 0)
+        validate(packet);
+
+    if (listener_ != 0) {
+        ir_frame_->timestamp = packet.timestamp;
+        depth_frame_->timestamp = packet.timestamp;
+        ir_frame_->sequence = packet.sequence;
+        depth_frame_->sequence = packet.sequence;
+
+        if (listener_->onNewFrame(libfreenect2::Frame::Ir, ir_frame_))
+            ir_frame_ = newFrame();
+        if (listener_->onNewFrame(libfreenect2::Frame::Depth, depth_frame_))
+            depth_frame_ = newFrame();
+    }
+}
+
+libfreenect2::Frame *ParallelCpuDepthPacketProcessor::newFrame()
+{
+    // a listener holding more than the pool was sized for costs an allocation, not a frame
+    libfreenect2::Frame *frame = frame_pool_ ? frame_pool_->acquire() : 0;
+    return frame ? frame : new libfreenect2::Frame(Width, Height, 4);
+}
+
+void ParallelCpuDepthPacketProcessor::validate(const libfreenect2::DepthPacket &packet)
+{
+    reference_listener_->depth = 0;
+    reference_->process(packet);
+    if (!reference_listener_->depth)
+        return;
+
+    const float *expected = (const float *)reference_listener_->depth->data;
+    const float *actual = (const float *)depth_frame_->data;
+    size_t differing = 0;
+    float max_diff = 0.0f;
+
+    for (size_t i = 0; i < Pixels; i++) {
+        float diff = std::abs(expected[i] - actual[i]);
+        if (diff > 1.0f)
+            differing++;
+        if (diff > max_diff)
+            max_diff = diff;
+    }
+
+    std::ostringstream message;
+    message << "depth validation (packet " << packet.sequence << "): " << differing << " of " << (size_t)Pixels
+            << " pixels differ from the stock CPU processor by more than 1 mm, max difference " << max_diff << " mm";
+    logMessage(differing ? libfreenect2::Logger::Warning : libfreenect2::Logger::Info, message.str());
+}
+
+/************************************************************************************/
+// ParallelCpuPacketPipeline
+
+ParallelCpuPacketPipeline::ParallelCpuPacketPipeline(size_t num_threads, unsigned int validate_every, FramePool *frames) :
+    num_threads_(num_threads),
+    validate_every_(validate_every),
+    frames_(frames)
+{
+    initialize();
+}
+
+ParallelCpuPacketPipeline::~ParallelCpuPacketPipeline()
+{
+}
+
+libfreenect2::DepthPacketProcessor *ParallelCpuPacketPipeline::createDepthPacketProcessor()
+{
+    return new ParallelCpuDepthPacketProcessor(num_threads_, validate_every_, frames_);
+}
+
+} // namespace ta
@@ -0,0 +1,124 @@
+/**
+ @file
+ parallel_depth_packet_processor - CPU depth decoding (phase unwrapping and
+ filters) split into row bands over a pool of threads, with SSE where it pays
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_PARALLEL_DEPTH_PACKET_PROCESSOR_H
+#define TA_PARALLEL_DEPTH_PACKET_PROCESSOR_H
+
+#include <libfreenect2.hpp>
+#include <depth_packet_processor.h>
+#include <packet_pipeline.h>
+
+#include "calibration_cache.h"
+#include "frame_pool.h"
+#include "row_pool.h"
+
+namespace ta
+{
+
+class ReferenceListener;
+
+// Same output as libfreenect2's CpuDepthPacketProcessor (same tables, same
+// parameters, same operation order), but every stage is row-parallel and the
+// per-pixel data is kept as planes so the measurement stage runs four pixels
+// per SSE instruction. All buffers are allocated once, not per packet; the IR
+// and depth frames handed to the listener come from frames (when given and
+// not exhausted, else they are allocated).
+//
+// With validate_every > 0, every Nth packet is also decoded by the stock
+// processor and the depth difference is logged, to check a build against
+// libfreenect2 on live data.
+class ParallelCpuDepthPacketProcessor : public libfreenect2::DepthPacketProcessor
+{
+public:
+    ParallelCpuDepthPacketProcessor(size_t num_threads, unsigned int validate_every, FramePool *frames);
+    virtual ~ParallelCpuDepthPacketProcessor();
+
+    virtual void setConfiguration(const libfreenect2::DepthPacketProcessor::Config &config);
+
+    virtual void loadP0TablesFromCommandResponse(unsigned char *buffer, size_t buffer_length);
+    virtual void loadXZTables(const float *xtable, const float *ztable);
+    virtual void loadLookupTable(const short *lut);
+
+    virtual void process(const libfreenect2::DepthPacket &packet);
+
+    // trig tables are looked up in / added to cache (which must outlive the processor)
+    void setCalibrationCache(CalibrationCache *cache) { cache_ = cache; }
+
+    // the worker threads of its RowPool, false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error) { return pool_.setThreadPolicy(policy, error); }
+
+private:
+    enum
+    {
+        Width = 512,
+        Height = 424,
+        Pixels = Width * Height,
+        Planes = 9 // a, b, amplitude for each of the three frequencies
+    };
+
+    void fillTrigTables(const uint16_t *p0_table, int frequency);
+
+    void decodeRows(const unsigned char *data, int first, int end);
+    void bilateralRows(int first, int end);
+    void depthRows(int first, int end);
+    void edgeRows(int first, int end);
+    void processPixelStage2(int x, int y, const float *m, float &ir_out, float &depth_out, float &ir_sum_out) const;
+    void filterPixelStage2(int x, int y, bool max_edge_test_ok, float &depth_out) const;
+
+    void validate(const libfreenect2::DepthPacket &packet);
+    libfreenect2::Frame *newFrame();
+
+    libfreenect2::DepthPacketProcessor::Parameters params_;
+    bool enable_bilateral_filter_;
+    bool enable_edge_filter_;
+
+    RowPool pool_;
+
+    short lut11to16_[2048];
+    float *x_table_;
+    float *z_table_;
+    float *trig_storage_;     // 18 planes, used unless the tables come from the cache
+    float *trig_table_[3][6]; // cos(p0 + phase[i]) x3, sin(-(p0 + phase[i])) x3, per frequency
+    CalibrationCache *cache_;
+    float *m_[Planes];          // stage 1 output
+    float *m_filtered_[Planes]; // after the bilateral filter
+    unsigned char *max_edge_test_;
+    float *raw_depth_;           // stage 2 output, before the edge filter
+    float *edge_depth_;          // raw depth where the bilateral edge test passed, else 0
+    float *ir_sum_;
+
+    FramePool *frame_pool_; // 512 x 424 x 4, may be 0
+    libfreenect2::Frame *ir_frame_;
+    libfreenect2::Frame *depth_frame_;
+
+    unsigned int validate_every_;
+    unsigned long packets_;
+    libfreenect2::CpuDepthPacketProcessor *reference_;
+    ReferenceListener *reference_listener_;
+};
+
+// BasePacketPipeline whose depth processor is ParallelCpuDepthPacketProcessor
+// (depth_processor 3). Colour and the stream parsers are libfreenect2's.
+class ParallelCpuPacketPipeline : public libfreenect2::BasePacketPipeline
+{
+public:
+    ParallelCpuPacketPipeline(size_t num_threads, unsigned int validate_every, FramePool *frames);
+    virtual ~ParallelCpuPacketPipeline();
+
+protected:
+    virtual libfreenect2::DepthPacketProcessor *createDepthPacketProcessor();
+
+private:
+    size_t num_threads_;
+    unsigned int validate_every_;
+    FramePool *frames_;
+};
+
+} // namespace ta
+
+#endif // TA_PARALLEL_DEPTH_PACKET_PROCESSOR_H
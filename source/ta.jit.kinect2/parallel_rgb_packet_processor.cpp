@@ -0,0 +1,237 @@
+/**
+ @file
+ parallel_rgb_packet_processor - decodes colour JPEG packets on a pool of
+ TurboJPEG worker threads and delivers the frames in sequence order
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "parallel_rgb_packet_processor.h"
+
+#include <cstring>
+#include <turbojpeg.h>
+
+// matrix dimensions
+#define RGB_WIDTH 1920
+#define RGB_HEIGHT 1080
+
+namespace ta
+{
+
+/************************************************************************************/
+// ParallelRgbPacketProcessor
+
+ParallelRgbPacketProcessor::ParallelRgbPacketProcessor(size_t num_threads, FramePool *pool) :
+    pool_(pool),
+    delivering_(false),
+    shutdown_(false)
+{
+    if (num_threads < 1)
+        num_threads = 1;
+
+    // two slots per decoder: one decoding, one waiting, anything more is stale
+    jobs_.resize(num_threads * 2);
+    for (size_t i = 0; i < jobs_.size(); i++) {
+        jobs_[i].frame = 0;
+        jobs_[i].jpeg.reserve(1024 * 1024);
+        free_jobs_.push_back(&jobs_[i]);
+    }
+    delivery_.reserve(jobs_.size());
+    for (size_t i = 0; i < num_threads; i++)
+        workers_.push_back(std::thread(&ParallelRgbPacketProcessor::workerLoop, this));
+}
+
+ParallelRgbPacketProcessor::~ParallelRgbPacketProcessor()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    cond_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i].join();
+    for (size_t i = 0; i < jobs_.size(); i++)
+        FramePool::recycle(jobs_[i].frame);
+}
+
+bool ParallelRgbPacketProcessor::ready()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !free_jobs_.empty();
+}
+
+void ParallelRgbPacketProcessor::process(const libfreenect2::RgbPacket &packet)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (free_jobs_.empty())
+        return; // parser didn't check ready(), drop the packet
+    Job *job = free_jobs_.back();
+    free_jobs_.pop_back();
+    lock.unlock();
+
+    // the parser reuses its buffer as soon as we return, so keep a copy
+    job->sequence = packet.sequence;
+    job->timestamp = packet.timestamp;
+    job->jpeg.assign(packet.jpeg_buffer, packet.jpeg_buffer + packet.jpeg_buffer_length);
+    job->done = false;
+    job->failed = false;
+
+    lock.lock();
+    queued_.push_back(job);
+    in_order_.push_back(job);
+    lock.unlock();
+    cond_.notify_one();
+}
+
+bool ParallelRgbPacketProcessor::setThreadPolicy(const ThreadPolicy &policy, std::string &error)
+{
+    bool ok = true;
+    for (size_t i = 0; i < workers_.size(); i++)
+        ok = applyThreadPolicy(workers_[i].native_handle(), policy, error) && ok;
+    return ok;
+}
+
+void ParallelRgbPacketProcessor::workerLoop()
+{
+    tjhandle decompressor = tjInitDecompress();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        while (!shutdown_ && queued_.empty())
+            cond_.wait(lock);
+        if (shutdown_)
+            break;
+
+        Job *job = queued_.front();
+        queued_.pop_front();
+        lock.unlock();
+
+        if (!job->frame && pool_)
+            job->frame = pool_->acquire();
+        if (!job->frame)
+            job->frame = new libfreenect2::Frame(RGB_WIDTH, RGB_HEIGHT, 4); // no pool, or pool exhausted
+        job->frame->sequence = job->sequence;
+        job->frame->timestamp = job->timestamp;
+
+        // same pixel format as the stock TurboJpegRgbPacketProcessor
+        int r = decompressor ? tjDecompress2(decompressor, &job->jpeg[0], job->jpeg.size(), job->frame->data,
+                                             RGB_WIDTH, RGB_WIDTH * 4, RGB_HEIGHT, TJPF_BGRX, 0) : -1;
+
+        lock.lock();
+        job->failed = (r != 0);
+        job->done = true;
+        deliverCompleted(lock);
+    }
+    lock.unlock();
+
+    if (decompressor)
+        tjDestroy(decompressor);
+}
+
+void ParallelRgbPacketProcessor::deliverCompleted(std::unique_lock<std::mutex> &lock)
+{
+    // one worker delivers at a time, so frames keep their order; the others
+    // just leave their finished jobs for it to pick up on its next round
+    if (delivering_)
+        return;
+    delivering_ = true;
+
+    while (true) {
+        // only the oldest job may be delivered, later ones wait for it
+        while (!in_order_.empty() && in_order_.front()->done) {
+            delivery_.push_back(in_order_.front());
+            in_order_.pop_front();
+        }
+        if (delivery_.empty())
+            break;
+
+        // the listener may take its time (or call ready()), never with mutex_ held
+        lock.unlock();
+        for (size_t i = 0; i < delivery_.size(); i++) {
+            Job *job = delivery_[i];
+            if (!job->failed && listener_ != 0 && listener_->onNewFrame(libfreenect2::Frame::Color, job->frame))
+                job->frame = 0; // listener owns it now
+        }
+        lock.lock();
+
+        free_jobs_.insert(free_jobs_.end(), delivery_.begin(), delivery_.end());
+        delivery_.clear();
+    }
+    delivering_ = false;
+}
+
+/************************************************************************************/
+// RgbStreamParser
+
+namespace
+{
+
+// packet layout as in libfreenect2's rgb_packet_stream_parser.cpp
+LIBFREENECT2_PACK(struct RawRgbPacket
+{
+    uint32_t sequence;
+    uint32_t magic_header; // 'BBBB'
+    unsigned char jpeg_buffer[0];
+});
+
+LIBFREENECT2_PACK(struct RgbPacketFooter
+{
+    uint32_t magic_header; // '9999'
+    uint32_t sequence;
+    uint32_t filler_length;
+    uint32_t unknown1;
+    uint32_t unknown2;
+    uint32_t timestamp;
+    float exposure;
+    float gain;
+    uint32_t magic_footer; // 'BBBB'
+    uint32_t packet_size;
+    float unknown3;
+    uint32_t unknown4[3];
+});
+
+}
+
+RgbStreamParser::RgbStreamParser(libfreenect2::BaseRgbPacketProcessor *processor) :
+    processor_(processor),
+    buffer_(2 * 1024 * 1024),
+    length_(0)
+{
+}
+
+void RgbStreamParser::onDataReceived(unsigned char *buffer, size_t length)
+{
+    capture_policy_.apply(); // a refusal is kept for captureThreadPolicyFailed()
+
+    if (length_ + length > buffer_.size()) {
+        length_ = 0; // lost sync, wait for the next frame
+        return;
+    }
+    std::memcpy(&buffer_[length_], buffer, length);
+    length_ += length;
+
+    // not enough data to do anything
+    if (length_ <= sizeof(RawRgbPacket) + sizeof(RgbPacketFooter))
+        return;
+
+    const RgbPacketFooter *footer = reinterpret_cast<const RgbPacketFooter *>(&buffer_[length_ - sizeof(RgbPacketFooter)]);
+    if (footer->magic_header != 0x39393939 || footer->magic_footer != 0x42424242)
+        return; // frame not complete yet
+
+    const RawRgbPacket *raw_packet = reinterpret_cast<const RawRgbPacket *>(&buffer_[0]);
+    size_t payload = length_ - sizeof(RawRgbPacket) - sizeof(RgbPacketFooter);
+
+    if (raw_packet->sequence == footer->sequence && payload >= footer->filler_length && processor_->ready()) {
+        libfreenect2::RgbPacket packet;
+        packet.sequence = raw_packet->sequence;
+        packet.timestamp = footer->timestamp;
+        packet.jpeg_buffer = const_cast<unsigned char *>(raw_packet->jpeg_buffer);
+        packet.jpeg_buffer_length = payload - footer->filler_length;
+        processor_->process(packet);
+    }
+
+    // reset buffer when we reach the end of a frame
+    length_ = 0;
+}
+
+} // namespace ta
@@ -0,0 +1,136 @@
+/**
+ @file
+ parallel_rgb_packet_processor - decodes colour JPEG packets on a pool of
+ TurboJPEG worker threads and delivers the frames in sequence order
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_PARALLEL_RGB_PACKET_PROCESSOR_H
+#define TA_PARALLEL_RGB_PACKET_PROCESSOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <libfreenect2.hpp>
+#include <packet_pipeline.h>
+#include <rgb_packet_processor.h>
+#include <data_callback.h>
+
+#include "frame_pool.h"
+#include "thread_policy.h"
+
+namespace ta
+{
+
+// RgbPacketProcessor that hands every packet to one of num_threads decoder
+// threads (each with its own TurboJPEG handle). Decoded frames are given to
+// the listener in the order the packets arrived, so a slow decode only adds
+// latency, not reordering. ready() returns false once every job slot is busy,
+// which makes the stream parser skip packets instead of queueing them.
+// Frames come from pool when one is given (it must outlive the processor and
+// every listener the frames are handed to).
+class ParallelRgbPacketProcessor : public libfreenect2::RgbPacketProcessor
+{
+public:
+    ParallelRgbPacketProcessor(size_t num_threads, FramePool *pool);
+    virtual ~ParallelRgbPacketProcessor();
+
+    virtual bool ready();
+    virtual void process(const libfreenect2::RgbPacket &packet);
+
+    size_t numThreads() const { return workers_.size(); }
+
+    // every decoder thread, false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error);
+
+private:
+    struct Job
+    {
+        uint32_t sequence;
+        uint32_t timestamp;
+        std::vector<unsigned char> jpeg;
+        libfreenect2::Frame *frame;
+        bool done;
+        bool failed;
+    };
+
+    void workerLoop();
+    void deliverCompleted(std::unique_lock<std::mutex> &lock); // called with mutex_ held, returns with it held
+
+    FramePool *pool_;
+    std::vector<std::thread> workers_;
+    std::vector<Job> jobs_;
+    std::vector<Job *> free_jobs_;
+    std::deque<Job *> queued_;      // waiting for a decoder
+    std::deque<Job *> in_order_;    // every accepted job, in arrival order
+    std::vector<Job *> delivery_;   // taken off in_order_, being handed to the listener
+    bool delivering_;               // a worker is handing frames to the listener, outside mutex_
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool shutdown_;
+};
+
+// Parses the raw colour USB stream into RgbPackets, replacing the stock
+// RgbPacketStreamParser (which is not part of the public headers).
+class RgbStreamParser : public libfreenect2::DataCallback
+{
+public:
+    explicit RgbStreamParser(libfreenect2::BaseRgbPacketProcessor *processor);
+    virtual ~RgbStreamParser() {}
+    virtual void onDataReceived(unsigned char *buffer, size_t length);
+
+    // applied by the first onDataReceived(), on libfreenect2's USB thread
+    void setCaptureThreadPolicy(const ThreadPolicy &policy) { capture_policy_.set(policy); }
+
+    // true once, with why, after that thread refused the capture policy
+    bool captureThreadPolicyFailed(std::string &error) { return capture_policy_.failed(error); }
+
+private:
+    libfreenect2::BaseRgbPacketProcessor *processor_;
+    DeferredThreadPolicy capture_policy_;
+    std::vector<unsigned char> buffer_;
+    size_t length_;
+};
+
+// A libfreenect2 BasePacketPipeline (CpuPacketPipeline, OpenCLPacketPipeline,
+// ParallelCpuPacketPipeline, constructed from args) whose colour goes through
+// RgbStreamParser and ParallelRgbPacketProcessor; depth/IR are the pipeline's
+// own. This libfreenect2 has no createRgbPacketProcessor() to override:
+// BasePacketPipeline::initialize() always builds the TurboJPEG processor and
+// its thread, so they are torn down again here, before the device ever sees
+// the pipeline, and only the parallel decoder is left. The stock colour
+// parser stays, unused (getRgbPacketParser() is ours). pool is not owned.
+template <class Pipeline>
+class ParallelRgbPacketPipeline : public Pipeline
+{
+public:
+    template <typename... Args>
+    ParallelRgbPacketPipeline(size_t num_threads, FramePool *pool, Args... args) :
+        Pipeline(args...)
+    {
+        delete this->async_rgb_processor_; // joins the stock decoder thread
+        delete this->rgb_processor_;
+        this->async_rgb_processor_ = 0;
+        this->rgb_processor_ = new ParallelRgbPacketProcessor(num_threads, pool); // ~BasePacketPipeline deletes it
+        stream_parser_ = new RgbStreamParser(this->rgb_processor_);
+    }
+
+    virtual ~ParallelRgbPacketPipeline()
+    {
+        delete stream_parser_; // before the processor it feeds
+    }
+
+    virtual libfreenect2::PacketPipeline::PacketParser *getRgbPacketParser() const { return stream_parser_; }
+
+private:
+    RgbStreamParser *stream_parser_;
+};
+
+} // namespace ta
+
+#endif // TA_PARALLEL_RGB_PACKET_PROCESSOR_H
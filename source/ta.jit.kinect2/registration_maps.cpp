@@ -0,0 +1,140 @@
+/**
+ @file
+ registration_maps - the per-pixel maps of libfreenect2::Registration
+ (undistortion and depth to colour), built once per device
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "registration_maps.h"
+
+#include <cstdlib>
+
+// as in libfreenect2's registration.cpp
+#define depth_q 0.01
+#define color_q 0.002199
+
+// matrix dimensions
+#define DEPTH_WIDTH 512
+#define DEPTH_HEIGHT 424
+
+namespace ta
+{
+
+RegistrationMaps::RegistrationMaps(const libfreenect2::Freenect2Device::IrCameraParams &depth,
+                                   const libfreenect2::Freenect2Device::ColorCameraParams &color,
+                                   CalibrationCache *cache) :
+    depth_(depth),
+    color_(color),
+    storage_(0)
+{
+    const size_t plane = DEPTH_WIDTH * DEPTH_HEIGHT * 4;
+    const size_t bytes = plane * 4;
+
+    uint64_t key = 0;
+    const unsigned char *maps = 0;
+    if (cache) {
+        key = CalibrationCache::hash(&depth_, sizeof(depth_));
+        key = CalibrationCache::hash(&color_, sizeof(color_), key);
+        maps = (const unsigned char *)cache->find(CalibrationCache::RegistrationMaps, key, bytes);
+    }
+
+    if (!maps) {
+        storage_ = (unsigned char *)std::malloc(bytes);
+        maps = storage_;
+    }
+    distort_map_ = (int *)(maps);
+    map_x_ = (float *)(maps + plane);
+    map_y_ = (float *)(maps + 2 * plane);
+    map_yi_ = (int *)(maps + 3 * plane);
+
+    if (storage_) {
+        build();
+        if (cache)
+            cache->store(CalibrationCache::RegistrationMaps, key, storage_, bytes);
+    }
+
+    for (int y = 0; y < DEPTH_HEIGHT; y++) {
+        const int *yi = map_yi_ + y * DEPTH_WIDTH;
+        row_min_yi_[y] = row_max_yi_[y] = yi[0];
+        for (int x = 1; x < DEPTH_WIDTH; x++) {
+            if (yi[x] < row_min_yi_[y]) row_min_yi_[y] = yi[x];
+            if (yi[x] > row_max_yi_[y]) row_max_yi_[y] = yi[x];
+        }
+    }
+}
+
+RegistrationMaps::~RegistrationMaps()
+{
+    std::free(storage_);
+}
+
+void RegistrationMaps::distort(int mx, int my, float &x, float &y) const
+{
+    // see http://en.wikipedia.org/wiki/Distortion_(optics) for description
+    float dx = ((float)mx - depth_.cx) / depth_.fx;
+    float dy = ((float)my - depth_.cy) / depth_.fy;
+    float dx2 = dx * dx;
+    float dy2 = dy * dy;
+    float r2 = dx2 + dy2;
+    float dxdy2 = 2 * dx * dy;
+    float kr = 1 + ((depth_.k3 * r2 + depth_.k2) * r2 + depth_.k1) * r2;
+    x = depth_.fx * (dx * kr + depth_.p2 * (r2 + 2 * dx2) + depth_.p1 * dxdy2) + depth_.cx;
+    y = depth_.fy * (dy * kr + depth_.p1 * (r2 + 2 * dy2) + depth_.p2 * dxdy2) + depth_.cy;
+}
+
+void RegistrationMaps::depthToColor(float mx, float my, float &rx, float &ry) const
+{
+    mx = (mx - depth_.cx) * depth_q;
+    my = (my - depth_.cy) * depth_q;
+
+    float wx =
+        (mx * mx * mx * color_.mx_x3y0) + (my * my * my * color_.mx_x0y3) +
+        (mx * mx * my * color_.mx_x2y1) + (my * my * mx * color_.mx_x1y2) +
+        (mx * mx * color_.mx_x2y0) + (my * my * color_.mx_x0y2) + (mx * my * color_.mx_x1y1) +
+        (mx * color_.mx_x1y0) + (my * color_.mx_x0y1) + (color_.mx_x0y0);
+
+    float wy =
+        (mx * mx * mx * color_.my_x3y0) + (my * my * my * color_.my_x0y3) +
+        (mx * mx * my * color_.my_x2y1) + (my * my * mx * color_.my_x1y2) +
+        (mx * mx * color_.my_x2y0) + (my * my * color_.my_x0y2) + (mx * my * color_.my_x1y1) +
+        (mx * color_.my_x1y0) + (my * color_.my_x0y1) + (color_.my_x0y0);
+
+    rx = (wx / (color_.fx * color_q)) - (color_.shift_m / color_.shift_d);
+    ry = (wy / color_q) + color_.cy;
+}
+
+void RegistrationMaps::build()
+{
+    float mx, my;
+    int ix, iy, index;
+    float rx, ry;
+    int *map_dist = distort_map_;
+    float *map_x = map_x_;
+    float *map_y = map_y_;
+    int *map_yi = map_yi_;
+
+    for (int y = 0; y < DEPTH_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_WIDTH; x++) {
+            // compute the distorted coordinate for current pixel
+            distort(x, y, mx, my);
+            // rounding the values and check if the pixel is inside the image
+            ix = (int)(mx + 0.5f);
+            iy = (int)(my + 0.5f);
+            if (ix < 0 || ix >= DEPTH_WIDTH || iy < 0 || iy >= DEPTH_HEIGHT)
+                index = -1;
+            else
+                index = iy * DEPTH_WIDTH + ix;
+            *map_dist++ = index;
+
+            // compute the depth to color mapping entries for the current pixel
+            depthToColor(x, y, rx, ry);
+            *map_x++ = rx;
+            *map_y++ = ry;
+            // compute the y offset to minimize later computations
+            *map_yi++ = (int)(ry + 0.5f);
+        }
+    }
+}
+
+} // namespace ta
@@ -0,0 +1,69 @@
+/**
+ @file
+ registration_maps - the per-pixel maps of libfreenect2::Registration
+ (undistortion and depth to colour), built once per device
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_REGISTRATION_MAPS_H
+#define TA_REGISTRATION_MAPS_H
+
+#include <libfreenect2.hpp>
+
+#include "calibration_cache.h"
+
+namespace ta
+{
+
+// Same maps and the same arithmetic as libfreenect2::Registration, which keeps
+// them private. Every map is indexed by the undistorted 512x424 depth pixel:
+// distortMap() is the raw depth pixel it is read from (-1 = outside), mapX()/
+// mapY() are the depth_to_color terms and mapYi() the rounded colour row.
+// With a cache the maps are read straight from its mapping when the camera
+// parameters match, otherwise built and stored in it.
+class RegistrationMaps
+{
+public:
+    RegistrationMaps(const libfreenect2::Freenect2Device::IrCameraParams &depth,
+                     const libfreenect2::Freenect2Device::ColorCameraParams &color,
+                     CalibrationCache *cache);
+    ~RegistrationMaps();
+
+    const libfreenect2::Freenect2Device::IrCameraParams &depth() const { return depth_; }
+    const libfreenect2::Freenect2Device::ColorCameraParams &color() const { return color_; }
+
+    const int *distortMap() const { return distort_map_; }
+    const float *mapX() const { return map_x_; }
+    const float *mapY() const { return map_y_; }
+    const int *mapYi() const { return map_yi_; }
+
+    // lowest / highest mapYi() of a depth row, to find the rows a colour band depends on
+    int rowMinYi(int row) const { return row_min_yi_[row]; }
+    int rowMaxYi(int row) const { return row_max_yi_[row]; }
+
+    bool fromCache() const { return storage_ == 0; }
+
+private:
+    RegistrationMaps(const RegistrationMaps &);
+    RegistrationMaps &operator=(const RegistrationMaps &);
+
+    void build();
+    void distort(int mx, int my, float &x, float &y) const;
+    void depthToColor(float mx, float my, float &rx, float &ry) const;
+
+    libfreenect2::Freenect2Device::IrCameraParams depth_;
+    libfreenect2::Freenect2Device::ColorCameraParams color_;
+
+    unsigned char *storage_; // 0 when the maps point into the cache
+    int *distort_map_;
+    float *map_x_;
+    float *map_y_;
+    int *map_yi_;
+    int row_min_yi_[424];
+    int row_max_yi_[424];
+};
+
+} // namespace ta
+
+#endif // TA_REGISTRATION_MAPS_H
@@ -0,0 +1,86 @@
+/**
+ @file
+ ring_logger - libfreenect2 logger that never blocks the USB/processing threads
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "ring_logger.h"
+
+#include <cstring>
+
+namespace ta
+{
+
+RingLogger::RingLogger(Level level) :
+    enqueue_pos_(0),
+    dequeue_pos_(0),
+    current_level_(level),
+    dropped_(0)
+{
+    level_ = level;
+    for (size_t i = 0; i < Capacity; i++)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+RingLogger::~RingLogger()
+{
+}
+
+libfreenect2::Logger::Level RingLogger::level() const
+{
+    return (Level)current_level_.load(std::memory_order_relaxed);
+}
+
+void RingLogger::setLevel(Level level)
+{
+    current_level_.store(level, std::memory_order_relaxed);
+}
+
+void RingLogger::log(Level level, const std::string &message)
+{
+    if (level > this->level())
+        return;
+
+    // bounded MPMC queue (D. Vyukov): each cell's sequence says whose turn it is
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells_[pos & (Capacity - 1)];
+        size_t seq = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed); // full
+            return;
+        }
+        else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+
+    size_t length = message.size() < MessageSize - 1 ? message.size() : MessageSize - 1;
+    std::memcpy(cell->text, message.data(), length);
+    cell->text[length] = 0;
+    cell->level = level;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+bool RingLogger::pop(Level &level, char *text)
+{
+    Cell *cell = &cells_[dequeue_pos_ & (Capacity - 1)];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    if ((intptr_t)seq - (intptr_t)(dequeue_pos_ + 1) < 0)
+        return false; // empty
+
+    level = cell->level;
+    std::memcpy(text, cell->text, MessageSize);
+    cell->sequence.store(dequeue_pos_ + Capacity, std::memory_order_release);
+    dequeue_pos_++;
+    return true;
+}
+
+} // namespace ta
@@ -0,0 +1,72 @@
+/**
+ @file
+ ring_logger - libfreenect2 logger that never blocks the USB/processing threads
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_RING_LOGGER_H
+#define TA_RING_LOGGER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+#include <logger.h>
+
+namespace ta
+{
+
+// libfreenect2::Logger that only copies each message into a bounded lock-free
+// ring (many producers, one consumer). Whoever owns the ring drains it from a
+// thread where blocking is fine, e.g. the Max main thread. Messages that do not
+// fit are dropped and counted, logging never waits.
+class RingLogger : public libfreenect2::Logger
+{
+public:
+    enum
+    {
+        Capacity = 256,   // messages, power of two
+        MessageSize = 256 // bytes per message, longer ones are truncated
+    };
+
+    explicit RingLogger(Level level);
+    virtual ~RingLogger();
+
+    virtual Level level() const;
+    void setLevel(Level level);
+
+    virtual void log(Level level, const std::string &message);
+
+    // single consumer: copies the oldest message into text (MessageSize bytes)
+    bool pop(Level &level, char *text);
+
+    unsigned long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        Level level;
+        char text[MessageSize];
+    };
+
+    Cell cells_[Capacity];
+    std::atomic<size_t> enqueue_pos_;
+    size_t dequeue_pos_;
+    std::atomic<int> current_level_;
+    std::atomic<unsigned long> dropped_;
+};
+
+// through libfreenect2's global logger (which the external points at a
+// RingLogger), if there is one and it takes level
+inline void logMessage(libfreenect2::Logger::Level level, const std::string &message)
+{
+    libfreenect2::Logger *logger = libfreenect2::getGlobalLogger();
+    if (logger && logger->level() >= level)
+        logger->log(level, message);
+}
+
+} // namespace ta
+
+#endif // TA_RING_LOGGER_H
@@ -0,0 +1,104 @@
+/**
+ @file
+ row_pool - persistent worker threads that run one job over the rows of an
+ image, one band of rows per thread
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "row_pool.h"
+
+namespace ta
+{
+
+RowPool::RowPool(size_t num_threads) :
+    job_(0),
+    rows_(0),
+    generation_(0),
+    pending_(0),
+    shutdown_(false)
+{
+    if (num_threads < 1)
+        num_threads = defaultThreads();
+    for (size_t i = 1; i < num_threads; i++)
+        workers_.push_back(std::thread(&RowPool::workerLoop, this, i));
+}
+
+RowPool::~RowPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        shutdown_ = true;
+    }
+    start_cond_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i].join();
+}
+
+size_t RowPool::defaultThreads()
+{
+    size_t threads = std::thread::hardware_concurrency();
+    return threads > 1 ? threads - 1 : 1; // leave a core for USB and colour
+}
+
+bool RowPool::setThreadPolicy(const ThreadPolicy &policy, std::string &error)
+{
+    bool ok = true;
+    for (size_t i = 0; i < workers_.size(); i++)
+        ok = applyThreadPolicy(workers_[i].native_handle(), policy, error) && ok;
+    return ok;
+}
+
+void RowPool::band(size_t index, int &first, int &end) const
+{
+    size_t n = numThreads();
+    first = (int)(rows_ * index / n);
+    end = (int)(rows_ * (index + 1) / n);
+}
+
+void RowPool::run(const std::function<void(int, int)> &job, int rows)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &job;
+        rows_ = rows;
+        pending_ = workers_.size();
+        generation_++;
+    }
+    start_cond_.notify_all();
+
+    int first, end;
+    band(0, first, end);
+    job(first, end);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (pending_ > 0)
+        done_cond_.wait(lock);
+    job_ = 0;
+}
+
+void RowPool::workerLoop(size_t index)
+{
+    unsigned long seen = 0;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        while (!shutdown_ && generation_ == seen)
+            start_cond_.wait(lock);
+        if (shutdown_)
+            break;
+        seen = generation_;
+        const std::function<void(int, int)> *job = job_;
+        int first, end;
+        band(index, first, end);
+        lock.unlock();
+
+        (*job)(first, end);
+
+        lock.lock();
+        if (--pending_ == 0)
+            done_cond_.notify_one();
+    }
+}
+
+} // namespace ta
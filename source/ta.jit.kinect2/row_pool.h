@@ -0,0 +1,62 @@
+/**
+ @file
+ row_pool - persistent worker threads that run one job over the rows of an
+ image, one band of rows per thread
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_ROW_POOL_H
+#define TA_ROW_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_policy.h"
+
+namespace ta
+{
+
+// Runs a job over rows [0, rows), split into one band per thread (the
+// calling thread takes the first band) and returns when every band is done.
+// Only one thread may call run() at a time.
+class RowPool
+{
+public:
+    explicit RowPool(size_t num_threads);
+    ~RowPool();
+
+    void run(const std::function<void(int, int)> &job, int rows = 424); // job(first_row, end_row)
+
+    size_t numThreads() const { return workers_.size() + 1; }
+
+    // every worker thread (not the one calling run()), false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error);
+
+    // one per core but one, for num_threads 0
+    static size_t defaultThreads();
+
+private:
+    RowPool(const RowPool &);
+    RowPool &operator=(const RowPool &);
+
+    void workerLoop(size_t band);
+    void band(size_t index, int &first, int &end) const;
+
+    std::vector<std::thread> workers_;
+    const std::function<void(int, int)> *job_;
+    int rows_;
+    unsigned long generation_;
+    size_t pending_;
+    bool shutdown_;
+    std::mutex mutex_;
+    std::condition_variable start_cond_;
+    std::condition_variable done_cond_;
+};
+
+} // namespace ta
+
+#endif // TA_ROW_POOL_H
@@ -0,0 +1,28 @@
+/**
+ @file
+ share_frame_listener - publishes every frame the device delivers into a
+ shared-memory ring before passing it on
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "share_frame_listener.h"
+
+namespace ta
+{
+
+ShareFrameListener::ShareFrameListener(SharedFrameRingWriter *ring, libfreenect2::FrameListener *next) :
+    ring_(ring),
+    next_(next)
+{
+}
+
+bool ShareFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    int stream = type == libfreenect2::Frame::Color ? SharedColor : type == libfreenect2::Frame::Ir ? SharedIr : SharedDepth;
+    ring_->publish(stream, frame->data, (uint32_t)frame->width, (uint32_t)frame->height, (uint32_t)frame->bytes_per_pixel,
+                   frame->sequence, frame->timestamp);
+    return next_->onNewFrame(type, frame);
+}
+
+} // namespace ta
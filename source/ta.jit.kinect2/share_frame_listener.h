@@ -0,0 +1,36 @@
+/**
+ @file
+ share_frame_listener - publishes every frame the device delivers into a
+ shared-memory ring before passing it on
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_SHARE_FRAME_LISTENER_H
+#define TA_SHARE_FRAME_LISTENER_H
+
+#include <frame_listener.hpp>
+
+#include "shared_frame_ring.h"
+
+namespace ta
+{
+
+// Outermost listener of the device while sharing is on: colour, IR and depth
+// are copied into the ring on the thread that produced them (decoder / depth
+// processor), then go on to the session's listeners untouched.
+class ShareFrameListener : public libfreenect2::FrameListener
+{
+public:
+    ShareFrameListener(SharedFrameRingWriter *ring, libfreenect2::FrameListener *next);
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+private:
+    SharedFrameRingWriter *ring_;
+    libfreenect2::FrameListener *next_;
+};
+
+} // namespace ta
+
+#endif // TA_SHARE_FRAME_LISTENER_H
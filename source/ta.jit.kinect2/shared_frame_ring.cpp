@@ -0,0 +1,271 @@
+/**
+ @file
+ shared_frame_ring - named POSIX shared-memory ring the capture threads publish
+ colour/IR/depth frames into, and other local processes read without copies
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "shared_frame_ring.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// matrix dimensions
+#define RGB_WIDTH 1920
+#define RGB_HEIGHT 1080
+#define DEPTH_WIDTH 512
+#define DEPTH_HEIGHT 424
+
+#define TA_SHARED_RING_MAGIC 0x534b4154 // 'TAKS'
+#define TA_SHARED_RING_VERSION 1
+#define TA_SHARED_RING_ALIGN 64
+
+namespace ta
+{
+
+namespace
+{
+
+uint64_t alignUp(uint64_t offset)
+{
+    return (offset + TA_SHARED_RING_ALIGN - 1) & ~(uint64_t)(TA_SHARED_RING_ALIGN - 1);
+}
+
+uint64_t streamCapacity(int stream)
+{
+    if (stream == SharedColor)
+        return (uint64_t)RGB_WIDTH * RGB_HEIGHT * 4;
+    return (uint64_t)DEPTH_WIDTH * DEPTH_HEIGHT * sizeof(float);
+}
+
+SharedSlotHeader *slotAt(const SharedRingHeader *header, int stream, uint64_t number)
+{
+    const SharedStreamHeader &s = header->streams[stream];
+    return (SharedSlotHeader *)((unsigned char *)header + s.first_slot + (number % header->slots) * s.slot_stride);
+}
+
+}
+
+std::string sharedRingName(const std::string &serial)
+{
+    std::string name("/tak2_");
+    for (size_t i = 0; i < serial.size() && name.size() < 31; i++) {
+        char c = serial[i];
+        bool ok = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        name += ok ? c : '_';
+    }
+    return name;
+}
+
+/************************************************************************************/
+// writer
+
+SharedFrameRingWriter::SharedFrameRingWriter(const std::string &serial, unsigned int slots) :
+    name_(sharedRingName(serial)),
+    header_(0),
+    size_(0)
+{
+    for (int i = 0; i < SharedStreams; i++)
+        published_[i] = 0;
+    if (slots < 2)
+        slots = 2; // a reader needs the previous frame to stay put while the next one is written
+
+    // header, then per stream: slots x (slot header + data)
+    uint64_t offset = alignUp(sizeof(SharedRingHeader));
+    uint64_t first_slot[SharedStreams], slot_stride[SharedStreams];
+    for (int i = 0; i < SharedStreams; i++) {
+        first_slot[i] = offset;
+        slot_stride[i] = alignUp(sizeof(SharedSlotHeader)) + alignUp(streamCapacity(i));
+        offset += slots * slot_stride[i];
+    }
+
+    // a name left behind by a writer that crashed: readers still mapping it keep their copy
+    shm_unlink(name_.c_str());
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        error_ = std::string("shm_open failed: ") + strerror(errno);
+        return;
+    }
+    if (ftruncate(fd, (off_t)offset) != 0) {
+        error_ = std::string("ftruncate failed: ") + strerror(errno);
+        ::close(fd);
+        shm_unlink(name_.c_str());
+        return;
+    }
+    void *mapping = mmap(0, (size_t)offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        error_ = std::string("mmap failed: ") + strerror(errno);
+        shm_unlink(name_.c_str());
+        return;
+    }
+
+    // the segment starts zeroed, which is a valid state for every counter
+    header_ = (SharedRingHeader *)mapping;
+    size_ = (size_t)offset;
+    header_->version = TA_SHARED_RING_VERSION;
+    header_->size = offset;
+    header_->slots = slots;
+    header_->writer_pid = (int32_t)getpid();
+    for (int i = 0; i < SharedStreams; i++) {
+        header_->streams[i].first_slot = first_slot[i];
+        header_->streams[i].slot_stride = slot_stride[i];
+        header_->streams[i].capacity = streamCapacity(i);
+    }
+    header_->alive.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = TA_SHARED_RING_MAGIC; // readers check it last
+}
+
+SharedFrameRingWriter::~SharedFrameRingWriter()
+{
+    if (!header_)
+        return;
+    header_->alive.store(0, std::memory_order_release);
+    shm_unlink(name_.c_str());
+    munmap(header_, size_);
+}
+
+void SharedFrameRingWriter::publish(int stream, const void *data, uint32_t width, uint32_t height, uint32_t bytes_per_pixel,
+                                    uint32_t sequence, uint32_t timestamp)
+{
+    if (!header_ || stream < 0 || stream >= SharedStreams)
+        return;
+    size_t size = (size_t)width * height * bytes_per_pixel;
+    if (size > header_->streams[stream].capacity)
+        return;
+
+    uint64_t number = published_[stream] + 1;
+    SharedSlotHeader *slot = slotAt(header_, stream, number);
+
+    // seqlock write: odd, data, even
+    uint32_t lock = slot->lock.load(std::memory_order_relaxed);
+    slot->lock.store(lock + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->sequence = sequence;
+    slot->timestamp = timestamp;
+    slot->width = width;
+    slot->height = height;
+    slot->bytes_per_pixel = bytes_per_pixel;
+    slot->number = number;
+    std::memcpy((unsigned char *)slot + alignUp(sizeof(SharedSlotHeader)), data, size);
+
+    slot->lock.store(lock + 2, std::memory_order_release);
+    header_->streams[stream].latest.store(number, std::memory_order_release);
+    published_[stream] = number;
+}
+
+/************************************************************************************/
+// reader
+
+SharedFrameRingReader::SharedFrameRingReader() :
+    header_(0),
+    size_(0)
+{
+}
+
+SharedFrameRingReader::~SharedFrameRingReader()
+{
+    close();
+}
+
+bool SharedFrameRingReader::open(const std::string &serial)
+{
+    close();
+
+    int fd = shm_open(sharedRingName(serial).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SharedRingHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void *mapping = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    const SharedRingHeader *header = (const SharedRingHeader *)mapping;
+    bool ok = header->magic == TA_SHARED_RING_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    ok = ok && header->version == TA_SHARED_RING_VERSION && header->size == (uint64_t)st.st_size && header->slots >= 2;
+    for (int i = 0; ok && i < SharedStreams; i++) {
+        const SharedStreamHeader &s = header->streams[i];
+        ok = s.first_slot + header->slots * s.slot_stride <= header->size
+             && s.slot_stride >= alignUp(sizeof(SharedSlotHeader)) + s.capacity;
+    }
+    if (!ok) {
+        munmap(mapping, (size_t)st.st_size); // being created right now, or another version
+        return false;
+    }
+
+    header_ = header;
+    size_ = (size_t)st.st_size;
+    return true;
+}
+
+void SharedFrameRingReader::close()
+{
+    if (header_)
+        munmap((void *)header_, size_);
+    header_ = 0;
+    size_ = 0;
+}
+
+bool SharedFrameRingReader::alive() const
+{
+    return header_ && header_->alive.load(std::memory_order_acquire) != 0;
+}
+
+uint64_t SharedFrameRingReader::latest(int stream) const
+{
+    if (!header_ || stream < 0 || stream >= SharedStreams)
+        return 0;
+    return header_->streams[stream].latest.load(std::memory_order_acquire);
+}
+
+bool SharedFrameRingReader::acquire(int stream, SharedFrameView &view) const
+{
+    // a couple of tries: the writer may lap a slow reader between reading latest and the slot
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint64_t number = latest(stream);
+        if (number == 0)
+            return false;
+
+        const SharedSlotHeader *slot = slotAt(header_, stream, number);
+        uint32_t lock = slot->lock.load(std::memory_order_acquire);
+        if (lock & 1)
+            continue;
+
+        view.stream = stream;
+        view.number = slot->number;
+        view.sequence = slot->sequence;
+        view.timestamp = slot->timestamp;
+        view.width = slot->width;
+        view.height = slot->height;
+        view.bytes_per_pixel = slot->bytes_per_pixel;
+        view.data = (const unsigned char *)slot + alignUp(sizeof(SharedSlotHeader));
+        view.slot = slot;
+        view.lock = lock;
+
+        if (view.number == number && valid(view))
+            return true;
+    }
+    return false;
+}
+
+bool SharedFrameRingReader::valid(const SharedFrameView &view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot && view.slot->lock.load(std::memory_order_relaxed) == view.lock;
+}
+
+} // namespace ta
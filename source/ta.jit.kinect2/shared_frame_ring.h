@@ -0,0 +1,159 @@
+/**
+ @file
+ shared_frame_ring - named POSIX shared-memory ring the capture threads publish
+ colour/IR/depth frames into, and other local processes read without copies
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_SHARED_FRAME_RING_H
+#define TA_SHARED_FRAME_RING_H
+
+// This header (with shared_frame_ring.cpp) is all a client process needs: no
+// Max, no libfreenect2, just POSIX shm_open/mmap (link -lrt on older Linux).
+//
+//     ta::SharedFrameRingReader ring;
+//     if (ring.open("012345678912")) {            // serial of the device
+//         ta::SharedFrameView view;
+//         if (ring.acquire(ta::SharedDepth, view)) {
+//             use((const float *)view.data, view.width, view.height);
+//             if (!ring.valid(view)) { /* overwritten while reading, drop what was computed */ }
+//         }
+//     }
+
+#include <atomic>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace ta
+{
+
+enum SharedStream
+{
+    SharedColor = 0, // 1920 x 1080, 4 bytes per pixel (BGRX, as libfreenect2 decodes it)
+    SharedIr,        // 512 x 424 float
+    SharedDepth,     // 512 x 424 float, mm
+    SharedStreams
+};
+
+// Layout of the segment: the header, then for every stream its slots, each
+// a SharedSlotHeader followed by the pixel data, everything 64 byte aligned.
+// Each slot is a seqlock: the writer makes the counter odd, writes, makes it
+// even again. A reader that saw the same even counter before and after using
+// the data read a whole frame; otherwise the writer lapped it.
+struct SharedSlotHeader
+{
+    std::atomic<uint32_t> lock;  // seqlock counter, odd while being written
+    uint32_t sequence;           // device frame sequence
+    uint32_t timestamp;          // device timestamp (0.1 ms ticks)
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_pixel;
+    uint64_t number;             // publication number within the stream, 1 based
+    unsigned char reserved[32];
+};
+
+struct SharedStreamHeader
+{
+    std::atomic<uint64_t> latest; // publication number of the newest complete frame, 0 = none yet
+    uint64_t first_slot;          // offset of slot 0 from the start of the segment
+    uint64_t slot_stride;         // bytes from one slot header to the next
+    uint64_t capacity;            // bytes of pixel data a slot holds
+};
+
+struct SharedRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;                // of the whole segment
+    uint32_t slots;               // per stream
+    int32_t writer_pid;
+    std::atomic<uint32_t> alive;  // cleared when the writer closes the ring (device closed or reconnecting)
+    uint32_t reserved[9];
+    SharedStreamHeader streams[SharedStreams];
+};
+
+// one frame as seen by a reader: data points into the shared segment
+struct SharedFrameView
+{
+    int stream;
+    uint64_t number;
+    uint32_t sequence;
+    uint32_t timestamp;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes_per_pixel;
+    const unsigned char *data;
+
+    const SharedSlotHeader *slot; // for valid()
+    uint32_t lock;
+};
+
+// "/tak2_<serial>", short enough for the 31 character limit on the Mac
+std::string sharedRingName(const std::string &serial);
+
+// Owned by the session while a device is open with sharing on. One writer per
+// stream (libfreenect2 delivers each stream from one thread at a time), so
+// publish() never blocks and never waits for readers.
+class SharedFrameRingWriter
+{
+public:
+    SharedFrameRingWriter(const std::string &serial, unsigned int slots);
+    ~SharedFrameRingWriter(); // marks the ring dead and unlinks the name, mapped readers keep their memory
+
+    bool ok() const { return header_ != 0; }
+    const std::string &name() const { return name_; }
+    const std::string &error() const { return error_; }
+
+    // copies the frame into the next slot of its stream, frames larger than a slot are dropped
+    void publish(int stream, const void *data, uint32_t width, uint32_t height, uint32_t bytes_per_pixel,
+                 uint32_t sequence, uint32_t timestamp);
+
+private:
+    SharedFrameRingWriter(const SharedFrameRingWriter &);
+    SharedFrameRingWriter &operator=(const SharedFrameRingWriter &);
+
+    std::string name_;
+    std::string error_;
+    SharedRingHeader *header_;
+    size_t size_;
+    uint64_t published_[SharedStreams];
+};
+
+// Client side, for any local process. Nothing is copied and no system call is
+// made per frame: acquire() and valid() only read the mapping.
+class SharedFrameRingReader
+{
+public:
+    SharedFrameRingReader();
+    ~SharedFrameRingReader();
+
+    bool open(const std::string &serial);
+    void close();
+
+    bool isOpen() const { return header_ != 0; }
+
+    // false once the writer closed the ring: close() and open() again to follow a reopened device
+    bool alive() const;
+
+    // publication number of the newest frame of stream, 0 if none (cheap way to poll for new frames)
+    uint64_t latest(int stream) const;
+
+    // the newest frame of stream, false if there is none yet
+    bool acquire(int stream, SharedFrameView &view) const;
+
+    // true if the frame was not overwritten since acquire(), check after using the data
+    bool valid(const SharedFrameView &view) const;
+
+private:
+    SharedFrameRingReader(const SharedFrameRingReader &);
+    SharedFrameRingReader &operator=(const SharedFrameRingReader &);
+
+    const SharedRingHeader *header_;
+    size_t size_;
+};
+
+} // namespace ta
+
+#endif // TA_SHARED_FRAME_RING_H
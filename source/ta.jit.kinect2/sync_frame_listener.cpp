@@ -0,0 +1,112 @@
+/**
+ @file
+ sync_frame_listener - colour+depth pairing listener that recycles pooled frames
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "sync_frame_listener.h"
+#include "frame_pool.h"
+
+#include <chrono>
+
+namespace ta
+{
+
+static const libfreenect2::Frame::Type s_types[3] = {
+    libfreenect2::Frame::Color, libfreenect2::Frame::Ir, libfreenect2::Frame::Depth
+};
+
+SyncFrameListener::SyncFrameListener(unsigned int frame_types) :
+    frame_types_(frame_types),
+    ready_types_(0)
+{
+    for (int i = 0; i < 3; i++)
+        next_[i] = 0;
+}
+
+SyncFrameListener::~SyncFrameListener()
+{
+    for (int i = 0; i < 3; i++)
+        FramePool::recycle(next_[i]);
+}
+
+int SyncFrameListener::slot(libfreenect2::Frame::Type type)
+{
+    switch (type) {
+        case libfreenect2::Frame::Color:
+            return 0;
+        case libfreenect2::Frame::Ir:
+            return 1;
+        default:
+            return 2;
+    }
+}
+
+bool SyncFrameListener::hasNewFrame() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return ready_types_ == frame_types_;
+}
+
+bool SyncFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    if (!(frame_types_ & type))
+        return false;
+
+    libfreenect2::Frame *stale;
+    bool complete;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int i = slot(type);
+        stale = next_[i];
+        next_[i] = frame;
+        ready_types_ |= type;
+        complete = (ready_types_ == frame_types_);
+    }
+    FramePool::recycle(stale);
+    if (complete)
+        cond_.notify_one();
+    return true;
+}
+
+void SyncFrameListener::takeFrames(libfreenect2::FrameMap &frames)
+{
+    for (int i = 0; i < 3; i++) {
+        if (frame_types_ & s_types[i]) {
+            frames[s_types[i]] = next_[i];
+            next_[i] = 0;
+        }
+    }
+    ready_types_ = 0;
+}
+
+bool SyncFrameListener::waitForNewFrame(libfreenect2::FrameMap &frames, int milliseconds)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    while (ready_types_ != frame_types_) {
+        if (cond_.wait_until(lock, deadline) == std::cv_status::timeout && ready_types_ != frame_types_)
+            return false;
+    }
+    takeFrames(frames);
+    return true;
+}
+
+void SyncFrameListener::waitForNewFrame(libfreenect2::FrameMap &frames)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (ready_types_ != frame_types_)
+        cond_.wait(lock);
+    takeFrames(frames);
+}
+
+void SyncFrameListener::release(libfreenect2::FrameMap &frames)
+{
+    for (libfreenect2::FrameMap::iterator it = frames.begin(); it != frames.end(); ++it) {
+        FramePool::recycle(it->second);
+        it->second = 0;
+    }
+}
+
+} // namespace ta
@@ -0,0 +1,52 @@
+/**
+ @file
+ sync_frame_listener - colour+depth pairing listener that recycles pooled frames
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_SYNC_FRAME_LISTENER_H
+#define TA_SYNC_FRAME_LISTENER_H
+
+#include <condition_variable>
+#include <mutex>
+
+#include <frame_listener_impl.h>
+
+namespace ta
+{
+
+// Drop-in replacement for libfreenect2::SyncMultiFrameListener (sync 1).
+// The stock listener deletes frames on release, which must not happen to
+// PooledFrames; this one hands them to FramePool::recycle() instead, and
+// reuses the caller's FrameMap nodes so waiting allocates nothing.
+class SyncFrameListener : public libfreenect2::FrameListener
+{
+public:
+    explicit SyncFrameListener(unsigned int frame_types);
+    virtual ~SyncFrameListener();
+
+    bool hasNewFrame() const;
+
+    // false on timeout
+    bool waitForNewFrame(libfreenect2::FrameMap &frames, int milliseconds);
+    void waitForNewFrame(libfreenect2::FrameMap &frames);
+
+    void release(libfreenect2::FrameMap &frames);
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+private:
+    static int slot(libfreenect2::Frame::Type type);
+    void takeFrames(libfreenect2::FrameMap &frames); // called with mutex_ held
+
+    unsigned int frame_types_;
+    unsigned int ready_types_;
+    libfreenect2::Frame *next_[3];
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+} // namespace ta
+
+#endif // TA_SYNC_FRAME_LISTENER_H
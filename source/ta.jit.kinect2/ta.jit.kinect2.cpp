@@ -10,6 +10,7 @@
  */
 
 #include "jit.common.h"
+#include "ext.h"
 
 // Libfreenect2 includes
 #include <iostream>
@@ -18,26 +19,138 @@
 #include <frame_listener_impl.h>
 #include <registration.h>
 #include <packet_pipeline.h>
-//#include <logger.h>
+#include <logger.h>
+#include "kinect2_session.h"
+#include "ring_logger.h"
+#include "frame_convert.h"
+#include "frame_window.h"
+#include "voxel_grid.h"
+#include "cloud_writer.h"
+#include "height_map.h"
+#include "fusion_target.h"
 
 // matrix dimensions
 #define RGB_WIDTH 1920
 #define RGB_HEIGHT 1080
 #define DEPTH_WIDTH 512
 #define DEPTH_HEIGHT 424
+#define BIGDEPTH_HEIGHT 1082
+
+// TA: char outputs of float images: depth (mm) maps 0..4.5 m, the sensor's range, and uv maps the colour width to 0..255
+#define TA_KINECT2_DEPTH_CHAR_SCALE (255.0f / 4500.0f)
+#define TA_KINECT2_UV_CHAR_SCALE (255.0f / RGB_WIDTH)
+
+// TA: most depth frames the batch outlet holds (2 x 64 frames of 868 KB stay allocated while it is on)
+#define TA_KINECT2_MAX_BATCH 64
+
+// TA: highest core index + 1 the *_affinity attributes take
+#define TA_KINECT2_MAX_CORES 64
+
+// TA: how often libfreenect2 log messages are moved to the Max console (ms)
+#define TA_KINECT2_LOG_INTERVAL 100
+
+// TA: bits returned by the "getupdated" method (which outlets have a new matrix)
+#define TA_KINECT2_UPDATED_DEPTH 1
+#define TA_KINECT2_UPDATED_RGB 2
+#define TA_KINECT2_UPDATED_BIGDEPTH 4
+#define TA_KINECT2_UPDATED_UVMAP 8
+#define TA_KINECT2_UPDATED_PYRAMID 16
+#define TA_KINECT2_UPDATED_NORMALS 32
+#define TA_KINECT2_UPDATED_MOTION 64 // not an outlet: a "motion" report for dumpout (see getmotion)
+#define TA_KINECT2_UPDATED_BATCH 128
+#define TA_KINECT2_UPDATED_VOXELS 256
+#define TA_KINECT2_UPDATED_HEIGHTMAP 512
+#define TA_KINECT2_UPDATED_FUSED 1024
+
+
+// TA: outlets whose element type and planecount are set one by one (@<name>_type, @<name>_planecount);
+// batch, voxels and fused have a fixed layout
+enum {
+    TA_KINECT2_LAYOUT_DEPTH = 0,
+    TA_KINECT2_LAYOUT_RGB,
+    TA_KINECT2_LAYOUT_BIGDEPTH,
+    TA_KINECT2_LAYOUT_UVMAP,
+    TA_KINECT2_LAYOUT_PYRAMID,
+    TA_KINECT2_LAYOUT_NORMALS,
+    TA_KINECT2_LAYOUT_HEIGHTMAP,
+    TA_KINECT2_LAYOUTS
+};
+static const char *s_layout_names[TA_KINECT2_LAYOUTS] = {"depth", "rgb", "bigdepth", "uvmap", "pyramid", "normals", "heightmap"};
 
 
 // Our Jitter object instance data
 typedef struct _ta_jit_kinect2 {
     t_object	ob;
     long depth_processor;
+    long depth_threads; // TA: depth_processor 3 worker threads (0 = one per core but one)
+    long depth_validate; // TA: depth_processor 3, compare every Nth frame with the stock CPU processor (0 = off)
+    long decode_threads; // TA: colour JPEG decoder threads (0 = stock single-threaded decoder)
+    long sync; // TA: 1 = wait for colour+depth pairs, 0 = each stream delivered on its own, 2 = nearest-timestamp pairs (applies on next open)
+    long calibration_cache; // TA: keep tables derived from the device calibration on disk (applies on next open)
+    long watchdog; // TA: ms without frames before the device is reopened in the background (0 = off, applies on next open)
+    long share; // TA: publish frames into shared memory for other local processes (applies on next open)
+    t_symbol *serial; // TA: serial number of the device to open, empty = the first one (applies on next open)
+    long capture_affinity[TA_KINECT2_MAX_CORES]; // TA: cores for libfreenect2's depth (and USB) thread, none = any (applies on next open)
+    long capture_affinitycount;
+    long capture_priority; // TA: 0 = normal, 1..99 = SCHED_FIFO priority (applies on next open)
+    long decode_affinity[TA_KINECT2_MAX_CORES]; // TA: cores for the colour decoder threads
+    long decode_affinitycount;
+    long decode_priority;
+    long worker_affinity[TA_KINECT2_MAX_CORES]; // TA: cores for the depth worker pools
+    long worker_affinitycount;
+    long worker_priority;
+    long output_mode; // TA: 0 = as many outlets as have something to show, 1 = new frames only (nothing at all otherwise)
+    t_symbol *outlet_type[TA_KINECT2_LAYOUTS]; // TA: per outlet, the MOP's own type / planecount would set every outlet at once
+    long outlet_planecount[TA_KINECT2_LAYOUTS];
+    long bigdepth; // TA: 1920x1082 depth in colour camera space on the third outlet (computed only while enabled)
+    long uvmap; // TA: 512x424x2 colour pixel coordinates of the undistorted depth pixels on the fourth outlet (computed only while enabled)
+    long pyramid; // TA: depth reduced 2, 4 .. 2^pyramid times (1 = 256x212 .. 3 = 64x53), one level on the fifth outlet, 0 = off
+    long pyramid_mode; // TA: 0 = nearest valid (min), 1 = median of the valid pixels of each 2x2 block
+    long pyramid_output; // TA: which of the levels 1 .. pyramid (all computed in the same pass) is output, 0 = pyramid
+    long normals; // TA: 512x424x3 unit surface normals of the undistorted depth on the sixth outlet (computed only while enabled)
+    long motion; // TA: compare each depth frame with the previous one in 16x16 tiles, "motion <activity> <tile>..." on dumpout
+    float motion_threshold; // TA: mean depth change of a tile, in mm, above which it counts as changed
+    long motion_suppress; // TA: 1 = no matrix output while no tile changed
+    float activity; // TA: changed tiles / all tiles of the last depth frame, 0..1 (read-only)
+    long batch; // TA: last N depth frames as one 512x424xN float32 matrix on the seventh outlet, oldest first (0 = off)
+    float voxel; // TA: voxel size in metres of the downsampled point cloud on the eighth outlet (0 = off)
+    long voxel_dropped; // TA: points of the last cloud that found no room in the voxel grid (read-only)
+    long write_cloud; // TA: record the point cloud to disk, 0 = off, 1 = one binary PLY per frame, 2 = one indexed sequence file
+    t_symbol *write_cloud_path; // TA: PLY file prefix or sequence file (Max or native path, applies when recording starts)
+    long write_cloud_depth; // TA: 1 = a sequence file also keeps every raw depth frame, depth-codec compressed (applies when recording starts)
+    long write_cloud_written; // TA: clouds written since recording started (read-only)
+    long write_cloud_dropped; // TA: clouds dropped because the disk was behind (read-only)
+    long heightmap; // TA: plan view of the point cloud on the ninth outlet, 0 = off, 1 = highest point (m), 2 = points per cell
+    long heightmap_dim[2]; // TA: grid cells, centred on the floor origin
+    long heightmap_dimcount;
+    float heightmap_cell; // TA: cell size in metres
+    float heightmap_transform[16]; // TA: 4x4 camera -> floor (x, y on the floor, z up), row by row
+    long heightmap_transformcount;
+    float heightmap_range[2]; // TA: only points this high above the floor count (m), keeps the floor itself out
+    long heightmap_rangecount;
+    t_symbol *fusion; // TA: name of the process-wide fusion target this sensor's cloud goes to, empty = off
+    float fusion_transform[16]; // TA: 4x4 extrinsics, this camera -> the shared frame, row by row
+    long fusion_transformcount;
+    long fusion_window; // TA: ms: clouds older than the newest one by more than this are left out of the merge
+    long fusion_sensors; // TA: sensors in the last fused cloud (read-only)
+    float skew; // TA: colour minus depth timestamp of the last pair, in ms (read-only)
+    long log_level; // TA: libfreenect2 log level, 0 (none) .. 4 (debug), shared by all instances
     
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *device; // TA: declare freenect2 device
-    libfreenect2::PacketPipeline *pipeline; // TA: declare packet pipeline
-    libfreenect2::SyncMultiFrameListener *listener; //TA: depth frame listener
-    libfreenect2::FrameMap *frame_map; // TA: frame map (contains all frames: depth, rgb, etc...)
-    t_bool isOpen;
+    ta::Kinect2Session *session; // TA: device, pipeline and listeners, opened/closed on the session thread
+    void *state_qelem; // TA: reports session state changes from the main thread
+    libfreenect2::Frame *rgb_frame; // TA: frames being converted in the current matrix_calc
+    libfreenect2::Frame *depth_frame;
+    long updated; // TA: TA_KINECT2_UPDATED_* bits set by the last matrix_calc
+    bool still; // TA: the last motion report had no changed tile
+    t_atom *motion_atoms; // TA: the last motion report, activity then tile indices (row * 32 + column)
+    long motion_atomcount;
+    ta::FrameWindow *batch_window; // TA: the frames the batch matrix references (Max thread only)
+    ta::VoxelGrid *voxel_grid; // TA: created with the first voxel cloud (Max thread only)
+    ta::CloudWriter *cloud_writer; // TA: created and deleted by matrix_calc as write_cloud changes (Max thread only)
+    ta::HeightMap *height_map; // TA: created with the first height map (Max thread only)
+    ta::FusionTarget *fusion_target; // TA: attached while fusion names one
+    int fusion_sensor; // TA: this instance's slot in it
+    ta::FusionTarget::Cloud *fusion_cloud; // TA: the last merged cloud (Max thread only)
 } t_ta_jit_kinect2;
 
 
@@ -52,11 +165,42 @@ void ta_jit_kinect2_copy_depthdata(t_ta_jit_kinect2 *x, long dimcount, t_jit_mat
 void ta_jit_kinect2_copy_rgbdata(t_ta_jit_kinect2 *x, long dimcount, t_jit_matrix_info *out_minfo, char *bop);
 void            ta_jit_kinect2_open(t_ta_jit_kinect2 *x);
 void            ta_jit_kinect2_close(t_ta_jit_kinect2 *x);
+t_atom_long     ta_jit_kinect2_getupdated(t_ta_jit_kinect2 *x);
+t_atom          *ta_jit_kinect2_getmotion(t_ta_jit_kinect2 *x, long *ac);
+t_jit_err       ta_jit_kinect2_log_level_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+t_jit_err       ta_jit_kinect2_log_dropped_get(t_ta_jit_kinect2 *x, void *attr, long *argc, t_atom **argv);
+void            ta_jit_kinect2_log_drain(ta::RingLogger *logger);
+void            ta_jit_kinect2_state_notify(t_ta_jit_kinect2 *x);
+t_jit_err       ta_jit_kinect2_products_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+t_jit_err       ta_jit_kinect2_layout_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+void            ta_jit_kinect2_layout_apply(t_ta_jit_kinect2 *x, int layout, void *matrix);
+t_jit_err       ta_jit_kinect2_batch_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+void            ta_jit_kinect2_thread_policy(const long *cores, long count, long priority, ta::ThreadPolicy *policy);
+void            ta_jit_kinect2_worker_policy(t_ta_jit_kinect2 *x);
+t_jit_err       ta_jit_kinect2_fusion_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+t_jit_err       ta_jit_kinect2_fusion_transform_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv);
+void ta_jit_kinect2_copy_bigdepthdata(const float *bigdepth, t_jit_matrix_info *out_minfo, char *bop);
+void ta_jit_kinect2_copy_uvdata(const float *uv, t_jit_matrix_info *out_minfo, char *bop);
+long ta_jit_kinect2_pyramid_output(t_ta_jit_kinect2 *x);
+void ta_jit_kinect2_copy_pyramiddata(const float *pyramid, long level, t_jit_matrix_info *out_minfo, char *bop);
+void ta_jit_kinect2_copy_normalsdata(const float *normals, t_jit_matrix_info *out_minfo, char *bop);
+void ta_jit_kinect2_motion_report(t_ta_jit_kinect2 *x, const ta::DepthProducts *products);
+void ta_jit_kinect2_batch_update(t_ta_jit_kinect2 *x, void *batch_matrix);
+bool ta_jit_kinect2_voxel_output(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, libfreenect2::Frame *color, void *voxel_matrix);
+void ta_jit_kinect2_cloud_update(t_ta_jit_kinect2 *x);
+void ta_jit_kinect2_cloud_write(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, libfreenect2::Frame *color);
+void ta_jit_kinect2_heightmap_output(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, void *heightmap_matrix);
+void ta_jit_kinect2_fusion_leave(t_ta_jit_kinect2 *x);
+bool ta_jit_kinect2_fusion_output(t_ta_jit_kinect2 *x, void *fused_matrix);
+void            ta_jit_kinect2_state_report(t_ta_jit_kinect2 *x);
 END_USING_C_LINKAGE
 
 
 // globals
 static void *s_ta_jit_kinect2_class = NULL;
+static ta::RingLogger *s_logger = NULL; // TA: libfreenect2's global logger (libfreenect2 owns it)
+static void *s_log_clock = NULL; // TA: drains s_logger into the Max console
+static unsigned long s_log_dropped_reported = 0;
 
 
 /************************************************************************************/
@@ -71,13 +215,15 @@ t_jit_err ta_jit_kinect2_init(void)
     s_ta_jit_kinect2_class = jit_class_new("ta_jit_kinect2", (method)ta_jit_kinect2_new, (method)ta_jit_kinect2_free, sizeof(t_ta_jit_kinect2), 0);
     
     // add matrix operator (mop)
-    mop = (t_jit_object *)jit_object_new(_jit_sym_jit_mop, 0, 2); // args are  num inputs and num outputs
+    mop = (t_jit_object *)jit_object_new(_jit_sym_jit_mop, 0, 10); // args are  num inputs and num outputs // TA: depth, rgb, bigdepth, uvmap, pyramid, normals, batch, voxels, heightmap, fused
     jit_class_addadornment(s_ta_jit_kinect2_class, mop);
     
     // add method(s)
     jit_class_addmethod(s_ta_jit_kinect2_class, (method)ta_jit_kinect2_matrix_calc, "matrix_calc", A_CANT, 0);
     jit_class_addmethod(s_ta_jit_kinect2_class, (method)ta_jit_kinect2_open, "open", 0);
     jit_class_addmethod(s_ta_jit_kinect2_class, (method)ta_jit_kinect2_close, "close", 0);
+    jit_class_addmethod(s_ta_jit_kinect2_class, (method)ta_jit_kinect2_getupdated, "getupdated", A_CANT, 0);
+    jit_class_addmethod(s_ta_jit_kinect2_class, (method)ta_jit_kinect2_getmotion, "getmotion", A_CANT, 0);
     
     // add attribute(s)
     attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
@@ -89,6 +235,453 @@ t_jit_err ta_jit_kinect2_init(void)
     
     jit_class_addattr(s_ta_jit_kinect2_class, attr);
     
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "depth_threads",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, depth_threads));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "depth_validate",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, depth_validate));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "decode_threads",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, decode_threads));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "sync",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, sync));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "output_mode",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, output_mode));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    for (int i = 0; i < TA_KINECT2_LAYOUTS; i++) {
+        std::string name = s_layout_names[i];
+        attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                              (name + "_type").c_str(),
+                                              _jit_sym_symbol,
+                                              attrflags,
+                                              (method)NULL, (method)ta_jit_kinect2_layout_set,
+                                              calcoffset(t_ta_jit_kinect2, outlet_type) + i * sizeof(t_symbol *));
+        
+        jit_class_addattr(s_ta_jit_kinect2_class, attr);
+        
+        attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                              (name + "_planecount").c_str(),
+                                              _jit_sym_long,
+                                              attrflags,
+                                              (method)NULL, (method)ta_jit_kinect2_layout_set,
+                                              calcoffset(t_ta_jit_kinect2, outlet_planecount) + i * sizeof(long));
+        
+        jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    }
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "calibration_cache",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, calibration_cache));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "watchdog",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, watchdog));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "share",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, share));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "serial",
+                                          _jit_sym_symbol,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, serial));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "capture_affinity",
+                                          _jit_sym_long,
+                                          TA_KINECT2_MAX_CORES,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, capture_affinitycount),
+                                          calcoffset(t_ta_jit_kinect2, capture_affinity));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "capture_priority",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, capture_priority));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "decode_affinity",
+                                          _jit_sym_long,
+                                          TA_KINECT2_MAX_CORES,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, decode_affinitycount),
+                                          calcoffset(t_ta_jit_kinect2, decode_affinity));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "decode_priority",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, decode_priority));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "worker_affinity",
+                                          _jit_sym_long,
+                                          TA_KINECT2_MAX_CORES,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, worker_affinitycount),
+                                          calcoffset(t_ta_jit_kinect2, worker_affinity));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "worker_priority",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, worker_priority));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "bigdepth",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, bigdepth));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "uvmap",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, uvmap));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "pyramid",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, pyramid));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "pyramid_mode",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, pyramid_mode));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "pyramid_output",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, pyramid_output));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "normals",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, normals));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "motion",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, motion));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "motion_threshold",
+                                          _jit_sym_float32,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, motion_threshold));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "motion_suppress",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, motion_suppress));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "activity",
+                                          _jit_sym_float32,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, activity));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "batch",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_batch_set,
+                                          calcoffset(t_ta_jit_kinect2, batch));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "voxel",
+                                          _jit_sym_float32,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, voxel));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "voxel_dropped",
+                                          _jit_sym_long,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, voxel_dropped));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "write_cloud",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, write_cloud));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "write_cloud_path",
+                                          _jit_sym_symbol,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, write_cloud_path));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "write_cloud_depth",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, write_cloud_depth));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "write_cloud_written",
+                                          _jit_sym_long,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, write_cloud_written));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "write_cloud_dropped",
+                                          _jit_sym_long,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, write_cloud_dropped));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "heightmap",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_products_set,
+                                          calcoffset(t_ta_jit_kinect2, heightmap));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "heightmap_dim",
+                                          _jit_sym_long,
+                                          2,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, heightmap_dimcount),
+                                          calcoffset(t_ta_jit_kinect2, heightmap_dim));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "heightmap_cell",
+                                          _jit_sym_float32,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, heightmap_cell));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "heightmap_transform",
+                                          _jit_sym_float32,
+                                          16,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, heightmap_transformcount),
+                                          calcoffset(t_ta_jit_kinect2, heightmap_transform));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "heightmap_range",
+                                          _jit_sym_float32,
+                                          2,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, heightmap_rangecount),
+                                          calcoffset(t_ta_jit_kinect2, heightmap_range));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "fusion",
+                                          _jit_sym_symbol,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_fusion_set,
+                                          calcoffset(t_ta_jit_kinect2, fusion));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset_array,
+                                          "fusion_transform",
+                                          _jit_sym_float32,
+                                          16,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_fusion_transform_set,
+                                          calcoffset(t_ta_jit_kinect2, fusion_transformcount),
+                                          calcoffset(t_ta_jit_kinect2, fusion_transform));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "fusion_window",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, fusion_window));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "fusion_sensors",
+                                          _jit_sym_long,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, fusion_sensors));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "skew",
+                                          _jit_sym_float32,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)NULL, (method)NULL,
+                                          calcoffset(t_ta_jit_kinect2, skew));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "log_level",
+                                          _jit_sym_long,
+                                          attrflags,
+                                          (method)NULL, (method)ta_jit_kinect2_log_level_set,
+                                          calcoffset(t_ta_jit_kinect2, log_level));
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    attr = (t_jit_object *)jit_object_new(_jit_sym_jit_attr_offset,
+                                          "log_dropped",
+                                          _jit_sym_long,
+                                          JIT_ATTR_GET_DEFER_LOW | JIT_ATTR_SET_OPAQUE_USER,
+                                          (method)ta_jit_kinect2_log_dropped_get, (method)NULL,
+                                          0);
+    
+    jit_class_addattr(s_ta_jit_kinect2_class, attr);
+    
+    // TA: route libfreenect2 logging (USB and processing threads) through a lock-free ring,
+    // the console only ever sees it from the main thread
+    s_logger = new ta::RingLogger(libfreenect2::Logger::getDefaultLevel());
+    libfreenect2::setGlobalLogger(s_logger);
+    s_log_clock = clock_new(s_logger, (method)ta_jit_kinect2_log_drain);
+    clock_delay(s_log_clock, TA_KINECT2_LOG_INTERVAL);
+    
     // finalize class
     jit_class_register(s_ta_jit_kinect2_class);
     return JIT_ERR_NONE;
@@ -106,10 +699,88 @@ t_ta_jit_kinect2 *ta_jit_kinect2_new(void)
     // TA: initialize other data or structs
     if (x) {
         x->depth_processor = 2; //TA: default depth-processor is OpenCL
-        x->freenect2 = *new libfreenect2::Freenect2();
-        x->device = 0; //TA: init device
-        x->pipeline = 0; //TA: init pipeline
-        x->isOpen = false;
+        x->depth_threads = 0;
+        x->depth_validate = 0;
+        x->decode_threads = 2; //TA: two JPEG decoders keep 30 fps with decodes up to ~66 ms
+        x->sync = 1; //TA: default is paired colour+depth output
+        x->output_mode = 0;
+        for (int i = 0; i < TA_KINECT2_LAYOUTS; i++) {
+            x->outlet_type[i] = _jit_sym_float32;
+            x->outlet_planecount[i] = 1;
+        }
+        x->outlet_type[TA_KINECT2_LAYOUT_RGB] = _jit_sym_char; //TA: ARGB, as jitter likes it
+        x->outlet_planecount[TA_KINECT2_LAYOUT_RGB] = 4;
+        x->outlet_planecount[TA_KINECT2_LAYOUT_UVMAP] = 2;
+        x->outlet_planecount[TA_KINECT2_LAYOUT_NORMALS] = 3;
+        x->calibration_cache = 1;
+        x->watchdog = 2000; //TA: 2 s without frames = cable knocked out, reconnect
+        x->share = 0;
+        x->serial = gensym("");
+        x->capture_affinitycount = 0;
+        x->capture_priority = 0;
+        x->decode_affinitycount = 0;
+        x->decode_priority = 0;
+        x->worker_affinitycount = 0;
+        x->worker_priority = 0;
+        x->bigdepth = 0;
+        x->uvmap = 0;
+        x->pyramid = 0;
+        x->pyramid_mode = 0;
+        x->pyramid_output = 0;
+        x->normals = 0;
+        x->motion = 0;
+        x->motion_threshold = 15; //TA: well above the sensor's few mm of noise
+        x->motion_suppress = 0;
+        x->activity = 0;
+        x->batch = 0;
+        x->voxel = 0;
+        x->voxel_dropped = 0;
+        x->write_cloud = 0;
+        x->write_cloud_path = gensym("");
+        x->write_cloud_depth = 0;
+        x->write_cloud_written = 0;
+        x->write_cloud_dropped = 0;
+        x->heightmap = 0;
+        x->heightmap_dim[0] = 256;
+        x->heightmap_dim[1] = 256;
+        x->heightmap_dimcount = 2;
+        x->heightmap_cell = 0.02f; //TA: 256 x 2 cm = 5.12 m, the sensor's range
+        {
+            //TA: a level sensor: floor x = camera x, floor y = camera z (2.56 m ahead at the grid centre), up = -camera y
+            static const float level[16] = {1, 0, 0, 0,
+                                            0, 0, 1, -2.56f,
+                                            0, -1, 0, 0,
+                                            0, 0, 0, 1};
+            for (int i = 0; i < 16; i++)
+                x->heightmap_transform[i] = level[i];
+        }
+        x->heightmap_transformcount = 16;
+        x->heightmap_range[0] = 0.05f;
+        x->heightmap_range[1] = 2.5f;
+        x->heightmap_rangecount = 2;
+        x->fusion = gensym("");
+        for (int i = 0; i < 16; i++)
+            x->fusion_transform[i] = (i % 5) ? 0 : 1; //TA: identity, this camera is the shared frame
+        x->fusion_transformcount = 16;
+        x->fusion_window = 40; //TA: a bit over one frame at 30 fps
+        x->fusion_sensors = 0;
+        x->skew = 0;
+        x->log_level = s_logger->level();
+        x->rgb_frame = NULL;
+        x->depth_frame = NULL;
+        x->updated = 0;
+        x->still = false;
+        x->motion_atoms = (t_atom *)jit_getbytes((1 + ta::MotionTiles) * sizeof(t_atom));
+        x->motion_atomcount = 0;
+        x->batch_window = NULL;
+        x->voxel_grid = NULL;
+        x->cloud_writer = NULL;
+        x->height_map = NULL;
+        x->fusion_target = NULL;
+        x->fusion_sensor = -1;
+        x->fusion_cloud = NULL;
+        x->state_qelem = qelem_new(x, (method)ta_jit_kinect2_state_report);
+        x->session = new ta::Kinect2Session((ta::Kinect2Session::NotifyFunction)ta_jit_kinect2_state_notify, x);
     }
     
     return x;
@@ -118,108 +789,321 @@ t_ta_jit_kinect2 *ta_jit_kinect2_new(void)
 
 void ta_jit_kinect2_free(t_ta_jit_kinect2 *x)
 {
-    post("closing device...");
-    if (x->isOpen == false) {
-        return; // quit close method if no device is open
-    }
-    x->device->stop();
-    x->device->close();
-    
-    x->listener->release(*x->frame_map);
-    x->listener = NULL;
-    x->frame_map = NULL;
-    x->device = NULL;
-    x->pipeline = NULL;
-    
-;
+    // TA: this is the only place that waits for the device, there is nobody left to notify
+    delete x->session;
+    x->session = NULL;
+    ta_jit_kinect2_fusion_leave(x); // TA: after the session, nothing contributes any more
+    delete x->fusion_cloud;
+    qelem_free(x->state_qelem);
+    jit_freebytes(x->motion_atoms, (1 + ta::MotionTiles) * sizeof(t_atom));
+    delete x->batch_window; // TA: the mop matrices referencing it are already gone
+    delete x->voxel_grid;
+    delete x->cloud_writer; // TA: writes what is still staged and closes the sequence file
+    delete x->height_map;
 }
 
 /************************************************************************************/
 // TA: METHODS BOUND TO KINECT
 
-//TA: open kinect device
+//TA: open kinect device (returns immediately, progress is reported as "state" on dumpout)
 void ta_jit_kinect2_open(t_ta_jit_kinect2 *x){
+    ta::Kinect2Session::Config config;
 
     post("opening device...");
     
-    // TA: exit "open" method if a device is already open
-    if (x->isOpen == true) {
-        post("device already opened");
-        return;
+    switch (x->depth_processor) {
+        case 0:
+        case 2:
+        case 3:
+            break;
+            
+        case 1:
+            //                x->pipeline = new libfreenect2::OpenGLPacketPipeline();
+            // TA: DAMN!!!!! OpenGL not found!!!!!!
+            post("OpenGL packet pipeline not available for the moment!!!");
+            return;
+            
+        default:
+            post("wrong attribute value");
+            post("values for depth processor are:");
+            post("0 - CPU");
+            post("1 - OpenGL");
+            post("2 - OpenCL");
+            post("3 - CPU (multithreaded)");
+            post("please set a correct value and open device again");
+            return; // TA: exit "open" method if no depth_processor is selected
     }
-    // TA: check for connected devices
-    if (x->freenect2.enumerateDevices() == 0) {
-        post("no device connected!");
-        return; // TA: exit "open" method if no device is connected
+    
+    config.depth_processor = x->depth_processor;
+    config.depth_threads = x->depth_threads;
+    config.depth_validate = x->depth_validate;
+    config.decode_threads = x->decode_threads;
+    config.sync = x->sync;
+    config.calibration_cache = x->calibration_cache;
+    config.watchdog = x->watchdog > 0 ? x->watchdog : 0;
+    config.share = x->share ? 1 : 0;
+    config.serial = x->serial ? x->serial->s_name : "";
+    ta_jit_kinect2_thread_policy(x->capture_affinity, x->capture_affinitycount, x->capture_priority, &config.capture);
+    ta_jit_kinect2_thread_policy(x->decode_affinity, x->decode_affinitycount, x->decode_priority, &config.decode);
+    ta_jit_kinect2_thread_policy(x->worker_affinity, x->worker_affinitycount, x->worker_priority, &config.worker);
+    x->session->open(config);
+    ta_jit_kinect2_worker_policy(x);
+}
+//TA: a list of core indices and a priority as the session wants them (out of range cores are ignored)
+void ta_jit_kinect2_thread_policy(const long *cores, long count, long priority, ta::ThreadPolicy *policy){
+    policy->cpus = 0;
+    for (long i = 0; i < count && i < TA_KINECT2_MAX_CORES; i++) {
+        if (cores[i] >= 0 && cores[i] < TA_KINECT2_MAX_CORES)
+            policy->cpus |= (uint64_t)1 << cores[i];
     }
+    policy->priority = priority < 0 ? 0 : priority > 99 ? 99 : (int)priority;
+}
+//TA: the voxel grid and height map pools are workers too: they follow worker_affinity / worker_priority
+//    when created and on every open (like the session's pools, which read them on open)
+void ta_jit_kinect2_worker_policy(t_ta_jit_kinect2 *x){
+    ta::ThreadPolicy policy;
+    std::string message;
     
-    if(!x->pipeline){
-        switch (x->depth_processor) {
-            case 0:
-                x->pipeline = new libfreenect2::CpuPacketPipeline();
-                post("using CPU packet pipeline...");
-                break;
-                
-            case 1:
-                //                x->pipeline = new libfreenect2::OpenGLPacketPipeline();
-                // TA: DAMN!!!!! OpenGL not found!!!!!!
-//                post("using OpenGL packet pipeline...");
-
-                
-                post("OpenGL packet pipeline not available for the moment!!!");
-                break;
-                
-            case 2:
-                x->pipeline = new libfreenect2::OpenCLPacketPipeline();
-                post("using OpenCL packet pipeline...");
-                break;
-                
-            default:
-                post("wrong attribute value");
-                post("values for depth processor are:");
-                post("0 - CPU");
-                post("1 - OpenGL");
-                post("2 - OpenCL");
-                post("please set a correct value and open device again");
-                return; // TA: exit "open" method if no depth_processor is selected
-        }
+    ta_jit_kinect2_thread_policy(x->worker_affinity, x->worker_affinitycount, x->worker_priority, &policy);
+    if (policy.isDefault())
+        return;
+    if ((x->voxel_grid && !x->voxel_grid->setThreadPolicy(policy, message)) ||
+        (x->height_map && !x->height_map->setThreadPolicy(policy, message)))
+        error("ta.jit.kinect2: worker threads: %s", message.c_str());
+}
+//TA: close kinect device (returns immediately)
+void ta_jit_kinect2_close(t_ta_jit_kinect2 *x){
+    post("closing device...");
+    x->session->close();
+}
+
+//TA: session thread: a state change is waiting, report it from the main thread
+void ta_jit_kinect2_state_notify(t_ta_jit_kinect2 *x){
+    qelem_set(x->state_qelem);
+}
+
+//TA: qelem (main thread): send every pending state change to the Max wrapper ("state <name> [message]" on dumpout)
+void ta_jit_kinect2_state_report(t_ta_jit_kinect2 *x){
+    ta::Kinect2Session::State state;
+    std::string message;
+    t_atom av[2];
+    
+    while (x->session && x->session->popTransition(state, message)) {
+        jit_atom_setsym(av, gensym(ta::Kinect2Session::stateName(state)));
+        jit_atom_setsym(av + 1, gensym(message.c_str()));
+        if (state == ta::Kinect2Session::Error)
+            error("ta.jit.kinect2: %s", message.c_str());
+        jit_object_notify(x, gensym("state"), av);
     }
-    if(x->pipeline){
-        x->device = x->freenect2.openDefaultDevice();
+}
+
+//TA: the depth-derived outlets only cost anything while enabled, tell the session which ones are
+t_jit_err ta_jit_kinect2_products_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    t_symbol *name = (t_symbol *)jit_object_method(attr, _jit_sym_getname);
+    unsigned int products = 0;
+    
+    if (argc && argv) {
+        long value = jit_atom_getlong(argv) ? 1 : 0;
+        if (name == gensym("bigdepth"))
+            x->bigdepth = value;
+        else if (name == gensym("uvmap"))
+            x->uvmap = value;
+        else if (name == gensym("pyramid")) {
+            value = jit_atom_getlong(argv);
+            x->pyramid = value < 0 ? 0 : value > ta::PyramidLevels ? ta::PyramidLevels : value;
+        }
+        else if (name == gensym("pyramid_mode"))
+            x->pyramid_mode = value;
+        else if (name == gensym("pyramid_output")) {
+            value = jit_atom_getlong(argv);
+            x->pyramid_output = value < 0 ? 0 : value > ta::PyramidLevels ? ta::PyramidLevels : value;
+        }
+        else if (name == gensym("normals"))
+            x->normals = value;
+        else if (name == gensym("motion")) {
+            x->motion = value;
+            x->still = false;
+        }
+        else if (name == gensym("voxel")) {
+            float size = jit_atom_getfloat(argv);
+            x->voxel = size > 0 ? size : 0;
+        }
+        else if (name == gensym("heightmap")) {
+            value = jit_atom_getlong(argv);
+            x->heightmap = value < 0 ? 0 : value > ta::HeightMap::HitCount ? ta::HeightMap::HitCount : value;
+        }
+        else if (name == gensym("write_cloud")) {
+            value = jit_atom_getlong(argv);
+            x->write_cloud = value < 0 ? 0 : value > ta::CloudWriter::Sequence ? ta::CloudWriter::Sequence : value;
+        }
+        else if (name == gensym("motion_threshold")) {
+            float threshold = jit_atom_getfloat(argv);
+            x->motion_threshold = threshold > 0 ? threshold : 0;
+        }
     }
-    if(x->device == 0){
-        post("failed to open device!!!");
-        return;
+    
+    if (x->bigdepth)
+        products |= ta::DepthStage::BigDepth;
+    if (x->uvmap)
+        products |= ta::DepthStage::UvMap;
+    if (x->pyramid)
+        products |= ta::DepthStage::Pyramid;
+    if (x->normals)
+        products |= ta::DepthStage::Normals;
+    if (x->motion)
+        products |= ta::DepthStage::Motion;
+    if (x->voxel > 0)
+        products |= ta::DepthStage::Points | ta::DepthStage::UvMap; // TA: uv for the colour of each point
+    if (x->write_cloud)
+        products |= ta::DepthStage::Points | ta::DepthStage::UvMap;
+    if (x->heightmap)
+        products |= ta::DepthStage::Points;
+    if (x->fusion_target)
+        products |= ta::DepthStage::Points;
+    if (x->session) {
+        x->session->setDepthPyramid(x->pyramid ? (int)x->pyramid : 1, x->pyramid_mode ? ta::ReduceMedian : ta::ReduceMin);
+        x->session->setDepthMotionThreshold(x->motion_threshold);
+        x->session->setDepthProducts(products);
     }
-    post("default Kinect device is now open !");
+    return JIT_ERR_NONE;
+}
 
+//TA: @<outlet>_type and @<outlet>_planecount, applied to the matrix by the next matrix_calc
+t_jit_err ta_jit_kinect2_layout_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    std::string name = ((t_symbol *)jit_object_method(attr, _jit_sym_getname))->s_name;
     
-    // TA: start device
-    x->listener = new libfreenect2::SyncMultiFrameListener(libfreenect2::Frame::Color|libfreenect2::Frame::Depth);
-    x->device->setColorFrameListener(x->listener);
-    x->device->setIrAndDepthFrameListener(x->listener);
-    x->frame_map = new libfreenect2::FrameMap[libfreenect2::Frame::Type::Color|libfreenect2::Frame::Type::Depth];
-    x->device->start();
+    if (!argc || !argv)
+        return JIT_ERR_NONE;
+    for (int i = 0; i < TA_KINECT2_LAYOUTS; i++) {
+        if (name == std::string(s_layout_names[i]) + "_type") {
+            t_symbol *type = jit_atom_getsym(argv);
+            if (type == _jit_sym_char || type == _jit_sym_long || type == _jit_sym_float32 || type == _jit_sym_float64)
+                x->outlet_type[i] = type;
+            else
+                error("ta.jit.kinect2: %s must be char, long, float32 or float64", name.c_str());
+        }
+        else if (name == std::string(s_layout_names[i]) + "_planecount") {
+            long planecount = jit_atom_getlong(argv);
+            x->outlet_planecount[i] = planecount < 1 ? 1 : planecount > JIT_MATRIX_MAX_PLANECOUNT ? JIT_MATRIX_MAX_PLANECOUNT : planecount;
+        }
+    }
+    return JIT_ERR_NONE;
+}
+
+//TA: before locking (a locked matrix keeps its info), only when something changed
+void ta_jit_kinect2_layout_apply(t_ta_jit_kinect2 *x, int layout, void *matrix){
+    t_jit_matrix_info info;
     
-    x->isOpen = true;
+    jit_object_method(matrix, _jit_sym_getinfo, &info);
+    if (info.type != x->outlet_type[layout] || info.planecount != x->outlet_planecount[layout]) {
+        info.type = x->outlet_type[layout];
+        info.planecount = x->outlet_planecount[layout];
+        jit_object_method(matrix, _jit_sym_setinfo, &info);
+    }
+}
+
+//TA: the window itself is (re)built by the next matrix_calc, on the thread that reads the matrix
+t_jit_err ta_jit_kinect2_batch_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    if (argc && argv) {
+        long value = jit_atom_getlong(argv);
+        x->batch = value < 0 ? 0 : value > TA_KINECT2_MAX_BATCH ? TA_KINECT2_MAX_BATCH : value;
+    }
+    return JIT_ERR_NONE;
+}
+
+//TA: leaves the previous fusion target (if any) and joins the named one, every sensor in it gets a slot of its own
+t_jit_err ta_jit_kinect2_fusion_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    t_symbol *name = (argc && argv) ? jit_atom_getsym(argv) : gensym("");
     
-    post("device is ready");
+    ta_jit_kinect2_fusion_leave(x);
+    x->fusion = name ? name : gensym("");
+    if (*x->fusion->s_name) {
+        ta::FusionTarget *target = ta::FusionTarget::attach(x->fusion->s_name);
+        int sensor = target->join();
+        if (sensor < 0) {
+            error("ta.jit.kinect2: fusion target %s already has %d sensors", x->fusion->s_name, (int)ta::FusionTarget::MaxSensors);
+            ta::FusionTarget::detach(target);
+            x->fusion = gensym("");
+        }
+        else {
+            target->setTransform(sensor, x->fusion_transform);
+            x->fusion_target = target;
+            x->fusion_sensor = sensor;
+            if (!x->fusion_cloud)
+                x->fusion_cloud = new ta::FusionTarget::Cloud();
+            x->fusion_cloud->generation = 0;
+            if (x->session)
+                x->session->setFusion(target, sensor);
+        }
+    }
+    return ta_jit_kinect2_products_set(x, attr, 0, NULL); // TA: points on or off
 }
-//TA: close kinect device
-void ta_jit_kinect2_close(t_ta_jit_kinect2 *x){
-    post("closing device...");
-    if (x->isOpen == false) {
-        return; // quit close method if no device is open
+
+//TA: the new extrinsics apply from the next depth frame on
+t_jit_err ta_jit_kinect2_fusion_transform_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    if (argc && argv) {
+        for (long i = 0; i < argc && i < 16; i++)
+            x->fusion_transform[i] = jit_atom_getfloat(argv + i);
+        if (x->fusion_target)
+            x->fusion_target->setTransform(x->fusion_sensor, x->fusion_transform);
     }
-    x->device->stop();
-    x->device->close();
+    return JIT_ERR_NONE;
+}
+
+//TA: log_level is global (libfreenect2 has a single logger), every instance just mirrors it
+t_jit_err ta_jit_kinect2_log_level_set(t_ta_jit_kinect2 *x, void *attr, long argc, t_atom *argv){
+    if (argc && argv) {
+        long level = jit_atom_getlong(argv);
+        if (level < libfreenect2::Logger::None) level = libfreenect2::Logger::None;
+        if (level > libfreenect2::Logger::Debug) level = libfreenect2::Logger::Debug;
+        x->log_level = level;
+        s_logger->setLevel((libfreenect2::Logger::Level)level);
+    }
+    return JIT_ERR_NONE;
+}
+
+//TA: number of libfreenect2 log messages lost because the ring was full
+t_jit_err ta_jit_kinect2_log_dropped_get(t_ta_jit_kinect2 *x, void *attr, long *argc, t_atom **argv){
+    if (!(*argc && *argv)) {
+        *argc = 1;
+        if (!(*argv = (t_atom *)jit_getbytes(sizeof(t_atom)))) {
+            *argc = 0;
+            return JIT_ERR_OUT_OF_MEM;
+        }
+    }
+    jit_atom_setlong(*argv, s_logger->dropped());
+    return JIT_ERR_NONE;
+}
+
+//TA: clock callback (main thread): move queued libfreenect2 messages to the Max console
+void ta_jit_kinect2_log_drain(ta::RingLogger *logger){
+    libfreenect2::Logger::Level level;
+    char text[ta::RingLogger::MessageSize];
     
-    x->listener->release(*x->frame_map);
-    x->listener = NULL;
-    x->device = 0; //TA: init device
-    x->pipeline = 0; //TA: init pipeline
-    x->isOpen = false;
-    post("device closed");
+    while (logger->pop(level, text)) {
+        if (level == libfreenect2::Logger::Error)
+            error("libfreenect2: %s", text);
+        else
+            post("libfreenect2 [%s]: %s", libfreenect2::Logger::level2str(level).c_str(), text);
+    }
+    
+    unsigned long dropped = logger->dropped();
+    if (dropped != s_log_dropped_reported) {
+        post("libfreenect2: %lu log messages dropped", dropped - s_log_dropped_reported);
+        s_log_dropped_reported = dropped;
+    }
+    clock_delay(s_log_clock, TA_KINECT2_LOG_INTERVAL);
+}
+
+//TA: which outlets got a new matrix in the last matrix_calc (TA_KINECT2_UPDATED_* bits)
+t_atom_long ta_jit_kinect2_getupdated(t_ta_jit_kinect2 *x){
+    return x->updated;
+}
+
+//TA: the motion report of the last matrix_calc that set TA_KINECT2_UPDATED_MOTION (owned by the object)
+t_atom *ta_jit_kinect2_getmotion(t_ta_jit_kinect2 *x, long *ac){
+    *ac = x->motion_atomcount;
+    return x->motion_atoms;
 }
 /************************************************************************************/
 // Methods bound to input/inlets
@@ -229,45 +1113,187 @@ t_jit_err ta_jit_kinect2_matrix_calc(t_ta_jit_kinect2 *x, void *inputs, void *ou
     t_jit_err			err = JIT_ERR_NONE;
     long				rgb_savelock;
     long				depth_savelock;
+    long				bigdepth_savelock;
+    long				uv_savelock;
+    long				pyramid_savelock;
+    long				normals_savelock;
     t_jit_matrix_info	rgb_minfo;
     t_jit_matrix_info	depth_minfo;
+    t_jit_matrix_info	bigdepth_minfo;
+    t_jit_matrix_info	uv_minfo;
+    t_jit_matrix_info	pyramid_minfo;
+    t_jit_matrix_info	normals_minfo;
     char				*rgb_bp;
     char				*depth_bp;
+    char				*bigdepth_bp;
+    char				*uv_bp;
+    char				*pyramid_bp;
+    char				*normals_bp;
     void				*rgb_matrix;
     void				*depth_matrix;
+    void				*bigdepth_matrix;
+    void				*uv_matrix;
+    void				*pyramid_matrix;
+    void				*normals_matrix;
+    void				*batch_matrix;
+    void				*voxel_matrix;
+    void				*heightmap_matrix;
+    void				*fused_matrix;
     
     rgb_matrix 	= jit_object_method(outputs,_jit_sym_getindex,1);
     depth_matrix = jit_object_method(outputs,_jit_sym_getindex,0);
+    bigdepth_matrix = jit_object_method(outputs,_jit_sym_getindex,2);
+    uv_matrix = jit_object_method(outputs,_jit_sym_getindex,3);
+    pyramid_matrix = jit_object_method(outputs,_jit_sym_getindex,4);
+    normals_matrix = jit_object_method(outputs,_jit_sym_getindex,5);
+    batch_matrix = jit_object_method(outputs,_jit_sym_getindex,6);
+    voxel_matrix = jit_object_method(outputs,_jit_sym_getindex,7);
+    heightmap_matrix = jit_object_method(outputs,_jit_sym_getindex,8);
+    fused_matrix = jit_object_method(outputs,_jit_sym_getindex,9);
     
-    if (x && depth_matrix && rgb_matrix) {
+    //TA: new frames only: bang at display rate, nothing is locked, converted or output between frames,
+    //    except the fused cloud, which the other sensors of the target may have moved on
+    if (x && x->output_mode == 1 && !x->session->hasNewFrame()) {
+        x->updated = 0;
+        if (x->fusion_target && fused_matrix && ta_jit_kinect2_fusion_output(x, fused_matrix))
+            x->updated |= TA_KINECT2_UPDATED_FUSED;
+        return JIT_ERR_NONE;
+    }
+    
+    if (x && depth_matrix && rgb_matrix && bigdepth_matrix && uv_matrix && pyramid_matrix && normals_matrix && batch_matrix && voxel_matrix && heightmap_matrix && fused_matrix) {
+        //TA: every outlet that converts gets its own type and planecount
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_DEPTH, depth_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_RGB, rgb_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_BIGDEPTH, bigdepth_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_UVMAP, uv_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_PYRAMID, pyramid_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_NORMALS, normals_matrix);
+        ta_jit_kinect2_layout_apply(x, TA_KINECT2_LAYOUT_HEIGHTMAP, heightmap_matrix);
+        //TA: the pyramid matrix follows the output level (before locking, a locked matrix keeps its dim)
+        if (x->pyramid) {
+            long level = ta_jit_kinect2_pyramid_output(x);
+            t_atom_long pyramid_dim[2] = {DEPTH_WIDTH >> level, DEPTH_HEIGHT >> level};
+            jit_object_method(pyramid_matrix, _jit_sym_getinfo, &pyramid_minfo);
+            if (pyramid_minfo.dim[0] != pyramid_dim[0] || pyramid_minfo.dim[1] != pyramid_dim[1])
+                jit_attr_setlong_array(pyramid_matrix, _jit_sym_dim, 2, pyramid_dim);
+        }
+        //TA: likewise the batch matrix follows the batch size (it is not locked, its data is the window's)
+        ta_jit_kinect2_batch_update(x, batch_matrix);
+        ta_jit_kinect2_cloud_update(x);
+        
         rgb_savelock = (long) jit_object_method(rgb_matrix, _jit_sym_lock, 1);
         depth_savelock = (long) jit_object_method(depth_matrix, _jit_sym_lock, 1);
+        bigdepth_savelock = (long) jit_object_method(bigdepth_matrix, _jit_sym_lock, 1);
+        uv_savelock = (long) jit_object_method(uv_matrix, _jit_sym_lock, 1);
+        pyramid_savelock = (long) jit_object_method(pyramid_matrix, _jit_sym_lock, 1);
+        normals_savelock = (long) jit_object_method(normals_matrix, _jit_sym_lock, 1);
         
         jit_object_method(rgb_matrix, _jit_sym_getinfo, &rgb_minfo);
         jit_object_method(depth_matrix, _jit_sym_getinfo, &depth_minfo);
+        jit_object_method(bigdepth_matrix, _jit_sym_getinfo, &bigdepth_minfo);
+        jit_object_method(uv_matrix, _jit_sym_getinfo, &uv_minfo);
+        jit_object_method(pyramid_matrix, _jit_sym_getinfo, &pyramid_minfo);
+        jit_object_method(normals_matrix, _jit_sym_getinfo, &normals_minfo);
         
         jit_object_method(rgb_matrix, _jit_sym_getdata, &rgb_bp);
         jit_object_method(depth_matrix, _jit_sym_getdata, &depth_bp);
+        jit_object_method(bigdepth_matrix, _jit_sym_getdata, &bigdepth_bp);
+        jit_object_method(uv_matrix, _jit_sym_getdata, &uv_bp);
+        jit_object_method(pyramid_matrix, _jit_sym_getdata, &pyramid_bp);
+        jit_object_method(normals_matrix, _jit_sym_getdata, &normals_bp);
         
         if (!rgb_bp) {
             err=JIT_ERR_INVALID_INPUT;
             goto out;
         }
-        if (!depth_bp) {
+        if (!depth_bp || !bigdepth_bp || !uv_bp || !pyramid_bp || !normals_bp) {
             err=JIT_ERR_INVALID_OUTPUT;
             goto out;
         }
         
         /************************************************************************************/
-        if(x->isOpen){
-            x->listener->waitForNewFrame(*x->frame_map);
-            
-            ta_jit_kinect2_copy_rgbdata(x, rgb_minfo.dimcount, &rgb_minfo, rgb_bp);
-            ta_jit_kinect2_copy_depthdata(x, depth_minfo.dimcount, &depth_minfo, depth_bp);
-
+        // TA: never blocks: converts whatever the session has that is new
+        ta::Kinect2Session::FrameSet frames;
+        bool streaming = x->session->state() == ta::Kinect2Session::Streaming;
+        
+        x->updated = 0;
+        if(!streaming && x->output_mode != 1){ // TA: closed or reconnecting device keeps outputting the last good frames
+            x->updated = TA_KINECT2_UPDATED_DEPTH | TA_KINECT2_UPDATED_RGB;
+            if(x->bigdepth) x->updated |= TA_KINECT2_UPDATED_BIGDEPTH;
+            if(x->uvmap) x->updated |= TA_KINECT2_UPDATED_UVMAP;
+            if(x->pyramid) x->updated |= TA_KINECT2_UPDATED_PYRAMID;
+            if(x->normals) x->updated |= TA_KINECT2_UPDATED_NORMALS;
+            if(x->batch_window) x->updated |= TA_KINECT2_UPDATED_BATCH;
+            if(x->voxel > 0) x->updated |= TA_KINECT2_UPDATED_VOXELS;
+            if(x->heightmap) x->updated |= TA_KINECT2_UPDATED_HEIGHTMAP;
+            if(x->fusion_target) x->updated |= TA_KINECT2_UPDATED_FUSED;
+        }
+        if(streaming && x->session->acquire(frames)){
+            // TA: motion first, a still scene may suppress everything else (colour-only frames too)
+            if(x->motion && frames.products && (frames.products->valid & ta::DepthStage::Motion)){
+                ta_jit_kinect2_motion_report(x, frames.products);
+                x->updated |= TA_KINECT2_UPDATED_MOTION;
+            }
+            if(x->motion && x->motion_suppress && x->still){
+                x->session->release(frames);
+                goto out;
+            }
             
-            x->listener->release(*x->frame_map);
+            x->rgb_frame = frames.color;
+            x->depth_frame = frames.depth;
+            if(x->rgb_frame){
+                ta_jit_kinect2_copy_rgbdata(x, rgb_minfo.dimcount, &rgb_minfo, rgb_bp);
+                x->updated |= TA_KINECT2_UPDATED_RGB;
+            }
+            if(x->depth_frame){
+                ta_jit_kinect2_copy_depthdata(x, depth_minfo.dimcount, &depth_minfo, depth_bp);
+                x->updated |= TA_KINECT2_UPDATED_DEPTH;
+                if(x->batch_window){ // TA: one frame in, the matrix just moves along the window
+                    x->batch_window->push((const float *)x->depth_frame->data);
+                    jit_object_method(batch_matrix, _jit_sym_data, x->batch_window->window());
+                    x->updated |= TA_KINECT2_UPDATED_BATCH;
+                }
+            }
+            if(x->bigdepth && frames.products && (frames.products->valid & ta::DepthStage::BigDepth)){
+                ta_jit_kinect2_copy_bigdepthdata(frames.products->bigdepth, &bigdepth_minfo, bigdepth_bp);
+                x->updated |= TA_KINECT2_UPDATED_BIGDEPTH;
+            }
+            if(x->uvmap && frames.products && (frames.products->valid & ta::DepthStage::UvMap)){ // TA: only with a new depth frame
+                ta_jit_kinect2_copy_uvdata(frames.products->uv, &uv_minfo, uv_bp);
+                x->updated |= TA_KINECT2_UPDATED_UVMAP;
+            }
+            if(x->pyramid && frames.products && (frames.products->valid & ta::DepthStage::Pyramid)
+               && ta_jit_kinect2_pyramid_output(x) <= frames.products->pyramid_level){ // TA: not while a shallower pyramid is still in flight
+                long level = ta_jit_kinect2_pyramid_output(x);
+                ta_jit_kinect2_copy_pyramiddata(frames.products->pyramid[level - 1], level, &pyramid_minfo, pyramid_bp);
+                x->updated |= TA_KINECT2_UPDATED_PYRAMID;
+            }
+            if(x->normals && frames.products && (frames.products->valid & ta::DepthStage::Normals)){
+                ta_jit_kinect2_copy_normalsdata(frames.products->normals, &normals_minfo, normals_bp);
+                x->updated |= TA_KINECT2_UPDATED_NORMALS;
+            }
+            if(x->voxel > 0 && frames.products && (frames.products->valid & ta::DepthStage::Points)){
+                if(ta_jit_kinect2_voxel_output(x, frames.products, frames.taken_color, voxel_matrix))
+                    x->updated |= TA_KINECT2_UPDATED_VOXELS;
+            }
+            if(x->heightmap && frames.products && (frames.products->valid & ta::DepthStage::Points)){
+                ta_jit_kinect2_heightmap_output(x, frames.products, heightmap_matrix);
+                x->updated |= TA_KINECT2_UPDATED_HEIGHTMAP;
+            }
+            if(x->cloud_writer && frames.products && (frames.products->valid & ta::DepthStage::Points)){
+                ta_jit_kinect2_cloud_write(x, frames.products, frames.taken_color);
+            }
+            if(x->rgb_frame && x->depth_frame){
+                x->skew = frames.skew * 0.1f; // TA: device ticks are 0.1 ms
+            }
+            x->session->release(frames);
+        }
+        // TA: the other sensors contribute on their own, even while this one is closed
+        if(x->fusion_target && ta_jit_kinect2_fusion_output(x, fused_matrix)){
+            x->updated |= TA_KINECT2_UPDATED_FUSED;
         }
+        x->rgb_frame = NULL;
+        x->depth_frame = NULL;
         /************************************************************************************/
         
     }
@@ -275,94 +1301,346 @@ t_jit_err ta_jit_kinect2_matrix_calc(t_ta_jit_kinect2 *x, void *inputs, void *ou
         return JIT_ERR_INVALID_PTR;
     
 out:
+    jit_object_method(normals_matrix,_jit_sym_lock,normals_savelock);
+    jit_object_method(pyramid_matrix,_jit_sym_lock,pyramid_savelock);
+    jit_object_method(uv_matrix,_jit_sym_lock,uv_savelock);
+    jit_object_method(bigdepth_matrix,_jit_sym_lock,bigdepth_savelock);
     jit_object_method(depth_matrix,_jit_sym_lock,depth_savelock);
     jit_object_method(rgb_matrix,_jit_sym_lock,rgb_savelock);
     return err;
 }
 
 
-/*********************************RGB************************************************/
-void ta_jit_kinect2_looprgb(t_ta_jit_kinect2 *x, t_jit_op_info *out_opinfo, t_jit_matrix_info *out_minfo, char *bop)
+/************************************************************************************/
+//TA: jitter matrices seen as core matrix views, the conversions themselves live in frame_convert
+//    (one kernel per source format, element type and planecount, picked here once per matrix)
+static bool ta_jit_kinect2_view(t_jit_matrix_info *minfo, char *bp, ta::MatrixView &view)
 {
-    long xPos, yPos;
-    
-    libfreenect2::Frame *rgb_frame = (*x->frame_map)[libfreenect2::Frame::Color];
+    if (minfo->dimcount < 2 || !bp)
+        return false; // safety
     
-    char *frame_data = (char *)rgb_frame->data;
-    out_opinfo->p = bop;
-    char *op;
-    op = (char *)out_opinfo->p;
-    char *aPos;
+    if (minfo->type == _jit_sym_char) view.type = ta::ElementChar;
+    else if (minfo->type == _jit_sym_long) view.type = ta::ElementLong;
+    else if (minfo->type == _jit_sym_float32) view.type = ta::ElementFloat32;
+    else if (minfo->type == _jit_sym_float64) view.type = ta::ElementFloat64;
+    else return false;
     
-    for(yPos = 0; yPos < RGB_HEIGHT; yPos++){
-        for(xPos = 0; xPos < RGB_WIDTH; xPos++){
-            aPos = frame_data + 3;
-            
-            //TA: alpha
-            *op = *aPos;
-            op++;
-            aPos--;
-            frame_data++;
-            //TA: red
-            *op = *aPos;
-            op++;
-            aPos--;
-            frame_data++;
-            //TA: green
-            *op = *aPos;
-            op++;
-            aPos--;
-            frame_data++;
-            //TA: blue
-            *op = *aPos;
-            op++;
-            aPos--;
-            frame_data++;
-        }
-    }
+    view.data = bp;
+    view.width = (int)minfo->dim[0];
+    view.height = (int)minfo->dim[1];
+    view.planes = (int)minfo->planecount;
+    view.stride = minfo->dimstride[1];
+    return true;
 }
 
+/*********************************RGB************************************************/
 void ta_jit_kinect2_copy_rgbdata(t_ta_jit_kinect2 *x, long dimcount, t_jit_matrix_info *out_minfo, char *bop)
 {
-    t_jit_op_info	out_opinfo;
+    libfreenect2::Frame *rgb_frame = x->rgb_frame;
+    ta::MatrixView out;
     
-    if (dimcount < 1)
+    if (dimcount < 1 || !ta_jit_kinect2_view(out_minfo, bop, out))
         return; // safety
     //else:
-    ta_jit_kinect2_looprgb(x, &out_opinfo, out_minfo, bop);
+    ta::convertColor(ta::ImageView<const unsigned char>::packed(rgb_frame->data, (int)rgb_frame->width, (int)rgb_frame->height, (int)rgb_frame->bytes_per_pixel), out);
 }
 
 /********************************DEPTH***********************************************/
-void ta_jit_kinect2_loopdepth(t_ta_jit_kinect2 *x, t_jit_op_info *out_opinfo, t_jit_matrix_info *out_minfo, char *bop)
+void ta_jit_kinect2_copy_depthdata(t_ta_jit_kinect2 *x, long dimcount, t_jit_matrix_info *out_minfo, char *bop)
+{
+    libfreenect2::Frame *depth_frame = x->depth_frame;
+    ta::MatrixView out;
+    
+    if (dimcount < 1 || !ta_jit_kinect2_view(out_minfo, bop, out))
+        return; // safety
+    // else:
+    ta::convertFloat(ta::ImageView<const float>::packed((const float *)depth_frame->data, (int)depth_frame->width, (int)depth_frame->height, 1),
+                     TA_KINECT2_DEPTH_CHAR_SCALE, out);
+}
+
+/*******************************BIGDEPTH*********************************************/
+void ta_jit_kinect2_copy_bigdepthdata(const float *bigdepth, t_jit_matrix_info *out_minfo, char *bop)
+{
+    ta::MatrixView out;
+    
+    if (ta_jit_kinect2_view(out_minfo, bop, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(bigdepth, RGB_WIDTH, BIGDEPTH_HEIGHT, 1), TA_KINECT2_DEPTH_CHAR_SCALE, out);
+}
+
+/*******************************UVMAP************************************************/
+//TA: 2 planes (colour x, colour y), interleaved like the jitter matrix cells
+void ta_jit_kinect2_copy_uvdata(const float *uv, t_jit_matrix_info *out_minfo, char *bop)
+{
+    ta::MatrixView out;
+    
+    if (ta_jit_kinect2_view(out_minfo, bop, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(uv, DEPTH_WIDTH, DEPTH_HEIGHT, 2), TA_KINECT2_UV_CHAR_SCALE, out);
+}
+
+/*******************************PYRAMID**********************************************/
+//TA: the level on the outlet: pyramid_output if it is one of the computed levels, else the deepest
+long ta_jit_kinect2_pyramid_output(t_ta_jit_kinect2 *x)
+{
+    return x->pyramid_output > 0 && x->pyramid_output < x->pyramid ? x->pyramid_output : x->pyramid;
+}
+
+void ta_jit_kinect2_copy_pyramiddata(const float *pyramid, long level, t_jit_matrix_info *out_minfo, char *bop)
+{
+    ta::MatrixView out;
+    
+    if (ta_jit_kinect2_view(out_minfo, bop, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(pyramid, DEPTH_WIDTH >> level, DEPTH_HEIGHT >> level, 1), TA_KINECT2_DEPTH_CHAR_SCALE, out);
+}
+
+/*******************************NORMALS**********************************************/
+//TA: 3 planes (x, y, z) in the depth camera frame, facing the camera (z < 0); char maps -1..1 to 0..255
+void ta_jit_kinect2_copy_normalsdata(const float *normals, t_jit_matrix_info *out_minfo, char *bop)
 {
-    long xPos, yPos;
-    
-    libfreenect2::Frame *depth_frame = (*x->frame_map)[libfreenect2::Frame::Depth];
-    
-    float *frame_data = (float *)depth_frame->data;
-    out_opinfo->p = bop;
-    float *op;
-    op = (float *)out_opinfo->p;
-    float value;
-    
-    for(yPos = 0; yPos < DEPTH_HEIGHT; yPos++){
-        for(xPos = 0; xPos < DEPTH_WIDTH; xPos++){
-            value = *frame_data;
-            *op = value;
-            op++;
-            frame_data++;
+    ta::MatrixView out;
+    
+    if (ta_jit_kinect2_view(out_minfo, bop, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(normals, DEPTH_WIDTH, DEPTH_HEIGHT, 3), 127.5f, 127.5f, out);
+}
+
+/*******************************MOTION***********************************************/
+//TA: "motion <activity> <tile>..." for dumpout, tile = row * 32 + column of the 16x16 tiles
+void ta_jit_kinect2_motion_report(t_ta_jit_kinect2 *x, const ta::DepthProducts *products)
+{
+    t_atom *av = x->motion_atoms;
+    
+    jit_atom_setfloat(av, products->activity);
+    for (int i = 0; i < products->changed_count; i++)
+        jit_atom_setlong(av + 1 + i, products->changed[i]);
+    x->motion_atomcount = 1 + products->changed_count;
+    x->activity = products->activity;
+    x->still = products->changed_count == 0;
+}
+
+/*******************************BATCH************************************************/
+//TA: points the batch matrix at the window (512x424xN float32, tightly packed, not owned by the
+//    matrix), or gives it its own data back before the window goes when batch is turned off. Called
+//    by every matrix_calc: anything sent to the outlet since (type, planecount, dim) is undone here
+void ta_jit_kinect2_batch_update(t_ta_jit_kinect2 *x, void *batch_matrix)
+{
+    t_jit_matrix_info info;
+    
+    if (x->batch && (!x->batch_window || x->batch_window->frames() != x->batch)) {
+        ta::FrameWindow *old = x->batch_window;
+        x->batch_window = new ta::FrameWindow(DEPTH_WIDTH * DEPTH_HEIGHT, (int)x->batch);
+        if (old) { // TA: a new size keeps the newest frames
+            int keep = old->count() < x->batch ? old->count() : (int)x->batch;
+            for (int i = old->frames() - keep; i < old->frames(); i++)
+                x->batch_window->push(old->window() + (size_t)i * old->frameSize());
+        }
+        jit_object_method(batch_matrix, _jit_sym_data, x->batch_window->window());
+        delete old;
+    }
+    if (x->batch_window && x->batch) {
+        jit_object_method(batch_matrix, _jit_sym_getinfo, &info);
+        if (info.type != _jit_sym_float32 || info.planecount != 1 || info.dimcount != 3 || info.dim[0] != DEPTH_WIDTH ||
+            info.dim[1] != DEPTH_HEIGHT || info.dim[2] != x->batch || !(info.flags & JIT_MATRIX_DATA_REFERENCE)) {
+            jit_matrix_info_default(&info);
+            info.type = _jit_sym_float32;
+            info.planecount = 1;
+            info.dimcount = 3;
+            info.dim[0] = DEPTH_WIDTH;
+            info.dim[1] = DEPTH_HEIGHT;
+            info.dim[2] = x->batch;
+            info.flags = JIT_MATRIX_DATA_REFERENCE | JIT_MATRIX_DATA_PACK_TIGHT | JIT_MATRIX_DATA_FLAGS_USE;
+            jit_object_method(batch_matrix, _jit_sym_setinfo_ex, &info);
         }
+        jit_object_method(batch_matrix, _jit_sym_data, x->batch_window->window());
+    }
+    else if (x->batch_window) {
+        jit_matrix_info_default(&info);
+        info.type = _jit_sym_float32;
+        info.planecount = 1;
+        info.dimcount = 2;
+        info.dim[0] = DEPTH_WIDTH;
+        info.dim[1] = DEPTH_HEIGHT;
+        jit_object_method(batch_matrix, _jit_sym_setinfo_ex, &info);
+        delete x->batch_window;
+        x->batch_window = NULL;
     }
 }
 
+/*******************************VOXELS***********************************************/
+//TA: the point cloud thinned to one point per voxel: N x 1 cells of x, y, z (m), r, g, b (0..1), in
+//    the depth camera frame. Colour comes from the newest colour frame, new in this frame set or not
+//    (0 before the first one). The matrix is not locked with the others: its dim follows N. Nothing is
+//    output for an empty cloud.
+bool ta_jit_kinect2_voxel_output(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, libfreenect2::Frame *color, void *voxel_matrix)
+{
+    t_jit_matrix_info info;
+    char *bp = NULL;
+    ta::MatrixView out;
+    ta::ImageView<const unsigned char> bgrx;
+    
+    if (!x->voxel_grid) {
+        x->voxel_grid = new ta::VoxelGrid(ta::RowPool::defaultThreads());
+        ta_jit_kinect2_worker_policy(x);
+    }
+    if (color)
+        bgrx = ta::ImageView<const unsigned char>::packed(color->data, (int)color->width, (int)color->height, 4);
+    
+    int count = x->voxel_grid->build(products->points, DEPTH_WIDTH, DEPTH_HEIGHT, x->voxel,
+                                     (products->valid & ta::DepthStage::UvMap) ? products->uv : NULL, bgrx);
+    x->voxel_dropped = (long)x->voxel_grid->dropped();
+    if (!count)
+        return false;
+    
+    jit_object_method(voxel_matrix, _jit_sym_getinfo, &info);
+    if (info.dimcount != 2 || info.dim[0] != count || info.dim[1] != 1) {
+        t_atom_long dim[2] = {count, 1};
+        jit_attr_setlong_array(voxel_matrix, _jit_sym_dim, 2, dim);
+    }
+    
+    long savelock = (long) jit_object_method(voxel_matrix, _jit_sym_lock, 1);
+    jit_object_method(voxel_matrix, _jit_sym_getinfo, &info);
+    jit_object_method(voxel_matrix, _jit_sym_getdata, &bp);
+    if (ta_jit_kinect2_view(&info, bp, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(x->voxel_grid->voxels(), count, 1, ta::VoxelGrid::Planes), 255.0f, out);
+    jit_object_method(voxel_matrix, _jit_sym_lock, savelock);
+    return true;
+}
 
-void ta_jit_kinect2_copy_depthdata(t_ta_jit_kinect2 *x, long dimcount, t_jit_matrix_info *out_minfo, char *bop)
+/*******************************CLOUD RECORDING***********************************************/
+//TA: starts and stops recording as write_cloud changes. Stopping waits for the (at most two) staged
+//    clouds to be written; a path that cannot be opened turns write_cloud off again.
+void ta_jit_kinect2_cloud_update(t_ta_jit_kinect2 *x)
 {
-    t_jit_op_info	out_opinfo;
+    char native[MAX_PATH_CHARS];
     
-    if (dimcount < 1)
-        return; // safety
-    // else:
-    ta_jit_kinect2_loopdepth(x, &out_opinfo, out_minfo, bop);
+    if (!x->write_cloud) {
+        if (x->cloud_writer) {
+            delete x->cloud_writer;
+            x->cloud_writer = NULL;
+            post("ta.jit.kinect2: %ld point clouds written, %ld dropped", x->write_cloud_written, x->write_cloud_dropped);
+        }
+        return;
+    }
+    if (x->cloud_writer)
+        return;
+    
+    if (!x->write_cloud_path || !*x->write_cloud_path->s_name) {
+        error("ta.jit.kinect2: write_cloud needs a write_cloud_path");
+        jit_attr_setlong(x, gensym("write_cloud"), 0); // TA: through the setter, the points are no longer needed
+        return;
+    }
+    if (path_nameconform(x->write_cloud_path->s_name, native, PATH_STYLE_NATIVE, PATH_TYPE_BOOT))
+        strncpy_zero(native, x->write_cloud_path->s_name, MAX_PATH_CHARS);
+    
+    x->cloud_writer = new ta::CloudWriter(native, (int)x->write_cloud, x->write_cloud_depth ? ta::CloudWriter::DepthRecord : 0);
+    if (!x->cloud_writer->ok()) {
+        error("ta.jit.kinect2: %s", x->cloud_writer->error().c_str());
+        delete x->cloud_writer;
+        x->cloud_writer = NULL;
+        jit_attr_setlong(x, gensym("write_cloud"), 0);
+        return;
+    }
+    x->write_cloud_written = 0;
+    x->write_cloud_dropped = 0;
+}
+
+//TA: hands the frame's point cloud (and the newest colour frame, new in this frame set or not) to the
+//    writer, which packs it and returns; the file I/O happens on the writer's own thread. With a uv map
+//    every point carries colour (black before the first colour frame), so a recording keeps one layout.
+//    A write error stops recording.
+void ta_jit_kinect2_cloud_write(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, libfreenect2::Frame *color)
+{
+    ta::ImageView<const unsigned char> bgrx;
+    
+    if (color)
+        bgrx = ta::ImageView<const unsigned char>::packed(color->data, (int)color->width, (int)color->height, 4);
+    x->cloud_writer->submit(products->points, DEPTH_WIDTH, DEPTH_HEIGHT,
+                            (products->valid & ta::DepthStage::UvMap) ? products->uv : NULL, bgrx,
+                            products->sequence, x->depth_frame ? x->depth_frame->timestamp : 0,
+                            x->depth_frame ? (const float *)x->depth_frame->data : NULL);
+    x->write_cloud_written = (long)x->cloud_writer->written();
+    x->write_cloud_dropped = (long)x->cloud_writer->dropped();
+    
+    std::string message = x->cloud_writer->error();
+    if (!message.empty()) {
+        error("ta.jit.kinect2: %s", message.c_str());
+        jit_attr_setlong(x, gensym("write_cloud"), 0); // TA: the next matrix_calc closes the file
+    }
+}
+
+/*******************************HEIGHT MAP***********************************************/
+//TA: the point cloud seen from above through heightmap_transform. The matrix is not locked with the
+//    others: its dim follows heightmap_dim. char: height in cm (up to 2.55 m) or points, saturated.
+void ta_jit_kinect2_heightmap_output(t_ta_jit_kinect2 *x, const ta::DepthProducts *products, void *heightmap_matrix)
+{
+    t_jit_matrix_info info;
+    char *bp = NULL;
+    ta::MatrixView out;
+    
+    if (!x->height_map) {
+        x->height_map = new ta::HeightMap(ta::RowPool::defaultThreads());
+        ta_jit_kinect2_worker_policy(x);
+    }
+    x->height_map->build(products->points, DEPTH_WIDTH, DEPTH_HEIGHT, x->heightmap_transform, x->heightmap_cell,
+                         (int)x->heightmap_dim[0], (int)x->heightmap_dim[1], (int)x->heightmap,
+                         x->heightmap_range[0], x->heightmap_range[1]);
+    int width = x->height_map->gridWidth();
+    int height = x->height_map->gridHeight();
+    
+    jit_object_method(heightmap_matrix, _jit_sym_getinfo, &info);
+    if (info.dimcount != 2 || info.dim[0] != width || info.dim[1] != height) {
+        t_atom_long dim[2] = {width, height};
+        jit_attr_setlong_array(heightmap_matrix, _jit_sym_dim, 2, dim);
+    }
+    
+    long savelock = (long) jit_object_method(heightmap_matrix, _jit_sym_lock, 1);
+    jit_object_method(heightmap_matrix, _jit_sym_getinfo, &info);
+    jit_object_method(heightmap_matrix, _jit_sym_getdata, &bp);
+    if (ta_jit_kinect2_view(&info, bp, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(x->height_map->grid(), width, height, 1),
+                         x->heightmap == ta::HeightMap::HitCount ? 1.0f : 100.0f, out);
+    jit_object_method(heightmap_matrix, _jit_sym_lock, savelock);
+}
+
+/*******************************FUSION***********************************************/
+//TA: no more contributions from this sensor (the session waits for one in progress), then leave
+void ta_jit_kinect2_fusion_leave(t_ta_jit_kinect2 *x)
+{
+    if (!x->fusion_target)
+        return;
+    if (x->session)
+        x->session->setFusion(NULL, -1);
+    x->fusion_target->leave(x->fusion_sensor);
+    ta::FusionTarget::detach(x->fusion_target);
+    x->fusion_target = NULL;
+    x->fusion_sensor = -1;
+    x->fusion_sensors = 0;
 }
 
+//TA: the clouds of every sensor in the target, in the shared frame: N x 1 cells of x, y, z (m), sensor
+//    slot. Only when some sensor contributed since the last one; nothing is output for an empty cloud.
+bool ta_jit_kinect2_fusion_output(t_ta_jit_kinect2 *x, void *fused_matrix)
+{
+    t_jit_matrix_info info;
+    char *bp = NULL;
+    ta::MatrixView out;
+    
+    if (!x->fusion_target->merge(*x->fusion_cloud, x->fusion_window > 0 ? (int)x->fusion_window : 0))
+        return false;
+    x->fusion_sensors = x->fusion_cloud->sensors;
+    int count = x->fusion_cloud->count;
+    if (!count)
+        return false;
+    
+    jit_object_method(fused_matrix, _jit_sym_getinfo, &info);
+    if (info.dimcount != 2 || info.dim[0] != count || info.dim[1] != 1) {
+        t_atom_long dim[2] = {count, 1};
+        jit_attr_setlong_array(fused_matrix, _jit_sym_dim, 2, dim);
+    }
+    
+    long savelock = (long) jit_object_method(fused_matrix, _jit_sym_lock, 1);
+    jit_object_method(fused_matrix, _jit_sym_getinfo, &info);
+    jit_object_method(fused_matrix, _jit_sym_getdata, &bp);
+    if (ta_jit_kinect2_view(&info, bp, out))
+        ta::convertFloat(ta::ImageView<const float>::packed(&x->fusion_cloud->points[0], count, 1, ta::FusionTarget::Planes), 1.0f, out);
+    jit_object_method(fused_matrix, _jit_sym_lock, savelock);
+    return true;
+}
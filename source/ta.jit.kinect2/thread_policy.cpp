@@ -0,0 +1,113 @@
+/**
+ @file
+ thread_policy - pins threads to cores and raises their scheduling priority
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "thread_policy.h"
+
+#include <cstring>
+#include <sched.h>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#endif
+
+namespace ta
+{
+
+namespace
+{
+
+bool applyAffinity(pthread_t thread, uint64_t cpus, std::string &error)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+        if (cpus & ((uint64_t)1 << i))
+            CPU_SET(i, &set);
+    }
+    int result = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (result) {
+        error = std::string("affinity: ") + strerror(result);
+        return false;
+    }
+    return true;
+#elif defined(__APPLE__)
+    // no pinning on the Mac: the same tag for the same cores keeps them together
+    int first = 0;
+    while (!(cpus & ((uint64_t)1 << first)))
+        first++;
+    thread_affinity_policy_data_t tag = { first + 1 };
+    if (thread_policy_set(pthread_mach_thread_np(thread), THREAD_AFFINITY_POLICY, (thread_policy_t)&tag, THREAD_AFFINITY_POLICY_COUNT) != KERN_SUCCESS) {
+        error = "affinity: not supported";
+        return false;
+    }
+    return true;
+#else
+    (void)thread;
+    (void)cpus;
+    error = "affinity: not supported";
+    return false;
+#endif
+}
+
+bool applyPriority(pthread_t thread, int priority, std::string &error)
+{
+    const int lowest = sched_get_priority_min(SCHED_FIFO);
+    const int highest = sched_get_priority_max(SCHED_FIFO);
+    sched_param param;
+    std::memset(&param, 0, sizeof(param));
+    param.sched_priority = priority < lowest ? lowest : priority > highest ? highest : priority;
+    int result = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (result) {
+        error = std::string("SCHED_FIFO: ") + strerror(result);
+        return false;
+    }
+    return true;
+}
+
+}
+
+bool applyThreadPolicy(pthread_t thread, const ThreadPolicy &policy, std::string &error)
+{
+    bool ok = true;
+    std::string why;
+    if (policy.cpus && !applyAffinity(thread, policy.cpus, why)) {
+        error = why;
+        ok = false;
+    }
+    if (policy.priority > 0 && !applyPriority(thread, policy.priority, why)) {
+        error = ok ? why : error + ", " + why;
+        ok = false;
+    }
+    return ok;
+}
+
+void DeferredThreadPolicy::set(const ThreadPolicy &policy)
+{
+    policy_ = policy;
+    pending_.store(!policy.isDefault());
+}
+
+void DeferredThreadPolicy::apply()
+{
+    // a relaxed look first: this sits on a per-packet path
+    if (!pending_.load(std::memory_order_relaxed) || !pending_.exchange(false))
+        return;
+    if (!applyThreadPolicy(pthread_self(), policy_, error_))
+        failed_.store(true);
+}
+
+bool DeferredThreadPolicy::failed(std::string &error)
+{
+    if (!failed_.load(std::memory_order_relaxed) || !failed_.exchange(false))
+        return false;
+    error = error_;
+    return true;
+}
+
+} // namespace ta
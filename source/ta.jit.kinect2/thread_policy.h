@@ -0,0 +1,63 @@
+/**
+ @file
+ thread_policy - pins threads to cores and raises their scheduling priority
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_THREAD_POLICY_H
+#define TA_THREAD_POLICY_H
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+namespace ta
+{
+
+// Linux: the affinity is a hard pin (pthread_setaffinity_np), the priority
+// SCHED_FIFO, which needs CAP_SYS_NICE or an rtprio limit. Mac: there is no
+// pinning, threads with the same cores get the same affinity tag (a hint
+// to share an L2) and SCHED_FIFO is allowed. Refusals are reported, the
+// thread then just keeps running as it was. Needs no Max and no libfreenect2.
+struct ThreadPolicy
+{
+    ThreadPolicy() : cpus(0), priority(0) {}
+
+    uint64_t cpus; // bit n = core n, 0 = any core
+    int priority;  // 0 = as created, 1 .. 99 = SCHED_FIFO at that priority (clamped to what the system allows)
+
+    bool isDefault() const { return !cpus && !priority; }
+};
+
+// false and why if the system refused (any part of it)
+bool applyThreadPolicy(pthread_t thread, const ThreadPolicy &policy, std::string &error);
+
+// For threads that are not ours (libfreenect2's), reachable only from their
+// callbacks: set() before the thread calls, the first apply() from it applies.
+// That thread has nobody to tell about a refusal, so it is kept for whoever
+// set the policy to pick up with failed().
+class DeferredThreadPolicy
+{
+public:
+    DeferredThreadPolicy() : pending_(false), failed_(false) {}
+
+    void set(const ThreadPolicy &policy);
+
+    // from the thread itself
+    void apply();
+
+    // true once, with why, after apply() was refused
+    bool failed(std::string &error);
+
+private:
+    ThreadPolicy policy_;
+    std::atomic<bool> pending_;
+    std::string error_; // written before failed_ is set, read after it is taken
+    std::atomic<bool> failed_;
+};
+
+} // namespace ta
+
+#endif // TA_THREAD_POLICY_H
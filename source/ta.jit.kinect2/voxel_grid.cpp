@@ -0,0 +1,189 @@
+/**
+ @file
+ voxel_grid - thins a point cloud to one averaged point per occupied voxel,
+ with bounded memory
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "voxel_grid.h"
+
+#define TA_VOXEL_EMPTY (~(uint64_t)0)
+#define TA_VOXEL_COORD_BITS 21 // per axis, +-2^20 voxels (1 km at 1 mm)
+
+namespace ta
+{
+
+namespace
+{
+
+inline uint64_t voxelKey(float x, float y, float z, float inv_size)
+{
+    const int half = 1 << (TA_VOXEL_COORD_BITS - 1);
+    const float limit = (float)(half - 1);
+    float c[3] = { x * inv_size, y * inv_size, z * inv_size };
+    uint64_t key = 0;
+    for (int i = 0; i < 3; i++) {
+        float v = c[i] > -limit ? (c[i] < limit ? c[i] : limit) : -limit;
+        int cell = (int)v;
+        cell -= v < (float)cell; // floor without a libm call
+        key = (key << TA_VOXEL_COORD_BITS) | (uint64_t)(uint32_t)(cell + half);
+    }
+    return key; // below 2^63, never TA_VOXEL_EMPTY
+}
+
+}
+
+VoxelGrid::VoxelGrid(size_t num_threads, int capacity) :
+    pool_(num_threads),
+    capacity_(16),
+    count_(0),
+    dropped_(0)
+{
+    while (capacity_ < capacity)
+        capacity_ <<= 1;
+
+    Cell empty;
+    empty.key = TA_VOXEL_EMPTY;
+    for (int i = 0; i < Planes; i++)
+        empty.sum[i] = 0.0f;
+    empty.count = 0;
+    empty.colour_count = 0;
+
+    bands_.resize(pool_.numThreads());
+    for (size_t i = 0; i < bands_.size(); i++) {
+        bands_[i].cells.assign(capacity_, empty);
+        bands_[i].used.reserve(capacity_ / 2);
+        bands_[i].dropped = 0;
+    }
+    merged_.cells.assign(capacity_, empty);
+    merged_.used.reserve(capacity_ / 2);
+    merged_.dropped = 0;
+    output_.resize((size_t)capacity_ / 2 * Planes);
+}
+
+VoxelGrid::Cell *VoxelGrid::find(Table &table, uint64_t key, int capacity)
+{
+    // Fibonacci hashing, linear probing; a table is never more than half full
+    const uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t i = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    for (;;) {
+        Cell &cell = table.cells[i];
+        if (cell.key == key)
+            return &cell;
+        if (cell.key == TA_VOXEL_EMPTY) {
+            if ((int)table.used.size() >= capacity / 2)
+                return 0;
+            cell.key = key;
+            table.used.push_back(i);
+            return &cell;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+void VoxelGrid::bandRows(Table &table, const float *points, int width, int first, int end, float inv_size,
+                         const float *uv, const ImageView<const unsigned char> &bgrx)
+{
+    const bool colour = uv && bgrx.data;
+    const float byte = 1.0f / 255.0f;
+
+    for (int y = first; y < end; y++) {
+        const float *p = points + (size_t)y * width * 3;
+        const float *c = colour ? uv + (size_t)y * width * 2 : 0;
+        // neighbouring pixels mostly share a voxel: skip the lookup then
+        uint64_t last_key = TA_VOXEL_EMPTY;
+        Cell *cell = 0;
+        for (int x = 0; x < width; x++, p += 3) {
+            if (!(p[2] > 0.0f))
+                continue; // no depth (NaN too)
+            const uint64_t key = voxelKey(p[0], p[1], p[2], inv_size);
+            if (key != last_key) {
+                cell = find(table, key, capacity_);
+                last_key = key;
+            }
+            if (!cell) {
+                table.dropped++;
+                continue;
+            }
+            cell->sum[0] += p[0];
+            cell->sum[1] += p[1];
+            cell->sum[2] += p[2];
+            cell->count++;
+            if (colour && c[2 * x] >= 0.0f) {
+                const int cx = (int)(c[2 * x] + 0.5f);
+                const int cy = (int)(c[2 * x + 1] + 0.5f);
+                if (cx < bgrx.width && cy >= 0 && cy < bgrx.height) {
+                    const unsigned char *bgr = bgrx.row(cy) + 4 * cx;
+                    cell->sum[3] += bgr[2] * byte;
+                    cell->sum[4] += bgr[1] * byte;
+                    cell->sum[5] += bgr[0] * byte;
+                    cell->colour_count++;
+                }
+            }
+        }
+    }
+}
+
+int VoxelGrid::build(const float *points, int width, int height, float voxel_size,
+                     const float *uv, const ImageView<const unsigned char> &bgrx)
+{
+    count_ = 0;
+    dropped_ = 0;
+    if (!points || !(voxel_size > 0.0f))
+        return 0;
+    const float inv_size = 1.0f / voxel_size;
+
+    // one table per band: each "row" of the pool job is a band of image rows
+    const int bands = (int)bands_.size();
+    pool_.run([this, points, width, height, inv_size, uv, &bgrx, bands](int first, int end) {
+        for (int b = first; b < end; b++)
+            bandRows(bands_[b], points, width, height * b / bands, height * (b + 1) / bands, inv_size, uv, bgrx);
+    }, bands);
+
+    // merge and clear the band tables (only the cells they used)
+    for (int b = 0; b < bands; b++) {
+        Table &band = bands_[b];
+        dropped_ += band.dropped;
+        band.dropped = 0;
+        for (size_t i = 0; i < band.used.size(); i++) {
+            Cell &cell = band.cells[band.used[i]];
+            Cell *into = find(merged_, cell.key, capacity_);
+            if (into) {
+                for (int k = 0; k < Planes; k++)
+                    into->sum[k] += cell.sum[k];
+                into->count += cell.count;
+                into->colour_count += cell.colour_count;
+            }
+            else {
+                dropped_ += cell.count;
+            }
+            cell.key = TA_VOXEL_EMPTY;
+            for (int k = 0; k < Planes; k++)
+                cell.sum[k] = 0.0f;
+            cell.count = 0;
+            cell.colour_count = 0;
+        }
+        band.used.clear();
+    }
+
+    // centroids; the colour is averaged over the points that had one (0 if none did)
+    float *out = &output_[0];
+    for (size_t i = 0; i < merged_.used.size(); i++, out += Planes) {
+        Cell &cell = merged_.cells[merged_.used[i]];
+        const float inv = 1.0f / cell.count;
+        const float inv_colour = cell.colour_count ? 1.0f / cell.colour_count : 0.0f;
+        for (int k = 0; k < Planes; k++) {
+            out[k] = cell.sum[k] * (k < 3 ? inv : inv_colour);
+            cell.sum[k] = 0.0f;
+        }
+        cell.key = TA_VOXEL_EMPTY;
+        cell.count = 0;
+        cell.colour_count = 0;
+    }
+    count_ = (int)merged_.used.size();
+    merged_.used.clear();
+    return count_;
+}
+
+} // namespace ta
@@ -0,0 +1,92 @@
+/**
+ @file
+ voxel_grid - thins a point cloud to one averaged point per occupied voxel,
+ with bounded memory
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_VOXEL_GRID_H
+#define TA_VOXEL_GRID_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "frame_convert.h"
+#include "row_pool.h"
+
+namespace ta
+{
+
+// Every band of rows hashes its points into a table of its own (open
+// addressing, keyed by voxel coordinates), summing position and colour;
+// the band tables are then merged into one and every voxel becomes its
+// centroid and the mean colour of those of its points that had one.
+// Tables never grow: a point whose voxel finds no room is dropped and
+// counted, so a frame costs the same memory whatever the scene and voxel
+// size. Needs no Max and no libfreenect2.
+class VoxelGrid
+{
+public:
+    enum
+    {
+        Planes = 6, // x, y, z (as the input), r, g, b (0..1)
+        DefaultCapacity = 1 << 16
+    };
+
+    // capacity: table slots, at most half of them become voxels
+    VoxelGrid(size_t num_threads, int capacity = DefaultCapacity);
+
+    // points: width x height x 3 (0 z = no point). uv (width x height x 2,
+    // colour pixel, -1 = none) and bgrx are optional, without them the colour
+    // is 0. Returns the number of voxels.
+    int build(const float *points, int width, int height, float voxel_size,
+              const float *uv = 0, const ImageView<const unsigned char> &bgrx = ImageView<const unsigned char>());
+
+    // count() x Planes floats, valid until the next build()
+    const float *voxels() const { return &output_[0]; }
+    int count() const { return count_; }
+
+    // points that found no room in the last build()
+    unsigned long dropped() const { return dropped_; }
+
+    int capacity() const { return capacity_; }
+
+    // the worker threads of its RowPool, false and why if refused
+    bool setThreadPolicy(const ThreadPolicy &policy, std::string &error) { return pool_.setThreadPolicy(policy, error); }
+
+private:
+    struct Cell
+    {
+        uint64_t key;
+        float sum[Planes];
+        uint32_t count;
+        uint32_t colour_count; // points that added to the colour sums
+    };
+
+    struct Table
+    {
+        std::vector<Cell> cells;
+        std::vector<uint32_t> used; // cells taken, to merge and clear just those
+        unsigned long dropped;
+    };
+
+    VoxelGrid(const VoxelGrid &);
+    VoxelGrid &operator=(const VoxelGrid &);
+
+    void bandRows(Table &table, const float *points, int width, int first, int end, float inv_size,
+                  const float *uv, const ImageView<const unsigned char> &bgrx);
+    static Cell *find(Table &table, uint64_t key, int capacity);
+
+    RowPool pool_;
+    int capacity_;
+    std::vector<Table> bands_;
+    Table merged_;
+    std::vector<float> output_;
+    int count_;
+    unsigned long dropped_;
+};
+
+} // namespace ta
+
+#endif // TA_VOXEL_GRID_H
@@ -0,0 +1,66 @@
+/**
+ @file
+ watchdog_frame_listener - forwards frames to the session's listeners and
+ remembers when each stream last delivered one
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "watchdog_frame_listener.h"
+
+#include <chrono>
+
+namespace ta
+{
+
+WatchdogFrameListener::WatchdogFrameListener(libfreenect2::FrameListener *color, libfreenect2::FrameListener *depth) :
+    color_(color),
+    depth_(depth)
+{
+    reset();
+}
+
+int64_t WatchdogFrameListener::now()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void WatchdogFrameListener::reset()
+{
+    int64_t t = now();
+    last_color_.store(t);
+    last_depth_.store(t);
+    color_started_.store(false);
+    depth_started_.store(false);
+}
+
+bool WatchdogFrameListener::onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame)
+{
+    if (type == libfreenect2::Frame::Color) {
+        last_color_.store(now());
+        color_started_.store(true);
+        return color_->onNewFrame(type, frame);
+    }
+
+    if (type == libfreenect2::Frame::Depth) {
+        last_depth_.store(now());
+        depth_started_.store(true);
+    }
+    return depth_->onNewFrame(type, frame);
+}
+
+bool WatchdogFrameListener::started() const
+{
+    return color_started_.load() && depth_started_.load();
+}
+
+int64_t WatchdogFrameListener::silence() const
+{
+    int64_t oldest = last_color_.load();
+    int64_t depth = last_depth_.load();
+    if (depth < oldest)
+        oldest = depth;
+    return now() - oldest;
+}
+
+} // namespace ta
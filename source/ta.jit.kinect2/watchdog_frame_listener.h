@@ -0,0 +1,54 @@
+/**
+ @file
+ watchdog_frame_listener - forwards frames to the session's listeners and
+ remembers when each stream last delivered one
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#ifndef TA_WATCHDOG_FRAME_LISTENER_H
+#define TA_WATCHDOG_FRAME_LISTENER_H
+
+#include <atomic>
+#include <stdint.h>
+
+#include <frame_listener.hpp>
+
+namespace ta
+{
+
+// Sits between the device and the real listeners (colour frames go to one,
+// IR/depth to the other, which may be the same object). Every colour and
+// depth arrival is stamped with a monotonic clock, so the session thread can
+// tell a device that stopped streaming (cable pulled, USB reset) from one that
+// is just slow. Ownership is whatever the real listener decides.
+class WatchdogFrameListener : public libfreenect2::FrameListener
+{
+public:
+    WatchdogFrameListener(libfreenect2::FrameListener *color, libfreenect2::FrameListener *depth);
+
+    virtual bool onNewFrame(libfreenect2::Frame::Type type, libfreenect2::Frame *frame);
+
+    // restarts both clocks, call right before the device is started
+    void reset();
+
+    // true once both colour and depth have delivered since reset()
+    bool started() const;
+
+    // milliseconds since the quieter of the two streams delivered a frame
+    int64_t silence() const;
+
+    static int64_t now(); // monotonic, ms
+
+private:
+    libfreenect2::FrameListener *color_;
+    libfreenect2::FrameListener *depth_;
+    std::atomic<int64_t> last_color_;
+    std::atomic<int64_t> last_depth_;
+    std::atomic<bool> color_started_;
+    std::atomic<bool> depth_started_;
+};
+
+} // namespace ta
+
+#endif // TA_WATCHDOG_FRAME_LISTENER_H
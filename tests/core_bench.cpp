@@ -0,0 +1,179 @@
+/**
+ @file
+ core_bench - times the per-frame paths of the core on synthetic frames
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "depth_codec.h"
+#include "depth_kernels.h"
+#include "frame_convert.h"
+#include "frame_window.h"
+#include "height_map.h"
+#include "registration_maps.h"
+#include "row_pool.h"
+#include "voxel_grid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace
+{
+
+const int DEPTH_WIDTH = 512;
+const int DEPTH_HEIGHT = 424;
+const int RGB_WIDTH = 1920;
+const int RGB_HEIGHT = 1080;
+
+// the median of runs, in ms (the first call is a warm-up)
+void bench(const char *name, int runs, const std::function<void()> &body)
+{
+    std::vector<double> times;
+    body();
+    for (int i = 0; i < runs; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        body();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    std::printf("%-36s %8.3f ms  (min %.3f, max %.3f)\n", name, times[times.size() / 2], times.front(), times.back());
+}
+
+ta::MatrixView matrix(std::vector<unsigned char> &data, ta::ElementType type, int width, int height, int planes, int element)
+{
+    data.resize((size_t)width * height * planes * element);
+    ta::MatrixView view = { &data[0], type, width, height, planes, (ptrdiff_t)width * planes * element };
+    return view;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    const int runs = argc > 1 ? std::max(1, atoi(argv[1])) : 50;
+    const size_t threads = ta::RowPool::defaultThreads();
+    std::printf("%d runs, %d worker threads\n", runs, (int)threads);
+
+    // a tilted wall 1..3 m away with a ring of sensor noise and an invalid border
+    std::vector<float> depth((size_t)DEPTH_WIDTH * DEPTH_HEIGHT);
+    std::vector<float> points(depth.size() * 3);
+    std::vector<float> uv(depth.size() * 2);
+    for (int y = 0; y < DEPTH_HEIGHT; y++) {
+        for (int x = 0; x < DEPTH_WIDTH; x++) {
+            const size_t i = (size_t)y * DEPTH_WIDTH + x;
+            const bool border = x < 16 || x >= DEPTH_WIDTH - 16;
+            depth[i] = border ? 0.0f : 1000.0f + 4.0f * x + (float)((x * 7 + y * 13) % 5);
+            const float z = depth[i] * 0.001f;
+            points[3 * i] = (x - DEPTH_WIDTH / 2) * z / 365.0f;
+            points[3 * i + 1] = (y - DEPTH_HEIGHT / 2) * z / 365.0f;
+            points[3 * i + 2] = z;
+            uv[2 * i] = border ? -1.0f : x * 3.5f;
+            uv[2 * i + 1] = border ? -1.0f : y * 2.5f;
+        }
+    }
+    std::vector<unsigned char> bgrx((size_t)RGB_WIDTH * RGB_HEIGHT * 4);
+    for (size_t i = 0; i < bgrx.size(); i++)
+        bgrx[i] = (unsigned char)(i * 31);
+    const ta::ImageView<const unsigned char> colour = ta::ImageView<const unsigned char>::packed(&bgrx[0], RGB_WIDTH, RGB_HEIGHT, 4);
+    const ta::ImageView<const float> depth_view = ta::ImageView<const float>::packed(&depth[0], DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+
+    std::vector<unsigned char> out;
+    ta::MatrixView argb = matrix(out, ta::ElementChar, RGB_WIDTH, RGB_HEIGHT, 4, 1);
+    bench("convertColor 1920x1080 char x4", runs, [&]() { ta::convertColor(colour, argb); });
+    ta::MatrixView argbf = matrix(out, ta::ElementFloat32, RGB_WIDTH, RGB_HEIGHT, 4, 4);
+    bench("convertColor 1920x1080 float32 x4", runs, [&]() { ta::convertColor(colour, argbf); });
+    ta::MatrixView depthf = matrix(out, ta::ElementFloat32, DEPTH_WIDTH, DEPTH_HEIGHT, 1, 4);
+    bench("convertFloat depth float32 x1", runs, [&]() { ta::convertFloat(depth_view, 1.0f, depthf); });
+    ta::MatrixView depthc = matrix(out, ta::ElementChar, DEPTH_WIDTH, DEPTH_HEIGHT, 1, 1);
+    bench("convertFloat depth char x1", runs, [&]() { ta::convertFloat(depth_view, 255.0f / 4500.0f, depthc); });
+
+    // the depth stage's kernels, banded over the pool as DepthStage runs them
+    libfreenect2::Freenect2Device::IrCameraParams ir;
+    libfreenect2::Freenect2Device::ColorCameraParams color;
+    std::memset(&ir, 0, sizeof(ir));
+    std::memset(&color, 0, sizeof(color));
+    ir.fx = ir.fy = 365.0f;
+    ir.cx = 256.0f;
+    ir.cy = 212.0f;
+    ir.k1 = 0.09f;
+    ir.k2 = -0.27f;
+    ir.k3 = 0.09f;
+    color.fx = color.fy = 1081.0f;
+    color.cx = 959.5f;
+    color.cy = 539.5f;
+    color.shift_d = 863.0f;
+    color.shift_m = 52.0f;
+    color.mx_x1y0 = 0.8f;
+    color.my_x0y1 = 0.55f;
+    ta::RegistrationMaps *maps = 0;
+    bench("RegistrationMaps build", runs / 10 + 1, [&]() {
+        delete maps;
+        maps = new ta::RegistrationMaps(ir, color, 0);
+    });
+
+    ta::RowPool pool(threads);
+    std::vector<float> kernel_out((size_t)ta::BigDepthWidth * ta::BigDepthHeight);
+    const ta::ImageView<float> bigdepth = ta::ImageView<float>::packed(&kernel_out[0], ta::BigDepthWidth, ta::BigDepthHeight, 1);
+    bench("bigDepthRows 1920x1082", runs, [&]() {
+        pool.run([&](int first, int end) { ta::bigDepthRows(*maps, depth_view, bigdepth, first, end); }, ta::BigDepthHeight);
+    });
+    const ta::ImageView<float> uv_map = ta::ImageView<float>::packed(&kernel_out[0], DEPTH_WIDTH, DEPTH_HEIGHT, 2);
+    bench("uvRows", runs, [&]() { pool.run([&](int first, int end) { ta::uvRows(*maps, depth_view, uv_map, first, end); }); });
+    const ta::ImageView<float> xyz = ta::ImageView<float>::packed(&kernel_out[0], DEPTH_WIDTH, DEPTH_HEIGHT, 3);
+    bench("normalRows", runs, [&]() { pool.run([&](int first, int end) { ta::normalRows(*maps, depth_view, xyz, first, end); }); });
+    bench("pointRows", runs, [&]() { pool.run([&](int first, int end) { ta::pointRows(*maps, depth_view, xyz, first, end); }); });
+
+    ta::ImageView<float> levels[ta::PyramidLevels];
+    float *level_data = &kernel_out[0];
+    for (int l = 1; l <= ta::PyramidLevels; l++) {
+        levels[l - 1] = ta::ImageView<float>::packed(level_data, DEPTH_WIDTH >> l, DEPTH_HEIGHT >> l, 1);
+        level_data += (DEPTH_WIDTH >> l) * (DEPTH_HEIGHT >> l);
+    }
+    bench("pyramidRows 3 levels, min", runs, [&]() {
+        pool.run([&](int first, int end) { ta::pyramidRows(depth_view, levels, ta::PyramidLevels, ta::ReduceMin, first, end); },
+                 DEPTH_HEIGHT >> ta::PyramidLevels);
+    });
+    bench("pyramidRows 3 levels, median", runs, [&]() {
+        pool.run([&](int first, int end) { ta::pyramidRows(depth_view, levels, ta::PyramidLevels, ta::ReduceMedian, first, end); },
+                 DEPTH_HEIGHT >> ta::PyramidLevels);
+    });
+
+    std::vector<float> previous(depth.size(), 2000.0f);
+    const ta::ImageView<float> previous_view = ta::ImageView<float>::packed(&previous[0], DEPTH_WIDTH, DEPTH_HEIGHT, 1);
+    const ta::ImageView<float> motion = ta::ImageView<float>::packed(&kernel_out[0], ta::MotionTilesX, ta::MotionTilesY, 1);
+    bench("motionRows 16x16 tiles", runs, [&]() {
+        pool.run([&](int first, int end) { ta::motionRows(depth_view, previous_view, motion, first, end); }, ta::MotionTilesY);
+    });
+    delete maps;
+
+    ta::DepthCodec codec;
+    std::vector<unsigned char> encoded(codec.maxEncodedSize());
+    size_t size = 0;
+    bench("DepthCodec encode", runs, [&]() { size = codec.encode(&depth[0], &encoded[0]); });
+    std::vector<float> decoded(depth.size());
+    bench("DepthCodec decode", runs, [&]() { codec.decode(&encoded[0], size, &decoded[0]); });
+    std::printf("%-36s %8.1f %%\n", "DepthCodec size", 100.0 * size / (depth.size() * sizeof(uint16_t)));
+
+    ta::FrameWindow window(depth.size(), 30);
+    bench("FrameWindow push (30 frames)", runs, [&]() { window.push(&depth[0]); });
+
+    ta::VoxelGrid grid(threads);
+    bench("VoxelGrid 2 cm, colour", runs, [&]() { grid.build(&points[0], DEPTH_WIDTH, DEPTH_HEIGHT, 0.02f, &uv[0], colour); });
+    std::printf("%-36s %8d voxels\n", "VoxelGrid 2 cm", grid.count());
+
+    const float floor[12] = { 1, 0, 0, 0, 0, 0, 1, -2, 0, -1, 0, 1 };
+    ta::HeightMap map(threads);
+    bench("HeightMap 256x256 max height", runs, [&]() {
+        map.build(&points[0], DEPTH_WIDTH, DEPTH_HEIGHT, floor, 0.02f, 256, 256, ta::HeightMap::MaxHeight, -10.0f, 10.0f);
+    });
+    bench("HeightMap 256x256 hit count", runs, [&]() {
+        map.build(&points[0], DEPTH_WIDTH, DEPTH_HEIGHT, floor, 0.02f, 256, 256, ta::HeightMap::HitCount, -10.0f, 10.0f);
+    });
+    return 0;
+}
@@ -0,0 +1,725 @@
+/**
+ @file
+ core_tests - checks of the Max-independent core: conversion, depth codec,
+ frame window, voxel grid, height map, calibration cache, registration maps,
+ depth kernels, shared-memory ring, fusion target and cloud writer
+
+	Copyright 2015 - Tiago Ângelo aka p1nh0 (p1nh0.c0d1ng@gmail.com) — Digitópia/Casa da Música
+ */
+
+#include "calibration_cache.h"
+#include "cloud_writer.h"
+#include "depth_codec.h"
+#include "depth_kernels.h"
+#include "frame_convert.h"
+#include "frame_window.h"
+#include "fusion_target.h"
+#include "height_map.h"
+#include "registration_maps.h"
+#include "row_pool.h"
+#include "shared_frame_ring.h"
+#include "voxel_grid.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+int s_failures = 0;
+
+#define CHECK(condition)                                                        \
+    do {                                                                        \
+        if (!(condition)) {                                                     \
+            std::printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #condition); \
+            s_failures++;                                                       \
+        }                                                                       \
+    } while (0)
+
+bool near(float a, float b, float tolerance = 1e-5f)
+{
+    return std::fabs(a - b) <= tolerance;
+}
+
+ta::MatrixView matrix(void *data, ta::ElementType type, int width, int height, int planes, ptrdiff_t stride)
+{
+    ta::MatrixView view = { data, type, width, height, planes, stride };
+    return view;
+}
+
+// a fresh directory under /tmp, removed (with what the tests put in it) by cleanDirectory()
+std::string tempDirectory()
+{
+    char name[] = "/tmp/ta_kinect2_tests_XXXXXX";
+    return mkdtemp(name) ? name : "/tmp";
+}
+
+void cleanDirectory(const std::string &directory, const char *const *files)
+{
+    for (; *files; files++)
+        unlink((directory + "/" + *files).c_str());
+    rmdir(directory.c_str());
+}
+
+// made-up but plausible camera parameters: no lens distortion, the colour
+// image about 3.75 x 2.5 times the depth image's extent, straight rows
+void cameraParams(libfreenect2::Freenect2Device::IrCameraParams &ir, libfreenect2::Freenect2Device::ColorCameraParams &colour)
+{
+    std::memset(&ir, 0, sizeof(ir));
+    ir.fx = ir.fy = 365.0f;
+    ir.cx = 256.0f;
+    ir.cy = 212.0f;
+    std::memset(&colour, 0, sizeof(colour));
+    colour.fx = colour.fy = 1081.0f;
+    colour.cx = 959.5f;
+    colour.cy = 539.5f;
+    colour.shift_d = 863.0f;
+    colour.shift_m = 52.0f;
+    colour.mx_x1y0 = 0.8f;
+    colour.my_x0y1 = 0.55f;
+}
+
+// a tilted wall 1..3 m away with a ring of sensor noise and an invalid border
+std::vector<float> wallDepth()
+{
+    std::vector<float> depth((size_t)ta::DepthWidth * ta::DepthHeight);
+    for (int y = 0; y < ta::DepthHeight; y++)
+        for (int x = 0; x < ta::DepthWidth; x++)
+            depth[(size_t)y * ta::DepthWidth + x] = x < 16 || x >= ta::DepthWidth - 16 ? 0.0f : 1000.0f + 4.0f * x + (float)((x * 7 + y * 13) % 5);
+    return depth;
+}
+
+/************************************************************************************/
+
+void testConvertColor()
+{
+    // two BGRX pixels
+    const unsigned char bgrx[8] = { 10, 20, 30, 255, 200, 100, 0, 7 };
+    const ta::ImageView<const unsigned char> src = ta::ImageView<const unsigned char>::packed(bgrx, 2, 1, 4);
+
+    unsigned char argb[8];
+    CHECK(ta::convertColor(src, matrix(argb, ta::ElementChar, 2, 1, 4, 8)));
+    const unsigned char expected[8] = { 255, 30, 20, 10, 7, 0, 100, 200 };
+    CHECK(std::memcmp(argb, expected, 8) == 0);
+
+    // padded rows: the padding stays as it was
+    unsigned char rgb[2][8];
+    std::memset(rgb, 0xee, sizeof(rgb));
+    const unsigned char two_rows[16] = { 10, 20, 30, 255, 200, 100, 0, 7, 1, 2, 3, 4, 5, 6, 7, 8 };
+    CHECK(ta::convertColor(ta::ImageView<const unsigned char>::packed(two_rows, 2, 2, 4), matrix(rgb, ta::ElementChar, 2, 2, 3, 8)));
+    CHECK(rgb[0][0] == 30 && rgb[0][1] == 20 && rgb[0][2] == 10);
+    CHECK(rgb[1][3] == 7 && rgb[1][4] == 6 && rgb[1][5] == 5);
+    CHECK(rgb[0][6] == 0xee && rgb[1][7] == 0xee);
+
+    float argbf[8];
+    CHECK(ta::convertColor(src, matrix(argbf, ta::ElementFloat32, 2, 1, 4, sizeof(argbf))));
+    CHECK(near(argbf[0], 1.0f) && near(argbf[1], 30 / 255.0f) && near(argbf[7], 200 / 255.0f));
+
+    unsigned char luma[2];
+    CHECK(ta::convertColor(src, matrix(luma, ta::ElementChar, 2, 1, 1, 2)));
+    CHECK(luma[0] == (29 * 10 + 150 * 20 + 77 * 30 + 128) >> 8);
+
+    CHECK(!ta::convertColor(ta::ImageView<const unsigned char>(), matrix(argb, ta::ElementChar, 2, 1, 4, 8)));
+}
+
+void testConvertFloat()
+{
+    const float inf = std::numeric_limits<float>::infinity();
+    const float depth[4] = { 0.0f, 1000.0f, 4500.0f, inf };
+    const ta::ImageView<const float> src = ta::ImageView<const float>::packed(depth, 4, 1, 1);
+
+    unsigned char bytes[4];
+    CHECK(ta::convertFloat(src, 255.0f / 4500.0f, matrix(bytes, ta::ElementChar, 4, 1, 1, 4)));
+    CHECK(bytes[0] == 0 && bytes[1] == 57 && bytes[2] == 255 && bytes[3] == 0);
+
+    int32_t longs[4];
+    CHECK(ta::convertFloat(src, 1.0f, matrix(longs, ta::ElementLong, 4, 1, 1, sizeof(longs))));
+    CHECK(longs[1] == 1000 && longs[2] == 4500 && longs[3] == 0);
+
+    // a single plane fills every destination plane
+    double doubles[4 * 3];
+    CHECK(ta::convertFloat(src, 1.0f, matrix(doubles, ta::ElementFloat64, 4, 1, 3, sizeof(doubles))));
+    CHECK(doubles[3] == 1000.0 && doubles[4] == 1000.0 && doubles[5] == 1000.0);
+
+    // two planes into three: the third is 0; signed values with an offset into char
+    const float uv[4] = { -1.0f, 0.5f, 1.0f, 0.0f };
+    unsigned char signed_bytes[2 * 3];
+    std::memset(signed_bytes, 0xee, sizeof(signed_bytes));
+    CHECK(ta::convertFloat(ta::ImageView<const float>::packed(uv, 2, 1, 2), 127.5f, 127.5f,
+                           matrix(signed_bytes, ta::ElementChar, 2, 1, 3, 6)));
+    CHECK(signed_bytes[0] == 0 && signed_bytes[1] == 191 && signed_bytes[2] == 0);
+    CHECK(signed_bytes[3] == 255 && signed_bytes[4] == 128 && signed_bytes[5] == 0);
+}
+
+/************************************************************************************/
+
+void testDepthCodec()
+{
+    const int width = 64, height = 48;
+    std::vector<float> depth((size_t)width * height);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            depth[(size_t)y * width + x] = x < 8 ? 0.0f : 500.0f + 10.0f * x + (float)((x * 7 + y * 13) % 5);
+    depth[100] = std::numeric_limits<float>::quiet_NaN();
+    depth[101] = -3.0f;
+    depth[102] = 70000.0f;
+    depth[103] = 1234.4f;
+
+    ta::DepthCodec codec(width, height);
+    std::vector<unsigned char> encoded(codec.maxEncodedSize());
+    const size_t size = codec.encode(&depth[0], &encoded[0]);
+    CHECK(size > 0 && size <= codec.maxEncodedSize());
+    CHECK(size < depth.size() * sizeof(uint16_t));
+
+    std::vector<float> decoded(depth.size(), -1.0f);
+    CHECK(codec.decode(&encoded[0], size, &decoded[0]));
+    std::vector<uint16_t> expected(depth.size());
+    ta::DepthCodec::quantize(&depth[0], &expected[0], depth.size());
+    CHECK(expected[100] == 0 && expected[101] == 0 && expected[102] == 65535 && expected[103] == 1234);
+    bool same = true;
+    for (size_t i = 0; i < depth.size(); i++)
+        same = same && decoded[i] == (float)expected[i];
+    CHECK(same);
+
+    std::vector<uint16_t> mm(depth.size());
+    CHECK(codec.decode(&encoded[0], size, &mm[0]));
+    CHECK(mm == expected);
+
+    CHECK(!codec.decode(&encoded[0], size / 2, &mm[0]));
+    ta::DepthCodec other(width / 2, height);
+    CHECK(!other.decode(&encoded[0], size, &mm[0]));
+}
+
+/************************************************************************************/
+
+void testFrameWindow()
+{
+    ta::FrameWindow window(2, 3);
+    CHECK(window.frames() == 3 && window.frameSize() == 2 && window.count() == 0);
+    CHECK(window.window()[0] == 0.0f && window.window()[5] == 0.0f);
+
+    for (int i = 1; i <= 4; i++) {
+        const float frame[2] = { (float)i, (float)-i };
+        window.push(frame);
+    }
+    CHECK(window.count() == 3);
+    // frames 2, 3, 4, oldest first
+    const float *w = window.window();
+    CHECK(w[0] == 2.0f && w[1] == -2.0f && w[2] == 3.0f && w[4] == 4.0f && w[5] == -4.0f);
+
+    window.clear();
+    CHECK(window.count() == 0 && window.window()[4] == 0.0f);
+}
+
+/************************************************************************************/
+
+void testVoxelGrid()
+{
+    // two points share a voxel, only one of them has a colour pixel; one point elsewhere, one without depth
+    const float points[4 * 3] = { 0.01f, 0.01f, 1.0f, 0.03f, 0.05f, 1.02f, 1.0f, 0.0f, 2.0f, 0.5f, 0.5f, 0.0f };
+    const float uv[4 * 2] = { 0, 0, -1, -1, 1, 0, 0, 0 };
+    const unsigned char bgrx[2 * 4] = { 0, 0, 255, 0, 255, 0, 0, 0 };
+
+    ta::VoxelGrid grid(1);
+    const int count = grid.build(points, 4, 1, 0.1f, uv, ta::ImageView<const unsigned char>::packed(bgrx, 2, 1, 4));
+    CHECK(count == 2 && grid.count() == 2 && grid.dropped() == 0);
+    const float *v = grid.voxels();
+    const float *shared = v[2] < 1.5f ? v : v + ta::VoxelGrid::Planes;
+    const float *single = v[2] < 1.5f ? v + ta::VoxelGrid::Planes : v;
+    CHECK(near(shared[0], 0.02f) && near(shared[1], 0.03f) && near(shared[2], 1.01f));
+    CHECK(near(shared[3], 1.0f) && near(shared[4], 0.0f) && near(shared[5], 0.0f)); // not halved
+    CHECK(near(single[2], 2.0f) && near(single[5], 1.0f));
+
+    // without colour the colour planes are 0
+    CHECK(grid.build(points, 4, 1, 0.1f) == 2 && grid.voxels()[3] == 0.0f);
+
+    // the smallest table holds 8 voxels, the rest is dropped
+    std::vector<float> spread(20 * 3);
+    for (int i = 0; i < 20; i++) {
+        spread[3 * i] = (float)i;
+        spread[3 * i + 2] = 1.0f;
+    }
+    ta::VoxelGrid small(1, 16);
+    CHECK(small.build(&spread[0], 20, 1, 0.5f) == 8);
+    CHECK(small.dropped() == 12);
+
+    // bands on several threads agree with one
+    ta::VoxelGrid threaded(4);
+    std::vector<float> cloud(64 * 64 * 3);
+    for (int i = 0; i < 64 * 64; i++) {
+        cloud[3 * i] = (i % 64) * 0.01f;
+        cloud[3 * i + 1] = (i / 64) * 0.01f;
+        cloud[3 * i + 2] = 1.0f + (i % 7) * 0.01f;
+    }
+    CHECK(threaded.build(&cloud[0], 64, 64, 0.08f) == grid.build(&cloud[0], 64, 64, 0.08f));
+}
+
+/************************************************************************************/
+
+void testHeightMap()
+{
+    // camera -> floor: x stays, camera z becomes floor y, camera -y becomes height
+    const float transform[12] = { 1, 0, 0, 0, 0, 0, 1, -2, 0, -1, 0, 1 };
+    const float points[4 * 3] = {
+        0.05f, -0.5f, 2.05f, // height 1.5 over cell (10, 10)
+        0.05f, 0.5f, 2.05f,  // height 0.5, same cell
+        0.35f, 0.0f, 2.05f,  // height 1.0, cell (13, 10)
+        0.05f, -2.0f, 0.0f   // no depth
+    };
+
+    ta::HeightMap map(2);
+    map.build(points, 4, 1, transform, 0.1f, 20, 20, ta::HeightMap::MaxHeight, 0.1f, 2.0f);
+    CHECK(map.gridWidth() == 20 && map.gridHeight() == 20);
+    const float *grid = map.grid();
+    CHECK(near(grid[10 * 20 + 10], 1.5f));
+    CHECK(near(grid[10 * 20 + 13], 1.0f));
+    float total = 0.0f;
+    for (int i = 0; i < 20 * 20; i++)
+        total += grid[i];
+    CHECK(near(total, 2.5f));
+
+    map.build(points, 4, 1, transform, 0.1f, 20, 20, ta::HeightMap::HitCount, 0.1f, 2.0f);
+    CHECK(map.grid()[10 * 20 + 10] == 2.0f && map.grid()[10 * 20 + 13] == 1.0f);
+
+    // the height band drops the low point
+    map.build(points, 4, 1, transform, 0.1f, 20, 20, ta::HeightMap::HitCount, 0.8f, 2.0f);
+    CHECK(map.grid()[10 * 20 + 10] == 1.0f);
+
+    map.build(points, 4, 1, transform, 0.1f, 0, 5000, ta::HeightMap::MaxHeight, 0.0f, 2.0f);
+    CHECK(map.gridWidth() == 1 && map.gridHeight() == ta::HeightMap::MaxDim);
+}
+
+/************************************************************************************/
+
+void testCalibrationCache()
+{
+    const std::string directory = tempDirectory();
+    const char *const files[] = { "A123_1.2.3.k2cal", 0 };
+    const uint32_t table[4] = { 1, 2, 3, 4 };
+    const uint64_t key = ta::CalibrationCache::hash("parameters", 10);
+    CHECK(key == ta::CalibrationCache::hash("parameters", 10));
+    CHECK(key != ta::CalibrationCache::hash("parameters", 10, 1));
+    {
+        ta::CalibrationCache cache(directory, "A123", "1.2.3");
+        CHECK(cache.path() == directory + "/" + files[0]);
+        CHECK(cache.find(ta::CalibrationCache::TrigTables, key, sizeof(table)) == 0);
+        cache.store(ta::CalibrationCache::TrigTables, key, table, sizeof(table));
+        CHECK(cache.save());
+        const void *found = cache.find(ta::CalibrationCache::TrigTables, key, sizeof(table));
+        CHECK(found && std::memcmp(found, table, sizeof(table)) == 0);
+    }
+
+    // a later session finds it; another key, size or tag misses
+    ta::CalibrationCache cache(directory, "A123", "1.2.3");
+    const void *found = cache.find(ta::CalibrationCache::TrigTables, key, sizeof(table));
+    CHECK(found && std::memcmp(found, table, sizeof(table)) == 0);
+    CHECK(((uintptr_t)found & 63) == 0);
+    CHECK(cache.find(ta::CalibrationCache::TrigTables, key + 1, sizeof(table)) == 0);
+    CHECK(cache.find(ta::CalibrationCache::TrigTables, key, sizeof(table) - 4) == 0);
+    CHECK(cache.find(ta::CalibrationCache::RegistrationMaps, key, sizeof(table)) == 0);
+    cleanDirectory(directory, files);
+}
+
+/************************************************************************************/
+
+void testRegistrationMaps()
+{
+    libfreenect2::Freenect2Device::IrCameraParams ir;
+    libfreenect2::Freenect2Device::ColorCameraParams colour;
+    cameraParams(ir, colour);
+    const std::string directory = tempDirectory();
+    const char *const files[] = { "A123_1.2.3.k2cal", 0 };
+    const size_t n = (size_t)ta::DepthWidth * ta::DepthHeight;
+
+    ta::CalibrationCache cache(directory, "A123", "1.2.3");
+    ta::RegistrationMaps built(ir, colour, &cache);
+    CHECK(!built.fromCache());
+    CHECK(cache.save());
+
+    // no lens distortion: every undistorted pixel reads itself
+    CHECK(built.distortMap()[0] == 0 && built.distortMap()[200 * ta::DepthWidth + 300] == 200 * ta::DepthWidth + 300);
+    CHECK(built.distortMap()[n - 1] == (int)n - 1);
+    for (int y = 0; y < ta::DepthHeight; y += 53) {
+        for (int x = 0; x < ta::DepthWidth; x += 64) {
+            const int yi = built.mapYi()[y * ta::DepthWidth + x];
+            CHECK(yi == (int)(built.mapY()[y * ta::DepthWidth + x] + 0.5f));
+            CHECK(yi >= built.rowMinYi(y) && yi <= built.rowMaxYi(y));
+        }
+    }
+
+    ta::CalibrationCache reopened(directory, "A123", "1.2.3");
+    ta::RegistrationMaps cached(ir, colour, &reopened);
+    CHECK(cached.fromCache());
+    CHECK(std::memcmp(cached.distortMap(), built.distortMap(), n * sizeof(int)) == 0);
+    CHECK(std::memcmp(cached.mapX(), built.mapX(), n * sizeof(float)) == 0);
+    CHECK(std::memcmp(cached.mapY(), built.mapY(), n * sizeof(float)) == 0);
+    CHECK(std::memcmp(cached.mapYi(), built.mapYi(), n * sizeof(int)) == 0);
+    CHECK(cached.rowMinYi(100) == built.rowMinYi(100) && cached.rowMaxYi(423) == built.rowMaxYi(423));
+
+    // recalibrated: the stale maps are not used
+    ir.fx += 1.0f;
+    ta::RegistrationMaps recalibrated(ir, colour, &reopened);
+    CHECK(!recalibrated.fromCache());
+    cleanDirectory(directory, files);
+}
+
+/************************************************************************************/
+
+// the median / min of the valid pixels of a block, 0 if none
+float reduceReference(float a, float b, float c, float d, int reduction)
+{
+    float v[4];
+    int n = 0;
+    if (a > 0.0f) v[n++] = a;
+    if (b > 0.0f) v[n++] = b;
+    if (c > 0.0f) v[n++] = c;
+    if (d > 0.0f) v[n++] = d;
+    if (!n)
+        return 0.0f;
+    std::sort(v, v + n);
+    if (reduction == ta::ReduceMin)
+        return v[0];
+    return n % 2 ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+}
+
+void testDepthKernels()
+{
+    libfreenect2::Freenect2Device::IrCameraParams ir;
+    libfreenect2::Freenect2Device::ColorCameraParams colour;
+    cameraParams(ir, colour);
+    ta::RegistrationMaps maps(ir, colour, 0);
+    const int w = ta::DepthWidth, h = ta::DepthHeight;
+    const size_t n = (size_t)w * h;
+
+    // holes of every count per 2x2 block
+    std::vector<float> depth = wallDepth();
+    for (size_t i = 0; i < n; i++)
+        if ((i * 7 + i / w * 3) % 11 < 3)
+            depth[i] = 0.0f;
+    const ta::ImageView<const float> depth_view = ta::ImageView<const float>::packed(&depth[0], w, h, 1);
+    ta::RowPool pool(3);
+
+    // points: metres, pixel centres through the IR intrinsics
+    std::vector<float> points(n * 3, -1.0f);
+    const ta::ImageView<float> points_view = ta::ImageView<float>::packed(&points[0], w, h, 3);
+    pool.run([&](int first, int end) { ta::pointRows(maps, depth_view, points_view, first, end); });
+    bool projected = true;
+    for (int y = 0; y < h; y += 7) {
+        for (int x = 0; x < w; x += 5) {
+            const float *p = &points[3 * ((size_t)y * w + x)];
+            const float z = depth[(size_t)y * w + x] * 0.001f; // 0 for holes and the border
+            projected = projected && near(p[2], z) && near(p[0], (x + 0.5f - ir.cx) / ir.fx * z) && near(p[1], (y + 0.5f - ir.cy) / ir.fy * z);
+        }
+    }
+    CHECK(projected);
+
+    // uv: the colour pixel of every depth pixel, -1 where there is no depth
+    std::vector<float> uv(n * 2);
+    const ta::ImageView<float> uv_view = ta::ImageView<float>::packed(&uv[0], w, h, 2);
+    pool.run([&](int first, int end) { ta::uvRows(maps, depth_view, uv_view, first, end); });
+    int checked = 0;
+    for (size_t i = 0; i < n; i += 97) {
+        const float d = depth[maps.distortMap()[i]];
+        if (d > 0.0f) {
+            CHECK(near(uv[2 * i], (maps.mapX()[i] + colour.shift_m / d) * colour.fx + colour.cx, 1e-3f));
+            CHECK(uv[2 * i + 1] == maps.mapY()[i]);
+            checked++;
+        }
+        else {
+            CHECK(uv[2 * i] == -1.0f && uv[2 * i + 1] == -1.0f);
+        }
+    }
+    CHECK(checked > 1000);
+
+    // bigdepth: banded the same as in one go (the filter window crosses band edges)
+    std::vector<float> whole((size_t)ta::BigDepthWidth * ta::BigDepthHeight);
+    std::vector<float> banded(whole.size());
+    const ta::ImageView<float> whole_view = ta::ImageView<float>::packed(&whole[0], ta::BigDepthWidth, ta::BigDepthHeight, 1);
+    const ta::ImageView<float> banded_view = ta::ImageView<float>::packed(&banded[0], ta::BigDepthWidth, ta::BigDepthHeight, 1);
+    ta::bigDepthRows(maps, depth_view, whole_view, 0, ta::BigDepthHeight);
+    ta::RowPool(5).run([&](int first, int end) { ta::bigDepthRows(maps, depth_view, banded_view, first, end); }, ta::BigDepthHeight);
+    CHECK(std::memcmp(&whole[0], &banded[0], whole.size() * sizeof(float)) == 0);
+    size_t finite = 0;
+    float lowest = std::numeric_limits<float>::infinity();
+    for (size_t i = 0; i < whole.size(); i++) {
+        if (std::isfinite(whole[i])) {
+            finite++;
+            lowest = std::min(lowest, whole[i]);
+        }
+    }
+    CHECK(finite > whole.size() / 10 && lowest >= 1000.0f);
+
+    // pyramid: every level against a scalar reduction of the one above, banded by rows of the deepest
+    for (int reduction = ta::ReduceMin; reduction <= ta::ReduceMedian; reduction++) {
+        std::vector<float> levels[ta::PyramidLevels];
+        ta::ImageView<float> level_views[ta::PyramidLevels];
+        for (int l = 1; l <= ta::PyramidLevels; l++) {
+            levels[l - 1].assign((size_t)(w >> l) * (h >> l), -1.0f);
+            level_views[l - 1] = ta::ImageView<float>::packed(&levels[l - 1][0], w >> l, h >> l, 1);
+        }
+        pool.run([&](int first, int end) { ta::pyramidRows(depth_view, level_views, ta::PyramidLevels, reduction, first, end); },
+                 h >> ta::PyramidLevels);
+        bool same = true;
+        for (int l = 1; l <= ta::PyramidLevels; l++) {
+            const float *above = l == 1 ? &depth[0] : &levels[l - 2][0];
+            const int lw = w >> l, lh = h >> l, aw = w >> (l - 1);
+            for (int y = 0; y < lh; y++) {
+                for (int x = 0; x < lw; x++) {
+                    const float *block = above + (size_t)2 * y * aw + 2 * x;
+                    same = same && levels[l - 1][(size_t)y * lw + x] == reduceReference(block[0], block[1], block[aw], block[aw + 1], reduction);
+                }
+            }
+        }
+        CHECK(same);
+    }
+
+    // normals of a flat wall face the camera; a hole has none
+    std::vector<float> flat(n, 2000.0f);
+    flat[(size_t)200 * w + 200] = 0.0f;
+    const ta::ImageView<const float> flat_view = ta::ImageView<const float>::packed(&flat[0], w, h, 1);
+    std::vector<float> normals(n * 3, -1.0f);
+    const ta::ImageView<float> normals_view = ta::ImageView<float>::packed(&normals[0], w, h, 3);
+    pool.run([&](int first, int end) { ta::normalRows(maps, flat_view, normals_view, first, end); });
+    bool facing = true;
+    for (size_t i = 0; i < n; i += 13)
+        if (i != (size_t)200 * w + 200)
+            facing = facing && near(normals[3 * i], 0.0f, 1e-4f) && near(normals[3 * i + 1], 0.0f, 1e-4f) && near(normals[3 * i + 2], -1.0f, 1e-4f);
+    CHECK(facing);
+    const float *hole = &normals[3 * ((size_t)200 * w + 200)];
+    CHECK(hole[0] == 0.0f && hole[1] == 0.0f && hole[2] == 0.0f);
+    const float *next = &normals[3 * ((size_t)200 * w + 201)];
+    CHECK(near(next[2], -1.0f, 1e-4f)); // one neighbour along x is enough
+
+    // motion: mean clamped difference per tile, then the frame becomes the previous one
+    std::vector<float> previous = wallDepth();
+    std::vector<float> moved = previous;
+    for (int y = 3 * ta::MotionTile; y < 4 * ta::MotionTile; y++) {
+        for (int x = 2 * ta::MotionTile; x < 3 * ta::MotionTile; x++)
+            moved[(size_t)y * w + x] += 50.0f;
+        for (int x = 5 * ta::MotionTile; x < 6 * ta::MotionTile; x++)
+            moved[(size_t)y * w + x] += 1000.0f;
+    }
+    std::vector<float> motion(ta::MotionTiles, -1.0f);
+    const ta::ImageView<const float> moved_view = ta::ImageView<const float>::packed(&moved[0], w, h, 1);
+    const ta::ImageView<float> previous_view = ta::ImageView<float>::packed(&previous[0], w, h, 1);
+    const ta::ImageView<float> motion_view = ta::ImageView<float>::packed(&motion[0], ta::MotionTilesX, ta::MotionTilesY, 1);
+    pool.run([&](int first, int end) { ta::motionRows(moved_view, previous_view, motion_view, first, end); }, ta::MotionTilesY);
+    CHECK(near(motion[3 * ta::MotionTilesX + 2], 50.0f));
+    CHECK(near(motion[3 * ta::MotionTilesX + 5], ta::MotionMaxDifference));
+    float total = 0.0f;
+    for (int i = 0; i < ta::MotionTiles; i++)
+        total += motion[i];
+    CHECK(near(total, 50.0f + ta::MotionMaxDifference, 1e-3f));
+    CHECK(previous == moved);
+    pool.run([&](int first, int end) { ta::motionRows(moved_view, previous_view, motion_view, first, end); }, ta::MotionTilesY);
+    CHECK(*std::max_element(motion.begin(), motion.end()) == 0.0f);
+}
+
+/************************************************************************************/
+
+void testSharedFrameRing()
+{
+    char serial[32];
+    std::snprintf(serial, sizeof(serial), "test%d", (int)getpid());
+    std::vector<float> frame((size_t)ta::DepthWidth * ta::DepthHeight, 1500.0f);
+
+    ta::SharedFrameRingReader reader;
+    CHECK(!reader.open(serial)); // no writer yet
+    ta::SharedFrameRingWriter *writer = new ta::SharedFrameRingWriter(serial, 2);
+    CHECK(writer->ok());
+    CHECK(reader.open(serial) && reader.alive());
+    ta::SharedFrameView view;
+    CHECK(reader.latest(ta::SharedDepth) == 0 && !reader.acquire(ta::SharedDepth, view));
+
+    writer->publish(ta::SharedDepth, &frame[0], ta::DepthWidth, ta::DepthHeight, 4, 7, 700);
+    CHECK(reader.latest(ta::SharedDepth) == 1 && reader.latest(ta::SharedIr) == 0);
+    CHECK(reader.acquire(ta::SharedDepth, view));
+    CHECK(view.number == 1 && view.sequence == 7 && view.timestamp == 700);
+    CHECK(view.width == (uint32_t)ta::DepthWidth && view.height == (uint32_t)ta::DepthHeight && view.bytes_per_pixel == 4);
+    CHECK(std::memcmp(view.data, &frame[0], frame.size() * sizeof(float)) == 0);
+    CHECK(reader.valid(view));
+
+    // the next frame goes to the other slot; the one after that laps the view
+    frame[0] = 2000.0f;
+    writer->publish(ta::SharedDepth, &frame[0], ta::DepthWidth, ta::DepthHeight, 4, 8, 800);
+    CHECK(reader.valid(view));
+    ta::SharedFrameView newest;
+    CHECK(reader.acquire(ta::SharedDepth, newest) && newest.number == 2 && ((const float *)newest.data)[0] == 2000.0f);
+    writer->publish(ta::SharedDepth, &frame[0], ta::DepthWidth, ta::DepthHeight, 4, 9, 900);
+    CHECK(!reader.valid(view) && reader.valid(newest));
+    CHECK(reader.latest(ta::SharedDepth) == 3);
+
+    // too large for a slot: dropped
+    writer->publish(ta::SharedDepth, &frame[0], ta::DepthWidth, ta::DepthHeight * 2, 4, 10, 1000);
+    CHECK(reader.latest(ta::SharedDepth) == 3);
+
+    delete writer;
+    CHECK(!reader.alive());
+    reader.close();
+    CHECK(!reader.open(serial));
+}
+
+/************************************************************************************/
+
+void testFusionTarget()
+{
+    ta::FusionTarget *target = ta::FusionTarget::attach("core_tests");
+    ta::FusionTarget *same = ta::FusionTarget::attach("core_tests");
+    CHECK(target && target == same && target->name() == "core_tests");
+    const int a = target->join(), b = target->join();
+    CHECK(a >= 0 && b >= 0 && a != b);
+
+    ta::FusionTarget::Cloud cloud;
+    CHECK(!target->merge(cloud, 1000)); // nothing yet
+
+    // a is 1 m to the right of b
+    const float transform[16] = { 1, 0, 0, 1, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+    target->setTransform(a, transform);
+    const float from_a[2 * 3] = { 0.5f, 0.0f, 2.0f, 0.0f, 0.0f, 0.0f }; // the second has no depth
+    const float from_b[2 * 3] = { 0.0f, 1.0f, 3.0f, 0.0f, -1.0f, 3.0f };
+    target->contribute(a, from_a, 2, 1);
+    target->contribute(b, from_b, 2, 1);
+    CHECK(target->merge(cloud, 1000));
+    CHECK(cloud.count == 3 && cloud.sensors == 2 && cloud.points.size() >= 3 * (size_t)ta::FusionTarget::Planes);
+    bool found = false;
+    for (int i = 0; i < cloud.count; i++) {
+        const float *p = &cloud.points[(size_t)i * ta::FusionTarget::Planes];
+        if (p[3] == (float)a)
+            found = near(p[0], 1.5f) && near(p[1], 0.0f) && near(p[2], 2.0f);
+    }
+    CHECK(found);
+    CHECK(!target->merge(cloud, 1000));
+
+    // a stalls: outside the window of b's newest cloud it drops out
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    target->contribute(b, from_b, 2, 1);
+    CHECK(target->merge(cloud, 20));
+    CHECK(cloud.count == 2 && cloud.sensors == 1);
+    for (int i = 0; i < cloud.count; i++)
+        CHECK(cloud.points[(size_t)i * ta::FusionTarget::Planes + 3] == (float)b);
+
+    target->leave(a);
+    target->leave(b);
+    ta::FusionTarget::detach(same);
+    ta::FusionTarget::detach(target);
+}
+
+/************************************************************************************/
+
+void testCloudWriter()
+{
+    const std::string directory = tempDirectory();
+    const char *const files[] = { "clouds.takc", "frames_000000.ply", 0 };
+    const int w = 16, h = 8;
+    std::vector<float> depth((size_t)w * h), points(depth.size() * 3);
+    for (size_t i = 0; i < depth.size(); i++) {
+        depth[i] = i % 5 ? 1000.0f + i : 0.0f;
+        points[3 * i] = (float)i;
+        points[3 * i + 1] = -(float)i;
+        points[3 * i + 2] = depth[i] * 0.001f;
+    }
+    const uint32_t valid = (uint32_t)(depth.size() - (depth.size() + 4) / 5);
+
+    // a sequence with depth records: one frame with, one without
+    {
+        ta::CloudWriter writer(directory + "/" + files[0], ta::CloudWriter::Sequence, ta::CloudWriter::DepthRecord);
+        CHECK(writer.ok());
+        CHECK(writer.submit(&points[0], w, h, 0, ta::ImageView<const unsigned char>(), 5, 500, &depth[0]));
+        while (writer.written() < 1)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK(writer.submit(&points[0], w, h, 0, ta::ImageView<const unsigned char>(), 6, 600));
+    }
+    FILE *file = std::fopen((directory + "/" + files[0]).c_str(), "rb");
+    CHECK(file != 0);
+    std::vector<unsigned char> data;
+    if (file) {
+        unsigned char buffer[4096];
+        size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+            data.insert(data.end(), buffer, buffer + read);
+        std::fclose(file);
+    }
+    uint32_t words[6];
+    CHECK(data.size() > 16 + 2 * 24);
+    if (data.size() > 16 + 2 * 24) {
+        std::memcpy(words, &data[0], 16);
+        CHECK(words[0] == 0x434b4154 && words[1] == 2 && words[2] == ta::CloudWriter::DepthRecord);
+
+        std::memcpy(words, &data[16], 24);
+        CHECK(words[0] == 0x464b4154 && words[1] == 5 && words[2] == 500 && words[3] == valid && words[4] == 12 && words[5] > 0);
+        const size_t record = 16 + 24 + (size_t)valid * 12;
+        CHECK(std::memcmp(&data[16 + 24], &points[3], 12) == 0); // the first valid point
+        std::vector<float> decoded(depth.size());
+        CHECK(record + words[5] <= data.size() && ta::DepthCodec(w, h).decode(&data[record], words[5], &decoded[0]));
+        CHECK(decoded == depth);
+
+        const size_t second = record + words[5];
+        std::memcpy(words, &data[second], 24);
+        CHECK(words[0] == 0x464b4154 && words[1] == 6 && words[3] == valid && words[5] == 0);
+
+        // the footer points at the index of both frames
+        uint32_t footer[2];
+        uint64_t index = 0;
+        std::memcpy(footer, &data[data.size() - 16], 8);
+        std::memcpy(&index, &data[data.size() - 8], 8);
+        CHECK(footer[0] == 0x494b4154 && footer[1] == 2);
+        uint64_t offset = 0;
+        if (index + 8 <= data.size())
+            std::memcpy(&offset, &data[index], 8);
+        CHECK(offset == 16);
+    }
+
+    // PLY: colour from the uv map, which is black without a colour frame
+    std::vector<float> uv(depth.size() * 2, 0.0f);
+    {
+        ta::CloudWriter writer(directory + "/frames", ta::CloudWriter::PlyFiles);
+        CHECK(writer.ok());
+        CHECK(writer.submit(&points[0], w, h, &uv[0], ta::ImageView<const unsigned char>(), 5, 500));
+    }
+    file = std::fopen((directory + "/" + files[1]).c_str(), "rb");
+    CHECK(file != 0);
+    if (file) {
+        char header[512] = { 0 };
+        std::fread(header, 1, sizeof(header) - 1, file);
+        std::fclose(file);
+        char vertices[64];
+        std::snprintf(vertices, sizeof(vertices), "element vertex %u\n", valid);
+        CHECK(std::strncmp(header, "ply\n", 4) == 0 && std::strstr(header, vertices) && std::strstr(header, "property uchar red"));
+        CHECK(std::strstr(header, "sequence 5 timestamp 500") != 0);
+    }
+    cleanDirectory(directory, files);
+}
+
+}
+
+int main()
+{
+    testConvertColor();
+    testConvertFloat();
+    testDepthCodec();
+    testFrameWindow();
+    testVoxelGrid();
+    testHeightMap();
+    testCalibrationCache();
+    testRegistrationMaps();
+    testDepthKernels();
+    testSharedFrameRing();
+    testFusionTarget();
+    testCloudWriter();
+
+    if (s_failures)
+        std::printf("%d check(s) failed\n", s_failures);
+    else
+        std::printf("all checks passed\n");
+    return s_failures ? 1 : 0;
+}